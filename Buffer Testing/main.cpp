@@ -1,24 +1,359 @@
 #include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
 
-int main()
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gl_functions.h"
+
+// Render path benchmark for the star renderer.
+// Draws N points into an offscreen render texture through every candidate upload path and reports upload and
+// draw time per million points. Everything runs on a plain OpenGL 1.1 + buffer object context, so it also works on
+// GPU-less machines with Mesa's llvmpipe:
+//
+//     LIBGL_ALWAYS_SOFTWARE=1 xvfb-run "./Buffer Testing" --points=1000000 --frames=60
+//
+// options: --points=<n> --frames=<n> --width=<px> --height=<px>
+
+
+struct Options
+{
+    size_t points = 1'000'000;
+    unsigned frames = 60;
+    unsigned warmup = 5;
+    unsigned width = 1920;
+    unsigned height = 1080;
+};
+
+
+// a render path is a setup step, a per-frame upload of the current positions and a draw
+struct Path
+{
+    const char* name;
+    std::function<bool()> setup;    // false = not supported by this context
+    std::function<void()> upload;
+    std::function<void()> draw;
+    std::function<void()> teardown;
+};
+
+
+struct Result
 {
-    sf::RenderWindow window(sf::VideoMode(1000, 1000), "Vertex Buffer Testing and learning");
-    sf::CircleShape shape(100.f);
-    shape.setFillColor(sf::Color::Green);
+    const char* name;
+    bool supported;
+    double upload_ms;
+    double draw_ms;
+};
+
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(const Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+
+// the same fixed function point draw the star renderer uses, reading 8 byte positions from the bound buffer
+static void draw_gl_points(sf::RenderTarget& target, const GLuint buffer, const size_t byte_offset, const size_t count)
+{
+    const sf::View& view = target.getView();
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(view.getTransform().getMatrix());
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glColor4ub(80, 20, 40, 255);
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
 
-    while (window.isOpen())
+    const gl::Functions& f = gl::functions();
+    f.BindBuffer(gl::array_buffer, buffer);
+    glVertexPointer(2, GL_FLOAT, 0, reinterpret_cast<const void*>(byte_offset));
+    glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(count));
+    f.BindBuffer(gl::array_buffer, 0);
+
+    target.resetGLStates();
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
     {
-        sf::Event event;
-        while (window.pollEvent(event))
+        const std::string arg = argv[i];
+        const size_t equals = arg.find('=');
+        const std::string key = arg.substr(0, equals);
+        if (key != "--points" && key != "--frames" && key != "--width" && key != "--height")
+        {
+            std::printf("unknown option %s\noptions: --points=<n> --frames=<n> --width=<px> --height=<px>\n", arg.c_str());
+            return 1;
+        }
+
+        // every option is a count of at least 1, the whole value has to be a number
+        unsigned long long value = 0;
+        const char* const first = equals == std::string::npos ? arg.data() + arg.size() : arg.data() + equals + 1;
+        const char* const last = arg.data() + arg.size();
+        const auto [end, error] = std::from_chars(first, last, value);
+        const unsigned long long limit = key == "--points" ? SIZE_MAX : UINT_MAX;
+        if (first == last || error != std::errc{} || end != last || value < 1 || value > limit)
         {
-            if (event.type == sf::Event::Closed)
-                window.close();
+            std::printf("%s needs a whole number from 1 to %llu\n", key.c_str(), limit);
+            return 1;
         }
 
-        window.clear();
-        window.draw(shape);
-        window.display();
+        if (key == "--points") options.points = static_cast<size_t>(value);
+        else if (key == "--frames") options.frames = static_cast<unsigned>(value);
+        else if (key == "--width") options.width = static_cast<unsigned>(value);
+        else options.height = static_cast<unsigned>(value);
+    }
+
+    sf::RenderTexture target;
+    if (!target.create(options.width, options.height))
+    {
+        std::printf("could not create a %ux%u render texture\n", options.width, options.height);
+        return 1;
+    }
+    target.setActive(true);
+
+    std::printf("renderer: %s\nversion:  %s\n", reinterpret_cast<const char*>(glGetString(GL_RENDERER)), reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    std::printf("%zu points, %u frames, %ux%u\n\n", options.points, options.frames, options.width, options.height);
+
+    // positions drift a little every frame so that nothing can be cached between uploads
+    const size_t count = options.points;
+    std::vector<sf::Vector2f> positions(count);
+    std::vector<sf::Vector2f> velocities(count);
+    std::mt19937 rng{ 42 };
+    std::uniform_real_distribution<float> x_dist(0.f, static_cast<float>(options.width));
+    std::uniform_real_distribution<float> y_dist(0.f, static_cast<float>(options.height));
+    std::uniform_real_distribution<float> v_dist(-1.f, 1.f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        positions[i] = { x_dist(rng), y_dist(rng) };
+        velocities[i] = { v_dist(rng), v_dist(rng) };
+    }
+
+    auto move_points = [&]()
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            positions[i] += velocities[i];
+            if (positions[i].x < 0 || positions[i].x > options.width) velocities[i].x = -velocities[i].x;
+            if (positions[i].y < 0 || positions[i].y > options.height) velocities[i].y = -velocities[i].y;
+        }
+    };
+
+    const sf::RenderStates additive(sf::BlendAdd);
+    const gl::Functions& f = gl::functions();
+    const auto position_bytes = static_cast<gl::SizeIPtr>(count * sizeof(sf::Vector2f));
+
+    // shared state of the paths
+    sf::VertexArray vertices(sf::Points, count);
+    for (size_t i = 0; i < count; ++i)
+        vertices[i].color = sf::Color(80, 20, 40);
+
+    auto fill_vertices = [&]()
+    {
+        for (size_t i = 0; i < count; ++i)
+            vertices[i].position = positions[i];
+    };
+
+    sf::VertexBuffer vertex_buffer(sf::Points);
+    GLuint buffer = 0;
+    constexpr unsigned regions = 3;
+    sf::Vector2f* mapped = nullptr;
+    unsigned region = 0;
+    std::array<gl::Sync, regions> fences{};
+
+    auto make_vertex_buffer_path = [&](const char* name, const sf::VertexBuffer::Usage usage) -> Path
+    {
+        return {
+            name,
+            [&, usage]() { vertex_buffer.setUsage(usage); return sf::VertexBuffer::isAvailable() && vertex_buffer.create(count); },
+            [&]() { fill_vertices(); vertex_buffer.update(&vertices[0]); },
+            [&]() { target.draw(vertex_buffer, additive); },
+            [&]() { vertex_buffer.create(0); }
+        };
+    };
+
+    auto create_buffer = [&]()
+    {
+        if (!f.buffers())
+            return false;
+
+        f.GenBuffers(1, &buffer);
+        f.BindBuffer(gl::array_buffer, buffer);
+        f.BufferData(gl::array_buffer, position_bytes, nullptr, gl::stream_draw);
+        f.BindBuffer(gl::array_buffer, 0);
+        return true;
+    };
+
+    auto delete_buffer = [&]()
+    {
+        f.DeleteBuffers(1, &buffer);
+        buffer = 0;
+    };
+
+    auto wait_for = [&](gl::Sync& fence)
+    {
+        if (!fence)
+            return;
+        while (true)
+        {
+            const GLenum result = f.ClientWaitSync(fence, gl::sync_flush_commands_bit, 1'000'000'000);
+            if (result == gl::already_signaled || result == gl::condition_satisfied || result == gl::wait_failed)
+                break;
+        }
+        f.DeleteSync(fence);
+        fence = nullptr;
+    };
+
+    std::vector<Path> paths = {
+        // the client side array only reaches the driver inside draw, so its upload column is just the cpu copy
+        {
+            "sf::VertexArray",
+            []() { return true; },
+            [&]() { fill_vertices(); },
+            [&]() { target.draw(vertices, additive); },
+            []() {}
+        },
+        make_vertex_buffer_path("sf::VertexBuffer static", sf::VertexBuffer::Static),
+        make_vertex_buffer_path("sf::VertexBuffer dynamic", sf::VertexBuffer::Dynamic),
+        make_vertex_buffer_path("sf::VertexBuffer stream", sf::VertexBuffer::Stream),
+        {
+            "gl orphan + subdata",
+            create_buffer,
+            [&]()
+            {
+                f.BindBuffer(gl::array_buffer, buffer);
+                f.BufferData(gl::array_buffer, position_bytes, nullptr, gl::stream_draw);
+                f.BufferSubData(gl::array_buffer, 0, position_bytes, positions.data());
+                f.BindBuffer(gl::array_buffer, 0);
+            },
+            [&]() { draw_gl_points(target, buffer, 0, count); },
+            delete_buffer
+        },
+        {
+            "gl map invalidate",
+            create_buffer,
+            [&]()
+            {
+                f.BindBuffer(gl::array_buffer, buffer);
+                void* destination = f.MapBufferRange(gl::array_buffer, 0, position_bytes, gl::map_write_bit | gl::map_invalidate_buffer_bit);
+                std::memcpy(destination, positions.data(), static_cast<size_t>(position_bytes));
+                f.UnmapBuffer(gl::array_buffer);
+                f.BindBuffer(gl::array_buffer, 0);
+            },
+            [&]() { draw_gl_points(target, buffer, 0, count); },
+            delete_buffer
+        },
+        {
+            "gl persistent (3 regions)",
+            [&]()
+            {
+                if (!f.persistent_mapping())
+                    return false;
+
+                const GLbitfield flags = gl::map_write_bit | gl::map_persistent_bit | gl::map_coherent_bit;
+                f.GenBuffers(1, &buffer);
+                f.BindBuffer(gl::array_buffer, buffer);
+                f.BufferStorage(gl::array_buffer, position_bytes * regions, nullptr, flags);
+                mapped = static_cast<sf::Vector2f*>(f.MapBufferRange(gl::array_buffer, 0, position_bytes * regions, flags));
+                f.BindBuffer(gl::array_buffer, 0);
+                region = 0;
+                return mapped != nullptr;
+            },
+            [&]()
+            {
+                wait_for(fences[region]);
+                std::memcpy(mapped + region * count, positions.data(), static_cast<size_t>(position_bytes));
+            },
+            [&]()
+            {
+                draw_gl_points(target, buffer, region * static_cast<size_t>(position_bytes), count);
+                fences[region] = f.FenceSync(gl::sync_gpu_commands_complete, 0);
+                region = (region + 1) % regions;
+            },
+            [&]()
+            {
+                for (gl::Sync& fence : fences)
+                    wait_for(fence);
+                f.BindBuffer(gl::array_buffer, buffer);
+                f.UnmapBuffer(gl::array_buffer);
+                f.BindBuffer(gl::array_buffer, 0);
+                mapped = nullptr;
+                delete_buffer();
+            }
+        },
+    };
+
+    std::vector<Result> results;
+    for (Path& path : paths)
+    {
+        if (!path.setup())
+        {
+            results.push_back({ path.name, false, 0, 0 });
+            std::printf("%-28s not supported\n", path.name);
+            continue;
+        }
+
+        double upload_ms = 0, draw_ms = 0;
+        for (unsigned frame = 0; frame < options.warmup + options.frames; ++frame)
+        {
+            move_points();
+            target.clear();
+            glFinish();
+
+            // glFinish after each stage so the driver cannot defer the transfer into the draw
+            Clock::time_point start = Clock::now();
+            path.upload();
+            glFinish();
+            const double upload = elapsed_ms(start);
+
+            start = Clock::now();
+            path.draw();
+            glFinish();
+            const double draw = elapsed_ms(start);
+
+            target.display();
+
+            if (frame >= options.warmup)
+            {
+                upload_ms += upload;
+                draw_ms += draw;
+            }
+        }
+        path.teardown();
+
+        const double per_million = 1e6 / static_cast<double>(std::max<size_t>(1, count)) / options.frames;
+        results.push_back({ path.name, true, upload_ms * per_million, draw_ms * per_million });
+        std::printf("%-28s done\n", path.name);
+    }
+
+    std::printf("\n%-28s %14s %14s %14s\n", "path", "upload ms/M", "draw ms/M", "total ms/M");
+    for (const Result& result : results)
+    {
+        if (!result.supported)
+            std::printf("%-28s %14s %14s %14s\n", result.name, "-", "-", "-");
+        else
+            std::printf("%-28s %14.3f %14.3f %14.3f\n", result.name, result.upload_ms, result.draw_ms, result.upload_ms + result.draw_ms);
     }
 
     return 0;
-}
\ No newline at end of file
+}
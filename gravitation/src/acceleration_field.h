@@ -0,0 +1,266 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "black_holes.h"
+#include "spatial_grid.h"
+#include "threading.h"
+#include "toroidal_space.h"
+
+
+// precomputed black hole acceleration for large black hole counts. every pull is split into a smooth long range
+// share, pull * S(r / cutoff) with S a smoothstep that is 0 at the black hole and 1 from the cutoff on, and a
+// short range remainder that is exactly zero beyond the cutoff. the long range shares of all black holes are
+// summed on a periodic node grid, rebuilt in parallel only once a black hole has moved more than the tolerance,
+// and stars interpolate it (bilinear or Catmull-Rom bicubic). the black holes within the cutoff, found through a
+// grid rebuilt every step, are then corrected exactly, so a star's cost depends on the local black hole density
+// instead of their number. the minimum image pull of a black hole jumps where it switches sides, half the world
+// away, so the field also fades every black hole out within seam_width of that cut, and the few black holes whose
+// cut runs next to a star (found in lists sorted by x and by y) are corrected exactly as well, the same way the
+// tree opens nodes that straddle the cut. the field is stored per unit G * star_mass, so G stays live
+class AccelerationField
+{
+	ThreadPool& pool_;
+	sf::FloatRect bounds_;
+	unsigned nodes_x_;
+	unsigned nodes_y_;
+	float inv_spacing_x_;
+	float inv_spacing_y_;
+	float cutoff_;
+	float inv_cutoff_sq_;
+	float seam_width_;
+
+	std::vector<sf::Vector2f> field_;
+	std::vector<sf::Vector2f> built_positions_; // black hole positions the field was last built for
+	SpatialGrid near_grid_;
+	std::vector<unsigned> by_x_; // black holes sorted by position, for the seam bands
+	std::vector<unsigned> by_y_;
+	std::vector<float> sorted_x_;
+	std::vector<float> sorted_y_;
+	size_t builds_ = 0;
+
+public:
+	AccelerationField(const sf::FloatRect& bounds, const float spacing, const float cutoff, ThreadPool& pool)
+		: pool_(pool), bounds_(bounds),
+		  nodes_x_(std::max(4u, static_cast<unsigned>(std::round(bounds.width / spacing)))),
+		  nodes_y_(std::max(4u, static_cast<unsigned>(std::round(bounds.height / spacing)))),
+		  inv_spacing_x_(nodes_x_ / bounds.width), inv_spacing_y_(nodes_y_ / bounds.height),
+		  cutoff_(std::min(cutoff, std::min(bounds.width, bounds.height) / 4)), inv_cutoff_sq_(1.f / (cutoff_ * cutoff_)),
+		  seam_width_(std::min(2.f * spacing, std::min(bounds.width, bounds.height) / 4)),
+		  field_(static_cast<size_t>(nodes_x_) * nodes_y_), near_grid_(bounds, cutoff_, pool)
+	{
+	}
+
+
+	// buckets the black holes for the near field every step, rebuilds the long range grid when one of them has
+	// moved more than tolerance since the last build. returns true if it was rebuilt
+	bool update(const BlackHoles& black_holes, const float tolerance, Arena& scratch)
+	{
+		near_grid_.build(black_holes.size(), scratch, [&black_holes](const size_t i) { return black_holes.position(i); });
+		sort_axis(black_holes.x, by_x_, sorted_x_);
+		sort_axis(black_holes.y, by_y_, sorted_y_);
+
+		if (!moved(black_holes, tolerance))
+			return false;
+
+		built_positions_.resize(black_holes.size());
+		for (size_t b = 0; b < black_holes.size(); ++b)
+			built_positions_[b] = black_holes.position(b);
+
+		pool_.parallel_for(field_.size(), [&](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t node = begin; node < end; ++node)
+			{
+				const sf::Vector2f position = node_position(static_cast<unsigned>(node % nodes_x_), static_cast<unsigned>(node / nodes_x_));
+				sf::Vector2f acceleration{};
+				for (size_t b = 0; b < built_positions_.size(); ++b)
+				{
+					const sf::Vector2f direction = toroidal_direction(position, built_positions_[b], bounds_);
+					const float distance_sq = direction.x * direction.x + direction.y * direction.y;
+					if (distance_sq > 0.f)
+						acceleration += direction * (black_holes.mass[b] * long_range_share(direction, distance_sq) / distance_sq);
+				}
+				field_[node] = acceleration;
+			}
+		});
+
+		++builds_;
+		return true;
+	}
+
+
+	// the acceleration at position, pull_scale = G * star_mass. black holes inside the capture zone are skipped
+	// and counted in captures when capture is on, otherwise their distance is clamped to the capture radius
+	sf::Vector2f acceleration(const sf::Vector2f position, const BlackHoles& black_holes, const float pull_scale,
+		const float capture_radius_sq, const bool capture, const bool bicubic, unsigned& captures) const
+	{
+		sf::Vector2f acceleration = (bicubic ? sample_bicubic(position) : sample_bilinear(position)) * pull_scale;
+
+		const auto correct = [&](const unsigned b, const sf::Vector2f direction, const float distance_sq)
+		{
+			if (distance_sq <= 0.f)
+				return;
+
+			const float pull = pull_scale * black_holes.mass[b];
+			acceleration -= direction * (pull * long_range_share(direction, distance_sq) / distance_sq); // already in the field
+
+			if (capture && distance_sq < capture_radius_sq)
+			{
+				++captures;
+				return;
+			}
+			acceleration += direction * (pull / std::max(distance_sq, capture ? 0.f : capture_radius_sq));
+		};
+
+		near_grid_.query_radius(position, cutoff_, correct);
+
+		// black holes whose cut is within seam_width of the star, each counted once. they are at least half the
+		// world minus seam_width away, so never inside the cutoff
+		const auto correct_seam = [&](const unsigned b)
+		{
+			const sf::Vector2f direction = toroidal_direction(position, black_holes.position(b), bounds_);
+			correct(b, direction, direction.x * direction.x + direction.y * direction.y);
+		};
+		for_each_in_band(by_x_, sorted_x_, position.x + bounds_.width / 2, bounds_.left, bounds_.width, correct_seam);
+		for_each_in_band(by_y_, sorted_y_, position.y + bounds_.height / 2, bounds_.top, bounds_.height, [&](const unsigned b)
+		{
+			if (!in_band(black_holes.x[b], position.x + bounds_.width / 2, bounds_.width))
+				correct_seam(b);
+		});
+
+		return acceleration;
+	}
+
+
+	// forces a rebuild on the next update, for black hole masses that changed without the black holes moving
+	void invalidate() { built_positions_.clear(); }
+
+	size_t builds() const { return builds_; }
+	size_t node_count() const { return field_.size(); }
+	float cutoff() const { return cutoff_; }
+
+private:
+	static float smoothstep(const float t)
+	{
+		const float s = std::clamp(t, 0.f, 1.f);
+		return s * s * (3.f - 2.f * s);
+	}
+
+	// smoothstep in r / cutoff, faded out towards the minimum image cut on either axis
+	float long_range_share(const sf::Vector2f direction, const float distance_sq) const
+	{
+		return smoothstep(std::sqrt(distance_sq * inv_cutoff_sq_))
+			* smoothstep((bounds_.width / 2 - std::abs(direction.x)) / seam_width_)
+			* smoothstep((bounds_.height / 2 - std::abs(direction.y)) / seam_width_);
+	}
+
+	static void sort_axis(const std::vector<float>& coordinates, std::vector<unsigned>& order, std::vector<float>& sorted)
+	{
+		order.resize(coordinates.size());
+		for (unsigned b = 0; b < order.size(); ++b)
+			order[b] = b;
+		std::sort(order.begin(), order.end(), [&coordinates](const unsigned a, const unsigned b) { return coordinates[a] < coordinates[b]; });
+
+		sorted.resize(order.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			sorted[i] = coordinates[order[i]];
+	}
+
+	bool in_band(const float coordinate, const float centre, const float extent) const
+	{
+		const float offset = std::abs(std::remainder(coordinate - centre, extent));
+		return offset < seam_width_;
+	}
+
+	// calls visit for every black hole whose coordinate is within seam_width of centre, wrapping around the world
+	template <typename Visit>
+	void for_each_in_band(const std::vector<unsigned>& order, const std::vector<float>& sorted, float centre,
+		const float origin, const float extent, Visit&& visit) const
+	{
+		centre = origin + std::fmod(std::fmod(centre - origin, extent) + extent, extent);
+		const auto visit_range = [&](const float low, const float high)
+		{
+			const auto first = std::lower_bound(sorted.begin(), sorted.end(), low);
+			const auto last = std::lower_bound(first, sorted.end(), high);
+			for (auto it = first; it != last; ++it)
+				visit(order[it - sorted.begin()]);
+		};
+
+		const float low = centre - seam_width_, high = centre + seam_width_;
+		visit_range(std::max(low, origin), std::min(high, origin + extent));
+		if (low < origin)
+			visit_range(low + extent, origin + extent);
+		if (high > origin + extent)
+			visit_range(origin, high - extent);
+	}
+
+	bool moved(const BlackHoles& black_holes, const float tolerance) const
+	{
+		if (builds_ == 0 || built_positions_.size() != black_holes.size())
+			return true;
+
+		const float tolerance_sq = tolerance * tolerance;
+		for (size_t b = 0; b < black_holes.size(); ++b)
+		{
+			if (toroidal_distance_sq(built_positions_[b], black_holes.position(b), bounds_) > tolerance_sq)
+				return true;
+		}
+		return false;
+	}
+
+	sf::Vector2f node_position(const unsigned x, const unsigned y) const
+	{
+		return { bounds_.left + x / inv_spacing_x_, bounds_.top + y / inv_spacing_y_ };
+	}
+
+	const sf::Vector2f& node(const int x, const int y) const
+	{
+		const int wrapped_x = (x % static_cast<int>(nodes_x_) + static_cast<int>(nodes_x_)) % static_cast<int>(nodes_x_);
+		const int wrapped_y = (y % static_cast<int>(nodes_y_) + static_cast<int>(nodes_y_)) % static_cast<int>(nodes_y_);
+		return field_[static_cast<size_t>(wrapped_y) * nodes_x_ + wrapped_x];
+	}
+
+	sf::Vector2f sample_bilinear(const sf::Vector2f position) const
+	{
+		const float fx = (position.x - bounds_.left) * inv_spacing_x_;
+		const float fy = (position.y - bounds_.top) * inv_spacing_y_;
+		const int x = static_cast<int>(std::floor(fx));
+		const int y = static_cast<int>(std::floor(fy));
+		const float tx = fx - x;
+		const float ty = fy - y;
+
+		const sf::Vector2f top = node(x, y) * (1.f - tx) + node(x + 1, y) * tx;
+		const sf::Vector2f bottom = node(x, y + 1) * (1.f - tx) + node(x + 1, y + 1) * tx;
+		return top * (1.f - ty) + bottom * ty;
+	}
+
+	static std::array<float, 4> catmull_rom(const float t)
+	{
+		const float t2 = t * t, t3 = t2 * t;
+		return { 0.5f * (-t3 + 2.f * t2 - t), 0.5f * (3.f * t3 - 5.f * t2 + 2.f), 0.5f * (-3.f * t3 + 4.f * t2 + t), 0.5f * (t3 - t2) };
+	}
+
+	sf::Vector2f sample_bicubic(const sf::Vector2f position) const
+	{
+		const float fx = (position.x - bounds_.left) * inv_spacing_x_;
+		const float fy = (position.y - bounds_.top) * inv_spacing_y_;
+		const int x = static_cast<int>(std::floor(fx));
+		const int y = static_cast<int>(std::floor(fy));
+		const std::array<float, 4> wx = catmull_rom(fx - x);
+		const std::array<float, 4> wy = catmull_rom(fy - y);
+
+		sf::Vector2f sum{};
+		for (int j = 0; j < 4; ++j)
+		{
+			sf::Vector2f row{};
+			for (int i = 0; i < 4; ++i)
+				row += node(x - 1 + i, y - 1 + j) * wx[i];
+			sum += row * wy[j];
+		}
+		return sum;
+	}
+};
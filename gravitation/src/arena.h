@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "settings.h"
+#include "threading.h"
+
+
+// bump allocator for memory that lives until the end of the frame. allocations are carved out of one block, what
+// does not fit goes to overflow blocks from the heap, and reset grows the block to the frame's high water mark,
+// so after the first frames a steady frame never touches the heap. nothing is destroyed, only trivially
+// destructible types go in
+class Arena
+{
+	std::unique_ptr<std::byte[]> block_;
+	size_t capacity_;
+	size_t used_ = 0;
+	std::vector<std::unique_ptr<std::byte[]>> overflow_;
+	size_t overflow_bytes_ = 0;
+	size_t peak_ = 0;       // most bytes one frame has used
+	size_t allocations_ = 0; // since the last reset
+
+public:
+	explicit Arena(const size_t capacity)
+		: block_(std::make_unique_for_overwrite<std::byte[]>(capacity)), capacity_(capacity) {}
+
+
+	void* allocate(const size_t bytes, const size_t alignment)
+	{
+		++allocations_;
+		const auto base = reinterpret_cast<std::uintptr_t>(block_.get());
+		const size_t offset = (base + used_ + alignment - 1) / alignment * alignment - base;
+		if (offset + bytes <= capacity_)
+		{
+			used_ = offset + bytes;
+			return block_.get() + offset;
+		}
+
+		// operator new[] aligns to __STDCPP_DEFAULT_NEW_ALIGNMENT__, over-allocate for anything stricter
+		overflow_.push_back(std::make_unique_for_overwrite<std::byte[]>(bytes + alignment));
+		overflow_bytes_ += bytes + alignment;
+		const auto overflow = reinterpret_cast<std::uintptr_t>(overflow_.back().get());
+		return reinterpret_cast<void*>((overflow + alignment - 1) / alignment * alignment);
+	}
+
+	// count uninitialized elements
+	template<typename Type>
+	Type* allocate(const size_t count)
+	{
+		static_assert(std::is_trivially_destructible_v<Type>, "the arena never runs destructors");
+		return static_cast<Type*>(allocate(count * sizeof(Type), alignof(Type)));
+	}
+
+	// everything allocated since the last reset is gone
+	void reset()
+	{
+		const size_t frame_bytes = used_ + overflow_bytes_;
+		peak_ = std::max(peak_, frame_bytes);
+		if (!overflow_.empty())
+		{
+			overflow_.clear();
+			capacity_ = std::max(capacity_ * 2, frame_bytes);
+			block_ = std::make_unique_for_overwrite<std::byte[]>(capacity_);
+		}
+		used_ = 0;
+		overflow_bytes_ = 0;
+		allocations_ = 0;
+	}
+
+
+	size_t used() const { return used_ + overflow_bytes_; }
+	size_t capacity() const { return capacity_; }
+	size_t peak() const { return peak_; }
+	size_t allocations() const { return allocations_; }
+};
+
+
+// standard allocator over an arena, for containers that only live during the frame. deallocation is a no-op,
+// a container that grows leaves its old buffer behind until the reset, so reserve up front
+template<typename Type>
+class ArenaAllocator
+{
+	Arena* arena_;
+
+public:
+	using value_type = Type;
+
+	explicit ArenaAllocator(Arena& arena) : arena_(&arena) {}
+
+	template<typename Other>
+	ArenaAllocator(const ArenaAllocator<Other>& other) : arena_(other.arena()) {}
+
+
+	Arena* arena() const { return arena_; }
+
+	Type* allocate(const size_t count) { return arena_->allocate<Type>(count); }
+	void deallocate(Type*, size_t) {}
+
+	template<typename Other>
+	bool operator==(const ArenaAllocator<Other>& other) const { return arena_ == other.arena(); }
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+
+// the frame's arena for the main thread and one scratch arena per pool thread, all reset at the end of the frame
+class FrameArenas
+{
+	Arena frame_;
+	std::vector<Arena> scratch_;
+
+public:
+	FrameArenas(const unsigned threads, const size_t frame_bytes, const size_t scratch_bytes)
+		: frame_(frame_bytes)
+	{
+		scratch_.reserve(threads);
+		for (unsigned t = 0; t < threads; ++t)
+			scratch_.emplace_back(scratch_bytes);
+	}
+
+
+	Arena& frame() { return frame_; }
+	Arena& scratch(const unsigned thread) { return scratch_[thread]; }
+
+	void reset()
+	{
+		frame_.reset();
+		for (Arena& arena : scratch_)
+			arena.reset();
+	}
+
+	// high water mark of a frame over all arenas
+	size_t peak() const
+	{
+		size_t peak = frame_.peak();
+		for (const Arena& arena : scratch_)
+			peak += arena.peak();
+		return peak;
+	}
+};
+
+
+// watches a hot section for heap allocations on the calling thread and in the pool jobs it runs. debug builds
+// log the first frame of every allocating streak with its count, buffers that grow to a new size now and then
+// are fine, a section that allocates in heap_guard_frames frames in a row trips an assertion
+class HeapGuard
+{
+	const ThreadPool& pool_;
+	const char* name_;
+	std::uint64_t start_ = 0;
+	unsigned frames_in_a_row_ = 0;
+
+public:
+	class Scope
+	{
+		HeapGuard& guard_;
+
+	public:
+		explicit Scope(HeapGuard& guard) : guard_(guard) { guard_.begin(); }
+		~Scope() { guard_.end(); }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	HeapGuard(const ThreadPool& pool, const char* name) : pool_(pool), name_(name) {}
+
+	Scope watch() { return Scope(*this); }
+
+private:
+	std::uint64_t allocations() const
+	{
+		return thread_heap_allocations + pool_.heap_allocations();
+	}
+
+	void begin()
+	{
+		start_ = allocations();
+	}
+
+	void end()
+	{
+		const std::uint64_t made = allocations() - start_;
+		frames_in_a_row_ = made > 0 ? frames_in_a_row_ + 1 : 0;
+#ifndef NDEBUG
+		if (frames_in_a_row_ == 1)
+			std::cerr << "heap guard: " << name_ << " made " << made << " heap allocations this frame\n";
+		if (frames_in_a_row_ == SimulationSettings::heap_guard_frames)
+		{
+			std::cerr << "heap guard: " << name_ << " allocated in " << frames_in_a_row_ << " frames in a row (" << made << " this frame)\n";
+			assert(!"heap allocation in a hot path");
+		}
+#endif
+	}
+};
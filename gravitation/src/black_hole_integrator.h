@@ -0,0 +1,315 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "black_holes.h"
+#include "star_kernel.h"
+#include "toroidal_space.h"
+
+
+// the black holes at the start of a step and after every substep of it, times as fractions of the step
+class BlackHoleTrajectory
+{
+	std::vector<BlackHoles> samples_; // only grows, the vectors of a sample are reused from step to step
+	std::vector<float> times_;
+	size_t count_ = 0;
+
+public:
+	void clear()
+	{
+		count_ = 0;
+		times_.clear();
+	}
+
+	BlackHoles& add(const float time)
+	{
+		if (count_ == samples_.size())
+			samples_.emplace_back();
+		times_.push_back(time);
+		return samples_[count_++];
+	}
+
+
+	size_t size() const { return count_; }
+	float time(const size_t sample) const { return times_[sample]; }
+	const BlackHoles& sample(const size_t sample) const { return samples_[sample]; }
+	const BlackHoles& start() const { return samples_.front(); }
+	const BlackHoles& end() const { return samples_[count_ - 1]; }
+
+	// the black holes at time into the step of length dt, positions from the cubic through the samples on
+	// either side and their velocities, velocities linear. out keeps its vectors from call to call
+	template<unsigned Dimensions>
+	void interpolate(const float time, const float dt, const typename Space<Dimensions>::Bounds& bounds, BlackHoles& out) const
+	{
+		using Vector = typename Space<Dimensions>::Vector;
+
+		size_t s = 1;
+		while (s + 1 < count_ && times_[s] < time)
+			++s;
+		out = samples_[s - 1];
+		if (s >= count_ || times_[s] <= times_[s - 1])
+			return;
+
+		const BlackHoles& to = samples_[s];
+		const float h = (times_[s] - times_[s - 1]) * dt;
+		const float u = std::clamp((time - times_[s - 1]) / (times_[s] - times_[s - 1]), 0.f, 1.f);
+		for (size_t i = 0; i < out.size(); ++i)
+		{
+			const Vector v0 = out.template velocity_in<Dimensions>(i), v1 = to.template velocity_in<Dimensions>(i);
+			const Vector p0 = out.template position_in<Dimensions>(i);
+			const Vector d = toroidal_direction(p0, to.template position_in<Dimensions>(i), bounds);
+			Vector position = p0 + v0 * (u * h) + (d * 3.f - (v0 * 2.f + v1) * h) * (u * u) + ((v0 + v1) * h - d * 2.f) * (u * u * u);
+			border(position, bounds);
+			out.set_position(i, position);
+			out.set_velocity(i, v0 + (v1 - v0) * u);
+		}
+	}
+
+	// fastest black hole at any sample of the step
+	float max_speed() const
+	{
+		float max_speed_sq = 0.f;
+		for (size_t s = 0; s < count_; ++s)
+		{
+			const BlackHoles& black_holes = samples_[s];
+			for (size_t i = 0; i < black_holes.size(); ++i)
+			{
+				float speed_sq = black_holes.vx[i] * black_holes.vx[i] + black_holes.vy[i] * black_holes.vy[i];
+				if (!black_holes.vz.empty())
+					speed_sq += black_holes.vz[i] * black_holes.vz[i];
+				max_speed_sq = std::max(max_speed_sq, speed_sq);
+			}
+		}
+		return std::sqrt(max_speed_sq);
+	}
+};
+
+
+struct HermiteParams
+{
+	double grav_const;
+	double dt;
+	double capture_radius_sq;
+	double softening_sq;
+	double eta;          // accuracy of the substep criterion
+	double max_speed;
+	unsigned max_substeps;
+};
+
+
+// 4th order Hermite predictor-corrector for the black holes (Makino & Aarseth 1992), in double, with one shared
+// substep for all of them from the Aarseth criterion of the most demanding one. the pull is the one of the Euler
+// update, grav_const * m_i * m_j * d / r^2 along the minimum image offset d, Plummer softened so that the jerk
+// stays finite through a close pass, and the capture boost is applied once per step. direct sum, O(n^2) per
+// substep, meant for the few black holes below the tree threshold. 2D runs with a zero z axis
+class HermiteIntegrator
+{
+	using Vector = sf::Vector3<double>;
+
+	std::vector<Vector> position_;
+	std::vector<Vector> velocity_;
+	std::vector<Vector> acceleration_;
+	std::vector<Vector> jerk_;
+	std::vector<Vector> predicted_position_;
+	std::vector<Vector> predicted_velocity_;
+	std::vector<Vector> new_acceleration_;
+	std::vector<Vector> new_jerk_;
+	std::vector<double> mass_;
+	Box<double> bounds_{};
+	double substep_ = 0.0; // carried over to the next step, 0 until the first one
+	unsigned substeps_ = 0;
+
+public:
+	// moves the black holes of start over one step, trajectory gets start and the state after every substep
+	template<unsigned Dimensions>
+	void integrate(const BlackHoles& start, const typename Space<Dimensions>::Bounds& bounds, const HermiteParams& params,
+		BlackHoleTrajectory& trajectory)
+	{
+		load<Dimensions>(start, bounds);
+		trajectory.clear();
+		trajectory.add(0.f) = start;
+
+		const size_t count = start.size();
+		for (size_t i = 0; i < count; ++i)
+			velocity_[i] *= std::pow(1.01, captures(i, params.capture_radius_sq));
+
+		evaluate(position_, velocity_, acceleration_, jerk_, params);
+
+		// startup criterion, a fraction of the shortest |a| / |j|, before there are higher derivatives to use
+		if (substep_ <= 0.0)
+		{
+			substep_ = std::numeric_limits<double>::infinity();
+			for (size_t i = 0; i < count; ++i)
+			{
+				const double jerk = std::sqrt(length_sq(jerk_[i]));
+				if (jerk > 0.0)
+					substep_ = std::min(substep_, 0.5 * params.eta * std::sqrt(length_sq(acceleration_[i])) / jerk);
+			}
+		}
+
+		const double min_substep = params.dt / std::max(1u, params.max_substeps);
+		double time = 0.0;
+		substeps_ = 0;
+		while (params.dt - time > 1e-9 * params.dt)
+		{
+			const double h = std::min(std::max(substep_, min_substep), params.dt - time);
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				predicted_position_[i] = position_[i] + h * (velocity_[i] + h / 2 * (acceleration_[i] + h / 3 * jerk_[i]));
+				predicted_velocity_[i] = velocity_[i] + h * (acceleration_[i] + h / 2 * jerk_[i]);
+				border(predicted_position_[i], bounds_);
+			}
+			evaluate(predicted_position_, predicted_velocity_, new_acceleration_, new_jerk_, params);
+
+			double next = std::numeric_limits<double>::infinity();
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Vector a0 = acceleration_[i], a1 = new_acceleration_[i];
+				const Vector j0 = jerk_[i], j1 = new_jerk_[i];
+				const Vector v1 = velocity_[i] + h / 2 * (a0 + a1) + h * h / 12 * (j0 - j1);
+				position_[i] += h / 2 * (velocity_[i] + v1) + h * h / 12 * (a0 - a1);
+				velocity_[i] = v1;
+				speed_limit(velocity_[i], params.max_speed);
+				border(position_[i], bounds_);
+
+				// snap and crackle from the interpolating polynomial, at the end of the substep
+				const Vector crackle = (12.0 * (a0 - a1) + 6.0 * h * (j0 + j1)) / (h * h * h);
+				const Vector snap = (-6.0 * (a0 - a1) - h * (4.0 * j0 + 2.0 * j1)) / (h * h) + h * crackle;
+				next = std::min(next, aarseth_substep(a1, j1, snap, crackle, params.eta));
+			}
+			std::swap(acceleration_, new_acceleration_);
+			std::swap(jerk_, new_jerk_);
+
+			// the full step keeps the estimate, a step cut short at the end of the star step is no reason to grow
+			if (h >= substep_ || next < substep_)
+				substep_ = std::min(next, 2.0 * std::max(h, substep_));
+			time += h;
+			++substeps_;
+			store<Dimensions>(start, trajectory.add(static_cast<float>(time / params.dt)));
+		}
+	}
+
+
+	unsigned substeps() const { return substeps_; }
+
+	// the next step starts from the startup criterion again, e.g. after the black holes were replaced
+	void reset()
+	{
+		substep_ = 0.0;
+	}
+
+private:
+	template<unsigned Dimensions>
+	void load(const BlackHoles& black_holes, const typename Space<Dimensions>::Bounds& bounds)
+	{
+		const size_t count = black_holes.size();
+		for (std::vector<Vector>* state : { &position_, &velocity_, &acceleration_, &jerk_, &predicted_position_,
+			&predicted_velocity_, &new_acceleration_, &new_jerk_ })
+			state->resize(count);
+		mass_.resize(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			position_[i] = Vector(black_holes.x[i], black_holes.y[i], Dimensions == 3 ? black_holes.z[i] : 0.0);
+			velocity_[i] = Vector(black_holes.vx[i], black_holes.vy[i], Dimensions == 3 ? black_holes.vz[i] : 0.0);
+			mass_[i] = black_holes.mass[i];
+		}
+
+		if constexpr (Dimensions == 2)
+			bounds_ = { { bounds.left, bounds.top, 0.0 }, { bounds.width, bounds.height, 0.0 } };
+		else
+			bounds_ = { Vector(bounds.origin), Vector(bounds.size) };
+	}
+
+	// start with the current positions and velocities
+	template<unsigned Dimensions>
+	void store(const BlackHoles& start, BlackHoles& black_holes) const
+	{
+		black_holes = start;
+		for (size_t i = 0; i < position_.size(); ++i)
+		{
+			const sf::Vector3f position(position_[i]), velocity(velocity_[i]);
+			if constexpr (Dimensions == 2)
+			{
+				black_holes.set_position(i, sf::Vector2f(position.x, position.y));
+				black_holes.set_velocity(i, sf::Vector2f(velocity.x, velocity.y));
+			}
+			else
+			{
+				black_holes.set_position(i, position);
+				black_holes.set_velocity(i, velocity);
+			}
+		}
+	}
+
+	// black holes inside the capture zone of i
+	unsigned captures(const size_t i, const double capture_radius_sq) const
+	{
+		unsigned inside = 0;
+		for (size_t j = 0; j < position_.size(); ++j)
+			if (j != i && toroidal_distance_sq(position_[i], position_[j], bounds_) < capture_radius_sq)
+				++inside;
+		return inside;
+	}
+
+	// acceleration and jerk of every black hole
+	void evaluate(const std::vector<Vector>& positions, const std::vector<Vector>& velocities, std::vector<Vector>& accelerations,
+		std::vector<Vector>& jerks, const HermiteParams& params) const
+	{
+		for (size_t i = 0; i < positions.size(); ++i)
+		{
+			Vector acceleration{}, jerk{};
+			for (size_t j = 0; j < positions.size(); ++j)
+			{
+				if (j == i)
+					continue;
+
+				const Vector d = toroidal_direction(positions[i], positions[j], bounds_);
+				const Vector v = velocities[j] - velocities[i];
+				const double s = length_sq(d) + params.softening_sq;
+				const double pull = params.grav_const * mass_[i] * mass_[j] / s;
+				const double dot = d.x * v.x + d.y * v.y + d.z * v.z;
+
+				acceleration += pull * d;
+				jerk += pull * (v - (2.0 * dot / s) * d);
+			}
+			accelerations[i] = acceleration;
+			jerks[i] = jerk;
+		}
+	}
+
+	// sqrt(eta * (|a| |a2| + |j|^2) / (|j| |a3| + |a2|^2)), unbounded for a black hole that feels nothing
+	static double aarseth_substep(const Vector& acceleration, const Vector& jerk, const Vector& snap, const Vector& crackle, const double eta)
+	{
+		const double a = std::sqrt(length_sq(acceleration)), j = std::sqrt(length_sq(jerk));
+		const double s = std::sqrt(length_sq(snap)), c = std::sqrt(length_sq(crackle));
+		const double denominator = j * c + s * s;
+		if (denominator <= 0.0)
+			return std::numeric_limits<double>::infinity();
+		return std::sqrt(eta * (a * s + j * j) / denominator);
+	}
+};
+
+
+// energy of 2D black holes under the pull grav_const * m_i * m_j * d / (r^2 + softening_sq), whose potential is
+// grav_const * m_i * m_j * ln(r^2 + softening_sq) / 2 per pair. the pulls change the velocities directly, so the
+// kinetic energy counts every black hole with unit mass. softening_sq 0 is the law of the Euler update
+inline double black_hole_energy(const BlackHoles& black_holes, const sf::FloatRect& bounds, const double grav_const, const double softening_sq)
+{
+	double energy = 0.0;
+	for (size_t i = 0; i < black_holes.size(); ++i)
+	{
+		energy += 0.5 * (static_cast<double>(black_holes.vx[i]) * black_holes.vx[i] + static_cast<double>(black_holes.vy[i]) * black_holes.vy[i]);
+		for (size_t j = i + 1; j < black_holes.size(); ++j)
+		{
+			const double distance_sq = toroidal_distance_sq(black_holes.position(i), black_holes.position(j), bounds);
+			energy += 0.5 * grav_const * black_holes.mass[i] * black_holes.mass[j] * std::log(distance_sq + softening_sq);
+		}
+	}
+	return energy;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "black_holes.h"
+#include "toroidal_space.h"
+
+
+// Barnes-Hut quadtree over the black holes. nodes are stored depth first, every node knows the index of the node
+// following its subtree (skip) so traversal needs no stack: descend with ++node, or jump over the subtree with skip.
+// distant nodes are replaced by their centre of mass, measured with the toroidal minimum image
+class BlackHoleTree
+{
+public:
+	static constexpr unsigned no_self = std::numeric_limits<unsigned>::max();
+
+private:
+	struct Node
+	{
+		float com_x;
+		float com_y;
+		float mass;
+		float size;
+		float size_sq;      // squared side length of the node's box, compared against theta^2 * distance^2
+		unsigned skip;      // index of the first node after this subtree
+		unsigned body_begin;
+		unsigned body_end;  // non-empty body range = leaf
+		bool leaf;
+	};
+
+	static constexpr unsigned max_depth = 32u;
+
+	sf::FloatRect bounds_;
+	float theta_sq_;
+	unsigned leaf_size_;
+
+	std::vector<Node> nodes_;
+	std::vector<unsigned> order_;   // original black hole index of every body, in tree order
+	std::vector<float> body_x_;
+	std::vector<float> body_y_;
+	std::vector<float> body_mass_;
+
+public:
+	BlackHoleTree(const sf::FloatRect& bounds, const float theta, const unsigned leaf_size)
+		: bounds_(bounds), theta_sq_(theta * theta), leaf_size_(std::max(1u, leaf_size)) {}
+
+
+	void build(const BlackHoles& black_holes)
+	{
+		const size_t count = black_holes.size();
+		nodes_.clear();
+		order_.resize(count);
+		std::iota(order_.begin(), order_.end(), 0u);
+
+		if (count == 0)
+			return;
+
+		const float side = std::max(bounds_.width, bounds_.height);
+		build_node(black_holes, 0, static_cast<unsigned>(count), bounds_.left, bounds_.top, side, 0);
+
+		body_x_.resize(count);
+		body_y_.resize(count);
+		body_mass_.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			body_x_[i] = black_holes.x[order_[i]];
+			body_y_[i] = black_holes.y[order_[i]];
+			body_mass_[i] = black_holes.mass[order_[i]];
+		}
+	}
+
+
+	// adds grav_const * mass * M * direction / distance_sq * dt to velocity for every black hole, approximating distant
+	// groups by their centre of mass. black holes closer than capture_radius_sq are skipped and counted instead.
+	// self is the black hole index to ignore when the querying body is a black hole itself
+	unsigned gravitate(const sf::Vector2f position, sf::Vector2f& velocity_change, const float mass, const float grav_const,
+		const float capture_radius_sq, const float dt, const unsigned self = no_self) const
+	{
+		unsigned captures = 0;
+		unsigned n = 0;
+		const unsigned node_count = static_cast<unsigned>(nodes_.size());
+
+		while (n < node_count)
+		{
+			const Node& node = nodes_[n];
+
+			if (node.leaf)
+			{
+				for (unsigned b = node.body_begin; b < node.body_end; ++b)
+				{
+					if (order_[b] == self)
+						continue;
+
+					const sf::Vector2f direction = toroidal_direction(position, { body_x_[b], body_y_[b] }, bounds_);
+					const float distance_sq = direction.x * direction.x + direction.y * direction.y;
+
+					if (distance_sq < capture_radius_sq)
+					{
+						++captures;
+						continue;
+					}
+
+					velocity_change += direction * (grav_const * mass * body_mass_[b] / distance_sq * dt);
+				}
+				n = node.skip;
+				continue;
+			}
+
+			const sf::Vector2f direction = toroidal_direction(position, { node.com_x, node.com_y }, bounds_);
+			const float distance_sq = direction.x * direction.x + direction.y * direction.y;
+
+			// a node may only be collapsed if all of it lies on the same side of the minimum image cut,
+			// otherwise part of its mass is really closer through the periodic boundary than its centre is
+			const bool one_image = std::abs(direction.x) + node.size <= bounds_.width / 2 && std::abs(direction.y) + node.size <= bounds_.height / 2;
+
+			if (one_image && node.size_sq < theta_sq_ * distance_sq)
+			{
+				velocity_change += direction * (grav_const * mass * node.mass / distance_sq * dt);
+				n = node.skip;
+			}
+			else
+				++n;
+		}
+
+		return captures;
+	}
+
+
+	size_t node_count() const { return nodes_.size(); }
+
+private:
+	// builds the subtree for order_[begin, end) inside the square box at (left, top) and returns its node index
+	unsigned build_node(const BlackHoles& black_holes, const unsigned begin, const unsigned end,
+		const float left, const float top, const float side, const unsigned depth)
+	{
+		const unsigned index = static_cast<unsigned>(nodes_.size());
+		nodes_.push_back({});
+
+		float mass = 0.f, com_x = 0.f, com_y = 0.f;
+		for (unsigned i = begin; i < end; ++i)
+		{
+			const unsigned b = order_[i];
+			mass += black_holes.mass[b];
+			com_x += black_holes.x[b] * black_holes.mass[b];
+			com_y += black_holes.y[b] * black_holes.mass[b];
+		}
+
+		Node node{};
+		node.mass = mass;
+		node.com_x = mass > 0.f ? com_x / mass : left + side / 2;
+		node.com_y = mass > 0.f ? com_y / mass : top + side / 2;
+		node.size = side;
+		node.size_sq = side * side;
+
+		if (end - begin <= leaf_size_ || depth >= max_depth)
+		{
+			node.leaf = true;
+			node.body_begin = begin;
+			node.body_end = end;
+		}
+		else
+		{
+			const float half = side / 2;
+			const float mid_x = left + half;
+			const float mid_y = top + half;
+
+			// split into quadrants: first on y, then each half on x
+			auto by_x = [&](const unsigned b) { return black_holes.x[b] < mid_x; };
+			auto by_y = [&](const unsigned b) { return black_holes.y[b] < mid_y; };
+
+			unsigned* data = order_.data();
+			const unsigned split_y = static_cast<unsigned>(std::partition(data + begin, data + end, by_y) - data);
+			const unsigned split_top = static_cast<unsigned>(std::partition(data + begin, data + split_y, by_x) - data);
+			const unsigned split_bottom = static_cast<unsigned>(std::partition(data + split_y, data + end, by_x) - data);
+
+			if (split_top > begin)
+				build_node(black_holes, begin, split_top, left, top, half, depth + 1);
+			if (split_y > split_top)
+				build_node(black_holes, split_top, split_y, mid_x, top, half, depth + 1);
+			if (split_bottom > split_y)
+				build_node(black_holes, split_y, split_bottom, left, mid_y, half, depth + 1);
+			if (end > split_bottom)
+				build_node(black_holes, split_bottom, end, mid_x, mid_y, half, depth + 1);
+		}
+
+		node.skip = static_cast<unsigned>(nodes_.size());
+		nodes_[index] = node;
+		return index;
+	}
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+
+#include "toroidal_space.h"
+
+
+// structure-of-arrays storage for the black holes, so that the star kernel and the tree builder stream
+// through plain float arrays even when there are thousands of them
+struct BlackHoles
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> vx;
+	std::vector<float> vy;
+	std::vector<float> mass;
+	std::vector<float> z;  // only sized in 3D
+	std::vector<float> vz;
+
+	size_t size() const { return x.size(); }
+
+	void resize(const size_t count, const unsigned dimensions = 2)
+	{
+		x.resize(count);
+		y.resize(count);
+		vx.resize(count);
+		vy.resize(count);
+		mass.resize(count);
+		z.resize(dimensions == 3 ? count : 0);
+		vz.resize(dimensions == 3 ? count : 0);
+	}
+
+	sf::Vector2f position(const size_t i) const { return { x[i], y[i] }; }
+	sf::Vector2f velocity(const size_t i) const { return { vx[i], vy[i] }; }
+
+	void set_position(const size_t i, const sf::Vector2f position) { x[i] = position.x; y[i] = position.y; }
+	void set_velocity(const size_t i, const sf::Vector2f velocity) { vx[i] = velocity.x; vy[i] = velocity.y; }
+
+	void set_position(const size_t i, const sf::Vector3f position) { x[i] = position.x; y[i] = position.y; z[i] = position.z; }
+	void set_velocity(const size_t i, const sf::Vector3f velocity) { vx[i] = velocity.x; vy[i] = velocity.y; vz[i] = velocity.z; }
+
+	template<unsigned Dimensions>
+	typename Space<Dimensions>::Vector position_in(const size_t i) const
+	{
+		if constexpr (Dimensions == 2)
+			return position(i);
+		else
+			return { x[i], y[i], z[i] };
+	}
+
+	template<unsigned Dimensions>
+	typename Space<Dimensions>::Vector velocity_in(const size_t i) const
+	{
+		if constexpr (Dimensions == 2)
+			return velocity(i);
+		else
+			return { vx[i], vy[i], vz[i] };
+	}
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "spatial_grid.h"
+#include "threading.h"
+#include "toroidal_space.h"
+
+
+// zoom / pan over the simulation. zoom 1 shows the whole torus, the view is always kept inside the world
+// so there is never a periodic seam on screen. a 3D world is projected onto the 2D one first, tilted with
+// Page Up / Page Down once enable_tilt has been called
+class Camera
+{
+	sf::FloatRect world_;
+	sf::Vector2f screen_;
+	float base_scale_;
+	float max_zoom_;
+	float zoom_step_;
+
+	float zoom_ = 1.f;
+	sf::Vector2f center_;
+
+	bool dragging_ = false;
+	sf::Vector2i last_mouse_{};
+
+	float depth_ = 0.f; // 0 in 2D
+	float tilt_step_ = 0.f;
+	float tilt_ = 0.f;  // radians, 0 looks straight down on the x / y plane
+
+public:
+	Camera(const sf::FloatRect& world, const sf::Vector2u screen, const float base_scale, const float max_zoom, const float zoom_step)
+		: world_(world), screen_(static_cast<float>(screen.x), static_cast<float>(screen.y)),
+		  base_scale_(base_scale), max_zoom_(max_zoom), zoom_step_(zoom_step)
+	{
+		reset();
+	}
+
+
+	void enable_tilt(const float depth, const float tilt_step)
+	{
+		depth_ = depth;
+		tilt_step_ = tilt_step;
+	}
+
+
+	void reset()
+	{
+		zoom_ = 1.f;
+		tilt_ = 0.f;
+		center_ = { world_.left + world_.width / 2, world_.top + world_.height / 2 };
+		clamp();
+	}
+
+
+	float zoom() const { return zoom_; }
+	float scale() const { return base_scale_ * zoom_; }
+	float tilt() const { return tilt_; }
+
+	// 3D world -> the 2D world the rest of the camera works in
+	Projection projection() const
+	{
+		return { world_.top + world_.height / 2, depth_ / 2, std::cos(tilt_), std::sin(tilt_), world_.top, world_.height };
+	}
+
+	// world -> pixel
+	sf::Transform transform() const
+	{
+		sf::Transform transform;
+		transform.translate(screen_ / 2.f);
+		transform.scale(scale(), scale());
+		transform.translate(-center_);
+		return transform;
+	}
+
+	sf::Vector2f to_world(const sf::Vector2i pixel) const
+	{
+		return center_ + (sf::Vector2f(pixel) - screen_ / 2.f) / scale();
+	}
+
+	sf::FloatRect view_rect() const
+	{
+		const sf::Vector2f half = screen_ / (2.f * scale());
+		return { center_.x - half.x, center_.y - half.y, half.x * 2, half.y * 2 };
+	}
+
+
+	// wheel zooms around the cursor, right / middle drag and the arrow keys pan, Home resets.
+	// returns true if the event was used
+	bool handle_event(const sf::Event& event)
+	{
+		switch (event.type)
+		{
+		case sf::Event::MouseWheelScrolled:
+			zoom_at({ event.mouseWheelScroll.x, event.mouseWheelScroll.y }, std::pow(zoom_step_, event.mouseWheelScroll.delta));
+			return true;
+
+		case sf::Event::MouseButtonPressed:
+			if (event.mouseButton.button == sf::Mouse::Right || event.mouseButton.button == sf::Mouse::Middle)
+			{
+				dragging_ = true;
+				last_mouse_ = { event.mouseButton.x, event.mouseButton.y };
+				return true;
+			}
+			return false;
+
+		case sf::Event::MouseButtonReleased:
+			if (event.mouseButton.button == sf::Mouse::Right || event.mouseButton.button == sf::Mouse::Middle)
+			{
+				dragging_ = false;
+				return true;
+			}
+			return false;
+
+		case sf::Event::MouseMoved:
+			if (!dragging_)
+				return false;
+			pan_pixels(sf::Vector2f(sf::Vector2i(event.mouseMove.x, event.mouseMove.y) - last_mouse_));
+			last_mouse_ = { event.mouseMove.x, event.mouseMove.y };
+			return true;
+
+		case sf::Event::KeyPressed:
+			switch (event.key.code)
+			{
+			case sf::Keyboard::Left:  pan_pixels({ screen_.x * 0.1f, 0 }); return true;
+			case sf::Keyboard::Right: pan_pixels({ -screen_.x * 0.1f, 0 }); return true;
+			case sf::Keyboard::Up:    pan_pixels({ 0, screen_.y * 0.1f }); return true;
+			case sf::Keyboard::Down:  pan_pixels({ 0, -screen_.y * 0.1f }); return true;
+			case sf::Keyboard::Home:  reset(); return true;
+			case sf::Keyboard::PageUp:   return tilt_by(tilt_step_);
+			case sf::Keyboard::PageDown: return tilt_by(-tilt_step_);
+			default: return false;
+			}
+
+		default:
+			return false;
+		}
+	}
+
+
+	// keeps the world point under pixel fixed while zooming
+	void zoom_at(const sf::Vector2i pixel, const float factor)
+	{
+		const sf::Vector2f anchor = to_world(pixel);
+		zoom_ = std::clamp(zoom_ * factor, 1.f, max_zoom_);
+		center_ = anchor - (sf::Vector2f(pixel) - screen_ / 2.f) / scale();
+		clamp();
+	}
+
+	// moves the image by delta pixels (the world follows the mouse)
+	void pan_pixels(const sf::Vector2f delta)
+	{
+		center_ -= delta / scale();
+		clamp();
+	}
+
+	// up to a quarter turn, where the disks are seen edge on
+	bool tilt_by(const float radians)
+	{
+		if (depth_ <= 0.f)
+			return false;
+
+		tilt_ = std::clamp(tilt_ + radians, 0.f, 1.5707964f);
+		return true;
+	}
+
+private:
+	// centres an axis on which the view is wider than the world (other aspect ratio, or rounding at zoom 1)
+	void clamp()
+	{
+		const sf::FloatRect view = view_rect();
+		auto clamp_axis = [](const float value, const float low, const float high)
+		{
+			return low > high ? (low + high) / 2 : std::clamp(value, low, high);
+		};
+		center_.x = clamp_axis(center_.x, world_.left + view.width / 2, world_.left + world_.width - view.width / 2);
+		center_.y = clamp_axis(center_.y, world_.top + view.height / 2, world_.top + world_.height - view.height / 2);
+	}
+};
+
+
+// collects the stars of every grid cell overlapping view into out. if more than budget are visible only every
+// stride-th star of each cell is kept (cell-stratified, so the density field is preserved) and the caller boosts
+// their weight by stride. rows of cells are written in parallel at offsets from a prefix sum over the row counts,
+// which lives in scratch
+struct CullResult
+{
+	size_t count;
+	unsigned stride;
+};
+
+inline CullResult cull_stars(const SpatialGrid& grid, const sf::FloatRect& view, const size_t budget, ThreadPool& pool,
+	Arena& scratch, std::vector<sf::Vector2f>& out)
+{
+	const sf::FloatRect& world = grid.bounds();
+	auto cell_range = [](const float from, const float to, const float origin, const float size, const int cells)
+	{
+		const int first = std::clamp(static_cast<int>(std::floor((from - origin) / size)), 0, cells - 1);
+		const int last = std::clamp(static_cast<int>(std::floor((to - origin) / size)), 0, cells - 1);
+		return std::pair(first, last);
+	};
+
+	const auto [x0, x1] = cell_range(view.left, view.left + view.width, world.left, grid.cell_width(), grid.cells_x());
+	const auto [y0, y1] = cell_range(view.top, view.top + view.height, world.top, grid.cell_height(), grid.cells_y());
+	const size_t rows = static_cast<size_t>(y1 - y0 + 1);
+
+	auto sampled_in_row = [&](const int y, const unsigned stride)
+	{
+		size_t total = 0;
+		for (int x = x0; x <= x1; ++x)
+		{
+			const size_t cell = static_cast<size_t>(y) * grid.cells_x() + x;
+			total += (grid.cell_end(cell) - grid.cell_begin(cell) + stride - 1) / stride;
+		}
+		return total;
+	};
+
+	// 1. visible count decides the stride, 2. per-row counts at that stride become write offsets
+	size_t* row_offsets = scratch.allocate<size_t>(rows + 1);
+	std::fill_n(row_offsets, rows + 1, size_t(0));
+	pool.parallel_for(rows, [&](const size_t begin, const size_t end, unsigned)
+	{
+		for (size_t r = begin; r < end; ++r)
+			row_offsets[r + 1] = sampled_in_row(y0 + static_cast<int>(r), 1);
+	});
+
+	size_t visible = 0;
+	for (size_t r = 1; r <= rows; ++r)
+		visible += row_offsets[r];
+
+	const unsigned stride = budget == 0 ? 1u : static_cast<unsigned>(std::max<size_t>(1, (visible + budget - 1) / budget));
+	if (stride > 1)
+	{
+		pool.parallel_for(rows, [&](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t r = begin; r < end; ++r)
+				row_offsets[r + 1] = sampled_in_row(y0 + static_cast<int>(r), stride);
+		});
+	}
+
+	for (size_t r = 1; r <= rows; ++r)
+		row_offsets[r] += row_offsets[r - 1];
+
+	out.resize(std::max(out.size(), row_offsets[rows]));
+	pool.parallel_for(rows, [&](const size_t begin, const size_t end, unsigned)
+	{
+		for (size_t r = begin; r < end; ++r)
+		{
+			size_t o = row_offsets[r];
+			const size_t row = static_cast<size_t>(y0 + static_cast<int>(r)) * grid.cells_x();
+			for (int x = x0; x <= x1; ++x)
+				for (unsigned s = grid.cell_begin(row + x); s < grid.cell_end(row + x); s += stride)
+					out[o++] = grid.sorted_position(s);
+		}
+	});
+
+	return { row_offsets[rows], stride };
+}
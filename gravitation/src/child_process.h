@@ -0,0 +1,104 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+
+// starts a copy of this program with the given arguments, args[0] is the executable
+class ChildProcess
+{
+#ifdef _WIN32
+	PROCESS_INFORMATION process_{};
+#else
+	pid_t pid_ = -1;
+#endif
+
+public:
+	explicit ChildProcess(const std::vector<std::string>& args)
+	{
+#ifdef _WIN32
+		std::string command;
+		for (const std::string& arg : args)
+			command += (command.empty() ? "\"" : " \"") + arg + "\"";
+		STARTUPINFOA startup{ sizeof(STARTUPINFOA) };
+		if (!CreateProcessA(nullptr, command.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process_))
+			process_ = {};
+#else
+		std::vector<char*> argv;
+		for (const std::string& arg : args)
+			argv.push_back(const_cast<char*>(arg.c_str()));
+		argv.push_back(nullptr);
+		if (posix_spawnp(&pid_, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+			pid_ = -1;
+#endif
+		if (!started())
+			std::cerr << "shards: cannot start " << args[0] << "\n";
+	}
+
+	~ChildProcess()
+	{
+#ifdef _WIN32
+		if (started())
+		{
+			WaitForSingleObject(process_.hProcess, INFINITE);
+			CloseHandle(process_.hProcess);
+			CloseHandle(process_.hThread);
+		}
+#else
+		if (started())
+			waitpid(pid_, nullptr, 0);
+#endif
+	}
+
+	// false once the process has exited. POSIX reaps it here, started() is false from then on
+	bool running()
+	{
+#ifdef _WIN32
+		DWORD code = 0;
+		return started() && GetExitCodeProcess(process_.hProcess, &code) && code == STILL_ACTIVE;
+#else
+		if (!started())
+			return false;
+		if (waitpid(pid_, nullptr, WNOHANG) == 0)
+			return true;
+		pid_ = -1;
+		return false;
+#endif
+	}
+
+	// for a process that does not leave on its own
+	void terminate()
+	{
+#ifdef _WIN32
+		if (started())
+			TerminateProcess(process_.hProcess, 1);
+#else
+		if (started())
+			kill(pid_, SIGKILL);
+#endif
+	}
+
+
+	ChildProcess(const ChildProcess&) = delete;
+	ChildProcess& operator=(const ChildProcess&) = delete;
+
+#ifdef _WIN32
+	bool started() const { return process_.hProcess != nullptr; }
+#else
+	bool started() const { return pid_ > 0; }
+#endif
+};
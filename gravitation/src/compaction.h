@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "threading.h"
+
+
+// stable parallel stream compaction. plan counts the kept elements of every thread's slice and turns the counts
+// into output offsets with an exclusive prefix sum, apply then has every slice scatter its kept elements to its
+// offset in the caller's scratch buffer and copies them back in parallel. one plan serves
+// every array of the same length, so all per-star arrays stay aligned. plan also collects the removed indices,
+// every slice into its thread's scratch arena first
+class StreamCompaction
+{
+	ThreadPool& pool_;
+	FrameArenas& arenas_;
+	const std::uint8_t* removed_ = nullptr;
+	size_t count_ = 0;
+	size_t kept_ = 0;
+	std::vector<size_t> offsets_;                                 // per slice
+	std::vector<std::pair<const size_t*, size_t>> slice_removed_; // per slice, indices and their count
+	std::vector<size_t> removed_indices_;
+
+public:
+	StreamCompaction(ThreadPool& pool, FrameArenas& arenas)
+		: pool_(pool), arenas_(arenas), offsets_(pool.size() + 1), slice_removed_(pool.size())
+	{
+	}
+
+
+	// removed[i] != 0 drops element i. returns the number of elements kept
+	size_t plan(const std::uint8_t* removed, const size_t count)
+	{
+		removed_ = removed;
+		count_ = count;
+		std::fill(offsets_.begin(), offsets_.end(), 0);
+		std::fill(slice_removed_.begin(), slice_removed_.end(), std::pair<const size_t*, size_t>{}); // below one element per thread only slice 0 runs
+
+		pool_.parallel_for(count, [this](const size_t begin, const size_t end, const unsigned t)
+		{
+			const auto dropped = static_cast<size_t>(std::count_if(removed_ + begin, removed_ + end, [](const std::uint8_t flag) { return flag != 0; }));
+			size_t* indices = arenas_.scratch(t).allocate<size_t>(dropped);
+			for (size_t i = begin, out = 0; out < dropped; ++i)
+				if (removed_[i])
+					indices[out++] = i;
+			slice_removed_[t] = { indices, dropped };
+			offsets_[t + 1] = end - begin - dropped;
+		});
+
+		removed_indices_.clear();
+		for (size_t t = 0; t < slice_removed_.size(); ++t)
+		{
+			offsets_[t + 1] += offsets_[t];
+			const auto [indices, dropped] = slice_removed_[t];
+			removed_indices_.insert(removed_indices_.end(), indices, indices + dropped);
+		}
+
+		kept_ = offsets_.back();
+		return kept_;
+	}
+
+
+	size_t kept() const { return kept_; }
+	const std::vector<size_t>& removed_indices() const { return removed_indices_; }
+
+
+	// values must have the planned length. scratch only grows, the owner keeps it for the next call so a steady
+	// compaction allocates nothing. the kept elements go back into values, whose pages stay where they were
+	template<typename Type, typename Allocator>
+	void apply(std::vector<Type, Allocator>& values, std::vector<std::byte>& scratch)
+	{
+		static_assert(std::is_trivially_copyable_v<Type>, "the elements are staged as raw bytes");
+		if (scratch.size() < kept_ * sizeof(Type))
+			scratch.resize(kept_ * sizeof(Type));
+		Type* const kept = reinterpret_cast<Type*>(scratch.data()); // operator new aligns for every star type
+
+		pool_.parallel_for(count_, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			size_t out = offsets_[t];
+			for (size_t i = begin; i < end; ++i)
+				if (!removed_[i])
+					kept[out++] = values[i];
+		});
+		pool_.parallel_for(kept_, [&](const size_t begin, const size_t end, unsigned)
+		{
+			std::copy(kept + begin, kept + end, values.data() + begin);
+		});
+		values.resize(kept_);
+	}
+};
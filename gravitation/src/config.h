@@ -0,0 +1,428 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "settings.h"
+#include "toroidal_space.h"
+
+
+// runtime configuration. defaults come from settings.h, then a "key = value" file (--config <path>),
+// then "--key=value" command line overrides. live parameters are hot reloaded when the file changes,
+// startup parameters size the simulation and only take effect after a restart
+struct Config
+{
+	// startup
+	unsigned screen_width = SFMLSettings::screen_width;
+	unsigned screen_height = SFMLSettings::screen_height;
+	float simulation_scale = SFMLSettings::simulation_scale;
+
+	unsigned number_of_stars = SimulationSettings::number_of_stars;
+	unsigned star_capacity = SimulationSettings::star_capacity;
+	std::string huge_pages = SimulationSettings::huge_pages;
+	unsigned number_of_black_holes = SimulationSettings::number_of_black_holes;
+	unsigned dimensions = SimulationSettings::dimensions;
+	float world_depth = SimulationSettings::world_depth;
+	float disk_thickness = SimulationSettings::disk_thickness;
+	unsigned threads = SimulationSettings::threads;
+	std::string thread_affinity = SimulationSettings::thread_affinity;
+	float star_spawn_radius = SimulationSettings::star_spawn_radius;
+	float initial_bh_velocity = SimulationSettings::initial_bh_velocity;
+	unsigned star_render_path = SimulationSettings::star_render_path;
+	bool density_render = SimulationSettings::density_render;
+
+	bool headless = SimulationSettings::headless;
+	bool headless_gl = SimulationSettings::headless_gl;
+	unsigned headless_steps = SimulationSettings::headless_steps;
+	unsigned frame_interval = SimulationSettings::frame_interval;
+	unsigned image_width = SimulationSettings::image_width;
+	unsigned image_height = SimulationSettings::image_height;
+	std::string image_output = SimulationSettings::image_output;
+	std::string capture = SimulationSettings::capture;
+	unsigned capture_fps = SimulationSettings::capture_fps;
+	bool validate_lod = SimulationSettings::validate_lod;
+	unsigned validation_steps = SimulationSettings::validation_steps;
+	bool benchmark_field = SimulationSettings::benchmark_field;
+	std::string star_precision = SimulationSettings::star_precision;
+	bool benchmark_precision = SimulationSettings::benchmark_precision;
+	unsigned precision_steps = SimulationSettings::precision_steps;
+	bool benchmark_numa = SimulationSettings::benchmark_numa;
+	bool benchmark_huge_pages = SimulationSettings::benchmark_huge_pages;
+	bool benchmark_timestep = SimulationSettings::benchmark_timestep;
+	bool benchmark_black_holes = SimulationSettings::benchmark_black_holes;
+	unsigned shard_workers = SimulationSettings::shard_workers;
+	unsigned shard_worker = 0; // set by the coordinator on the command line of the workers it starts
+	std::string shard_name = SimulationSettings::shard_name;
+	unsigned domains = SimulationSettings::domains;
+	unsigned domain_rank = 0; // set by rank 0 on the command line of the ranks it starts
+	std::string domain_address = SimulationSettings::domain_address;
+	unsigned domain_steps = SimulationSettings::domain_steps;
+
+	// live
+	float G = SimulationSettings::G;
+	float dt = SimulationSettings::dt;
+	bool adaptive_dt = SimulationSettings::adaptive_dt;
+	float dt_eta = SimulationSettings::dt_eta;
+	float dt_min = SimulationSettings::dt_min;
+	float dt_max = SimulationSettings::dt_max;
+	bool hermite_black_holes = SimulationSettings::hermite_black_holes;
+	float black_hole_eta = SimulationSettings::black_hole_eta;
+	float cosmic_speed_limit = SimulationSettings::cosmic_speed_limit;
+	float damping = SimulationSettings::damping;
+	bool speed_limit_stars = SimulationSettings::speed_limit_stars;
+	bool damp_stars = SimulationSettings::damp_stars;
+	bool capture_stars = SimulationSettings::capture_stars;
+	float star_inflow = SimulationSettings::star_inflow;
+	bool accretion = SimulationSettings::accretion;
+	float accreted_mass = SimulationSettings::accreted_mass;
+	bool temporal_lod = SimulationSettings::temporal_lod;
+	unsigned lod_interval = SimulationSettings::lod_interval;
+	float lod_error = SimulationSettings::lod_error;
+	bool host_drift = SimulationSettings::host_drift;
+	float host_drift_threshold = SimulationSettings::host_drift_threshold;
+	unsigned host_drift_refresh = SimulationSettings::host_drift_refresh;
+	bool acceleration_field = SimulationSettings::acceleration_field;
+	bool field_bicubic = SimulationSettings::field_bicubic;
+	float field_tolerance = SimulationSettings::field_tolerance;
+
+	std::string executable; // argv[0], shard workers are started with it
+	std::string path; // config file, watched for hot reload
+	std::vector<std::pair<std::string, std::string>> overrides; // command line values win over the file, also after a reload
+
+
+	sf::FloatRect bounds() const
+	{
+		return { 0, 0, screen_width / simulation_scale, screen_height / simulation_scale };
+	}
+
+	Box<float> box() const
+	{
+		const sf::FloatRect plane = bounds();
+		return { { plane.left, plane.top, 0.f }, { plane.width, plane.height, world_depth } };
+	}
+
+	static Config from_command_line(int argc, char** argv);
+
+	bool load(const std::string& file_path);
+	bool set(const std::string& key, const std::string& value);
+	void apply_overrides();
+	// what it takes to start another process with this configuration
+	std::vector<std::string> command_line() const;
+
+	// copies the live parameters of other and reports startup parameters that differ
+	void update_live(const Config& other);
+	// fixes the combinations of values that are each in range but contradict each other
+	void validate();
+};
+
+
+// values outside [min, max] are rejected, positive is the smallest value of a field that has to be above 0
+inline constexpr double positive = std::numeric_limits<float>::min();
+inline constexpr double unbounded = std::numeric_limits<double>::max();
+
+struct ConfigField
+{
+	const char* name;
+	std::variant<unsigned Config::*, float Config::*, bool Config::*, std::string Config::*> member;
+	bool live;
+	double min = -unbounded;
+	double max = unbounded;
+};
+
+inline const std::array<ConfigField, 67> config_fields = { {
+	{ "screen_width",          &Config::screen_width,          false, 1 },
+	{ "screen_height",         &Config::screen_height,         false, 1 },
+	{ "simulation_scale",      &Config::simulation_scale,      false, positive },
+	{ "number_of_stars",       &Config::number_of_stars,       false, 1 },
+	{ "star_capacity",         &Config::star_capacity,         false },
+	{ "huge_pages",            &Config::huge_pages,            false },
+	{ "number_of_black_holes", &Config::number_of_black_holes, false, 1 },
+	{ "dimensions",            &Config::dimensions,            false, 2, 3 },
+	{ "world_depth",           &Config::world_depth,           false, positive },
+	{ "disk_thickness",        &Config::disk_thickness,        false, 0 },
+	{ "threads",               &Config::threads,               false, 1 },
+	{ "thread_affinity",       &Config::thread_affinity,       false },
+	{ "star_spawn_radius",     &Config::star_spawn_radius,     false, positive },
+	{ "initial_bh_velocity",   &Config::initial_bh_velocity,   false, 0 },
+	{ "star_render_path",      &Config::star_render_path,      false, 0, 3 },
+	{ "density_render",        &Config::density_render,        false },
+	{ "headless",              &Config::headless,              false },
+	{ "headless_gl",           &Config::headless_gl,           false },
+	{ "headless_steps",        &Config::headless_steps,        false },
+	{ "frame_interval",        &Config::frame_interval,        false, 1 },
+	{ "image_width",           &Config::image_width,           false, 1 },
+	{ "image_height",          &Config::image_height,          false, 1 },
+	{ "image_output",          &Config::image_output,          false },
+	{ "capture",               &Config::capture,               false },
+	{ "capture_fps",           &Config::capture_fps,           false, 1 },
+	{ "validate_lod",          &Config::validate_lod,          false },
+	{ "validation_steps",      &Config::validation_steps,      false, 1 },
+	{ "benchmark_field",       &Config::benchmark_field,       false },
+	{ "star_precision",        &Config::star_precision,        false },
+	{ "benchmark_precision",   &Config::benchmark_precision,   false },
+	{ "precision_steps",       &Config::precision_steps,       false, 1 },
+	{ "benchmark_numa",        &Config::benchmark_numa,        false },
+	{ "benchmark_huge_pages",  &Config::benchmark_huge_pages,  false },
+	{ "benchmark_timestep",    &Config::benchmark_timestep,    false },
+	{ "benchmark_black_holes", &Config::benchmark_black_holes, false },
+	{ "shard_workers",         &Config::shard_workers,         false },
+	{ "shard_worker",          &Config::shard_worker,          false },
+	{ "shard_name",            &Config::shard_name,            false },
+	{ "domains",               &Config::domains,               false },
+	{ "domain_rank",           &Config::domain_rank,           false },
+	{ "domain_address",        &Config::domain_address,        false },
+	{ "domain_steps",          &Config::domain_steps,          false, 1 },
+	{ "G",                     &Config::G,                     true, 0 },
+	{ "dt",                    &Config::dt,                    true, positive },
+	{ "adaptive_dt",           &Config::adaptive_dt,           true },
+	{ "dt_eta",                &Config::dt_eta,                true, positive },
+	{ "dt_min",                &Config::dt_min,                true, positive },
+	{ "dt_max",                &Config::dt_max,                true, positive },
+	{ "hermite_black_holes",   &Config::hermite_black_holes,   true },
+	{ "black_hole_eta",        &Config::black_hole_eta,        true, positive },
+	{ "cosmic_speed_limit",    &Config::cosmic_speed_limit,    true, positive },
+	{ "damping",               &Config::damping,               true, 0, 1 },
+	{ "speed_limit_stars",     &Config::speed_limit_stars,     true },
+	{ "damp_stars",            &Config::damp_stars,            true },
+	{ "capture_stars",         &Config::capture_stars,         true },
+	{ "star_inflow",           &Config::star_inflow,           true, 0 },
+	{ "accretion",             &Config::accretion,             true },
+	{ "accreted_mass",         &Config::accreted_mass,         true, 0 },
+	{ "temporal_lod",          &Config::temporal_lod,          true },
+	{ "lod_interval",          &Config::lod_interval,          true, 1 },
+	{ "lod_error",             &Config::lod_error,             true, 0 },
+	{ "host_drift",            &Config::host_drift,            true },
+	{ "host_drift_threshold",  &Config::host_drift_threshold,  true, 0 },
+	{ "host_drift_refresh",    &Config::host_drift_refresh,    true, 1 },
+	{ "acceleration_field",    &Config::acceleration_field,    true },
+	{ "field_bicubic",         &Config::field_bicubic,         true },
+	{ "field_tolerance",       &Config::field_tolerance,       true, 0 },
+} };
+
+
+inline Config Config::from_command_line(const int argc, char** argv)
+{
+	Config config;
+	if (argc > 0)
+		config.executable = argv[0];
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--config" && i + 1 < argc)
+			config.path = argv[++i];
+
+		else if (arg.rfind("--", 0) == 0 && arg.find('=') != std::string::npos)
+		{
+			const size_t equals = arg.find('=');
+			config.overrides.emplace_back(arg.substr(2, equals - 2), arg.substr(equals + 1));
+		}
+
+		else
+			std::cerr << "config: ignoring argument " << arg << " (expected --config <file> or --key=value)\n";
+	}
+
+	if (!config.path.empty())
+		config.load(config.path);
+
+	config.apply_overrides();
+	config.validate();
+	return config;
+}
+
+
+inline bool Config::load(const std::string& file_path)
+{
+	std::ifstream file(file_path);
+	if (!file)
+	{
+		std::cerr << "config: cannot open " << file_path << "\n";
+		return false;
+	}
+
+	std::string line;
+	unsigned line_number = 0;
+	while (std::getline(file, line))
+	{
+		++line_number;
+		line = line.substr(0, line.find('#'));
+
+		const size_t equals = line.find('=');
+		if (equals == std::string::npos)
+			continue;
+
+		std::string key, value, rest;
+		std::istringstream(line.substr(0, equals)) >> key;
+		std::istringstream values(line.substr(equals + 1));
+		values >> value;
+
+		if (values >> rest || !set(key, value))
+			std::cerr << "config: " << file_path << ":" << line_number << ": bad entry '" << key << " = " << value << "'\n";
+	}
+	return true;
+}
+
+
+// the whole text has to be the value, "1.5x" and a negative unsigned are rejected
+template<typename Type>
+bool parse_config_value(const std::string& text, Type& value)
+{
+	if constexpr (std::is_same_v<Type, std::string>)
+	{
+		value = text;
+		return true;
+	}
+	else if constexpr (std::is_same_v<Type, bool>)
+	{
+		if (text != "true" && text != "false")
+			return false;
+		value = text == "true";
+		return true;
+	}
+	else
+	{
+		const char* end = text.data() + text.size();
+		const auto [parsed_end, error] = std::from_chars(text.data(), end, value);
+		if constexpr (std::is_floating_point_v<Type>)
+		{
+			if (!std::isfinite(value))
+				return false;
+		}
+		return !text.empty() && error == std::errc() && parsed_end == end;
+	}
+}
+
+
+inline bool Config::set(const std::string& key, const std::string& value)
+{
+	for (const ConfigField& field : config_fields)
+	{
+		if (key != field.name)
+			continue;
+
+		return std::visit([this, &value, &field](auto member)
+		{
+			auto parsed = this->*member;
+			if (!parse_config_value(value, parsed))
+				return false;
+
+			if constexpr (std::is_arithmetic_v<decltype(parsed)> && !std::is_same_v<decltype(parsed), bool>)
+			{
+				if (parsed < field.min || parsed > field.max)
+				{
+					std::cerr << "config: " << field.name << " = " << value << " is out of range";
+					if (field.min == positive)
+						std::cerr << ", has to be above 0";
+					else if (field.min > -unbounded)
+						std::cerr << ", at least " << field.min;
+					if (field.max < unbounded)
+						std::cerr << ", at most " << field.max;
+					std::cerr << "\n";
+					return false;
+				}
+			}
+
+			this->*member = parsed;
+			return true;
+		}, field.member);
+	}
+	return false;
+}
+
+
+inline void Config::apply_overrides()
+{
+	for (const auto& [key, value] : overrides)
+		if (!set(key, value))
+			std::cerr << "config: bad command line entry --" << key << "=" << value << "\n";
+}
+
+
+inline void Config::validate()
+{
+	if (dt_min > dt_max)
+	{
+		std::cerr << "config: dt_min " << dt_min << " is above dt_max " << dt_max << ", using " << dt_min << " for both\n";
+		dt_max = dt_min;
+	}
+	if (domains > 1 && domain_rank >= domains)
+	{
+		std::cerr << "config: domain_rank " << domain_rank << " is not below domains " << domains << ", running as rank 0\n";
+		domain_rank = 0;
+	}
+}
+
+
+inline std::vector<std::string> Config::command_line() const
+{
+	std::vector<std::string> args{ executable };
+	if (!path.empty())
+	{
+		args.push_back("--config");
+		args.push_back(path);
+	}
+	for (const auto& [key, value] : overrides)
+		args.push_back("--" + key + "=" + value);
+	return args;
+}
+
+
+inline void Config::update_live(const Config& other)
+{
+	for (const ConfigField& field : config_fields)
+	{
+		std::visit([&](auto member)
+		{
+			if (this->*member == other.*member)
+				return;
+
+			if (field.live)
+			{
+				std::cout << "config: " << field.name << " " << this->*member << " -> " << other.*member << "\n";
+				this->*member = other.*member;
+			}
+			else
+				std::cout << "config: " << field.name << " changed, restart to apply\n";
+		}, field.member);
+	}
+}
+
+
+// polls the modification time of the config file, cheap enough to call a few times a second
+class ConfigWatcher
+{
+	std::string path_;
+	std::filesystem::file_time_type last_write_{};
+
+public:
+	explicit ConfigWatcher(std::string path) : path_(std::move(path))
+	{
+		changed();
+	}
+
+	bool changed()
+	{
+		if (path_.empty())
+			return false;
+
+		std::error_code error;
+		const auto write_time = std::filesystem::last_write_time(path_, error);
+		if (error || write_time == last_write_)
+			return false;
+
+		last_write_ = write_time;
+		return true;
+	}
+};
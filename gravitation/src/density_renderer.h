@@ -0,0 +1,132 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+#include <vector>
+
+#include "threading.h"
+
+
+// CPU renderer that never touches the GL vertex path: every thread splats its share of the stars into its own
+// float histogram at screen resolution, the histograms are summed in parallel, tone mapped with asinh into the
+// star colour palette and uploaded as a single texture. cost scales with stars / cores instead of driver overhead.
+// the texture is only created on the first resolve, so tone_map alone works without any GL context (headless)
+class DensityRenderer
+{
+	ThreadPool& pool_;
+	unsigned width_;
+	unsigned height_;
+
+	std::vector<float> histograms_;   // one width * height layer per thread
+	std::vector<float> thread_peaks_;
+	std::vector<sf::Uint8> pixels_;   // RGBA
+
+	std::array<float, 3> base_colour_; // star colour normalised so its brightest channel is 1
+	float softening_;                 // density at which asinh turns from linear to logarithmic
+	float peak_ = 1.f;                // smoothed brightest pixel, sets the exposure of the next frame
+
+	std::optional<sf::Texture> texture_;
+	sf::Sprite sprite_;
+
+public:
+	DensityRenderer(const unsigned width, const unsigned height, const sf::Color star_colour, const float softening, ThreadPool& pool)
+		: pool_(pool), width_(width), height_(height),
+		  histograms_(static_cast<size_t>(pool.size()) * width * height, 0.f), thread_peaks_(pool.size(), 0.f),
+		  pixels_(static_cast<size_t>(width) * height * 4, 255), softening_(softening)
+	{
+		const float brightest = std::max({ star_colour.r, star_colour.g, star_colour.b, sf::Uint8(1) });
+		base_colour_ = { star_colour.r / brightest, star_colour.g / brightest, star_colour.b / brightest };
+	}
+
+
+	// accumulates weight per star at its transformed pixel, points outside the image are dropped
+	void splat(const sf::Vector2f* positions, const size_t count, const sf::Transform& transform, const float weight = 1.f)
+	{
+		const float* m = transform.getMatrix();
+		const float width = static_cast<float>(width_);
+		const float height = static_cast<float>(height_);
+
+		pool_.parallel_for(count, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			float* histogram = &histograms_[static_cast<size_t>(t) * width_ * height_];
+			for (size_t i = begin; i < end; ++i)
+			{
+				const float x = m[0] * positions[i].x + m[4] * positions[i].y + m[12];
+				const float y = m[1] * positions[i].x + m[5] * positions[i].y + m[13];
+
+				if (x >= 0.f && y >= 0.f && x < width && y < height)
+					histogram[static_cast<size_t>(y) * width_ + static_cast<size_t>(x)] += weight;
+			}
+		});
+	}
+
+
+	// tone maps, adapts the exposure and uploads the pixels to the texture
+	void resolve()
+	{
+		adapt_exposure(tone_map());
+
+		if (!texture_)
+		{
+			texture_.emplace();
+			texture_->create(width_, height_);
+			sprite_.setTexture(*texture_, true);
+		}
+		texture_->update(pixels_.data());
+	}
+
+
+	// sums the per-thread histograms, clears them for the next splat and tone maps into pixels() in one parallel
+	// pass at the current exposure. returns the densest pixel
+	float tone_map()
+	{
+		const size_t pixel_count = static_cast<size_t>(width_) * height_;
+		const unsigned layers = pool_.size();
+		const float inv_softening = 1.f / softening_;
+		const float inv_peak = 1.f / std::asinh(peak_ * inv_softening);
+
+		std::fill(thread_peaks_.begin(), thread_peaks_.end(), 0.f);
+
+		pool_.parallel_for(pixel_count, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			float peak = 0.f;
+			for (size_t p = begin; p < end; ++p)
+			{
+				float density = 0.f;
+				for (unsigned layer = 0; layer < layers; ++layer)
+				{
+					float& value = histograms_[layer * pixel_count + p];
+					density += value;
+					value = 0.f;
+				}
+				peak = std::max(peak, density);
+
+				// asinh keeps faint outskirts visible without blowing out the cores, highlights drift towards white
+				const float v = std::min(1.f, std::asinh(density * inv_softening) * inv_peak);
+				const float highlight = v * v * v;
+				sf::Uint8* pixel = &pixels_[p * 4];
+				for (size_t c = 0; c < 3; ++c)
+					pixel[c] = static_cast<sf::Uint8>(255.f * std::min(1.f, base_colour_[c] * v + (1.f - base_colour_[c]) * highlight));
+			}
+			thread_peaks_[t] = std::max(thread_peaks_[t], peak);
+		});
+
+		return *std::max_element(thread_peaks_.begin(), thread_peaks_.end());
+	}
+
+
+	// exposure follows the brightest pixel slowly so the image does not flicker, rate 1 jumps straight to it
+	void adapt_exposure(const float frame_peak, const float rate = 0.1f)
+	{
+		peak_ += (std::max(softening_, frame_peak) - peak_) * rate;
+	}
+
+
+	const sf::Sprite& sprite() const { return sprite_; }
+	const std::vector<sf::Uint8>& pixels() const { return pixels_; }
+	unsigned width() const { return width_; }
+	unsigned height() const { return height_; }
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "arena.h"
+#include "black_holes.h"
+#include "compaction.h"
+#include "huge_pages.h"
+#include "threading.h"
+#include "transport.h"
+
+
+// what a rank measured during a distributed run, summed over its steps
+struct DomainStats
+{
+	std::uint64_t steps = 0;
+	std::uint64_t stars = 0;      // at the end
+	std::uint64_t migrated = 0;   // stars sent to the rank that owns them now
+	std::uint64_t ghosts = 0;     // halo stars received
+	std::uint64_t bytes_sent = 0;
+	std::uint64_t bytes_received = 0;
+	double step_ms = 0.0;
+	double exchange_ms = 0.0;     // of step_ms, spent in the transport
+};
+
+
+// spatial domain decomposition of the torus into slabs along x. the cuts sit at quantiles of the starting star x
+// coordinates, a single level orthogonal recursive bisection into size parts, so every rank starts with the same
+// number of stars. rank 0 owns the black holes and broadcasts them after every step, stars that left their slab
+// migrate to their new owner with their velocity, and the stars within halo_width of a cut are sent across it as
+// ghosts (positions only) for terms that need a star's neighbourhood. the slab of the last rank ends at the
+// world's edge and the first rank's starts there, so the halo wraps around
+class DomainDecomposition
+{
+	Transport& transport_;
+	ThreadPool& pool_;
+	sf::FloatRect bounds_;
+	float halo_width_;
+	std::vector<float> cuts_; // size + 1, rank r owns [cuts_[r], cuts_[r + 1])
+	std::vector<unsigned> others_;
+	std::vector<unsigned> neighbours_;
+	std::vector<Transport::Message> outgoing_;
+	std::vector<Transport::Message> incoming_;
+	std::vector<std::uint8_t> leaving_;
+	StreamCompaction compaction_;
+	std::vector<std::byte> compaction_scratch_;
+	std::vector<sf::Vector2f> ghosts_;
+	size_t migrated_ = 0;
+
+public:
+	DomainDecomposition(Transport& transport, ThreadPool& pool, FrameArenas& arenas, const sf::FloatRect& bounds, const float halo_width)
+		: transport_(transport), pool_(pool), bounds_(bounds), halo_width_(halo_width), cuts_(transport.size() + 1),
+		  outgoing_(transport.size()), incoming_(transport.size()), compaction_(pool, arenas)
+	{
+		const unsigned rank = transport_.rank(), size = transport_.size();
+		for (unsigned r = 0; r < size; ++r)
+			if (r != rank)
+				others_.push_back(r);
+
+		if (size > 1)
+			neighbours_.push_back((rank + size - 1) % size);
+		if (size > 2)
+			neighbours_.push_back((rank + 1) % size);
+	}
+
+
+	unsigned owner(const float x) const
+	{
+		const auto cut = std::upper_bound(cuts_.begin() + 1, cuts_.end() - 1, wrap(x));
+		return static_cast<unsigned>(cut - (cuts_.begin() + 1));
+	}
+
+	float slab_left() const { return cuts_[transport_.rank()]; }
+	float slab_right() const { return cuts_[transport_.rank() + 1]; }
+	const std::vector<sf::Vector2f>& ghosts() const { return ghosts_; }
+	size_t migrated() const { return migrated_; }
+
+
+	// rank 0 places the cuts at the quantiles of its stars and sends every rank the cuts, the black holes and
+	// the stars in its slab. the other ranks replace their own starting state with what they receive
+	bool decompose(StarArray<sf::Vector2f>& positions, StarArray<sf::Vector2f>& velocities, BlackHoles& black_holes)
+	{
+		const unsigned rank = transport_.rank(), size = transport_.size();
+		if (rank == 0)
+		{
+			std::vector<float> xs(positions.size());
+			for (size_t i = 0; i < positions.size(); ++i)
+				xs[i] = positions[i].x;
+			cuts_.front() = bounds_.left;
+			cuts_.back() = bounds_.left + bounds_.width;
+			for (unsigned r = 1; r < size; ++r)
+			{
+				const auto quantile = xs.begin() + static_cast<std::ptrdiff_t>(xs.size() * r / size);
+				std::nth_element(xs.begin(), quantile, xs.end());
+				cuts_[r] = xs.empty() ? bounds_.left + bounds_.width * r / size : *quantile;
+			}
+
+			clear_outgoing();
+			for (const unsigned r : others_)
+				append(outgoing_[r], cuts_.data(), cuts_.size());
+			append_black_holes(black_holes);
+			send_away(positions, velocities);
+		}
+
+		if (!transport_.exchange(rank == 0 ? others_ : std::vector<unsigned>{ 0 }, outgoing_, incoming_))
+			return false;
+
+		if (rank != 0)
+		{
+			const std::byte* data = incoming_[0].data();
+			data = read(data, cuts_.data(), cuts_.size());
+			data = unpack_black_holes(data, black_holes);
+			positions.clear();
+			velocities.clear();
+			receive_stars(data, incoming_[0].data() + incoming_[0].size(), positions, velocities);
+		}
+		return true;
+	}
+
+
+	// the black holes are only moved on rank 0
+	bool broadcast_black_holes(BlackHoles& black_holes)
+	{
+		const unsigned rank = transport_.rank();
+		clear_outgoing();
+		if (rank == 0)
+			append_black_holes(black_holes);
+
+		if (!transport_.exchange(rank == 0 ? others_ : std::vector<unsigned>{ 0 }, outgoing_, incoming_))
+			return false;
+
+		if (rank != 0)
+			unpack_black_holes(incoming_[0].data(), black_holes);
+		return true;
+	}
+
+
+	// stars outside this rank's slab go to their owner, the kept stars stay in order and the arrivals are appended
+	bool migrate(StarArray<sf::Vector2f>& positions, StarArray<sf::Vector2f>& velocities)
+	{
+		const size_t before = positions.size();
+		clear_outgoing();
+		send_away(positions, velocities);
+		migrated_ = before - positions.size();
+
+		if (!transport_.exchange(others_, outgoing_, incoming_))
+			return false;
+
+		for (const unsigned r : others_)
+			receive_stars(incoming_[r].data(), incoming_[r].data() + incoming_[r].size(), positions, velocities);
+		return true;
+	}
+
+
+	// every neighbour gets the positions within halo_width of the cut between them
+	bool exchange_halo(const StarArray<sf::Vector2f>& positions)
+	{
+		if (neighbours_.empty())
+		{
+			ghosts_.clear();
+			return true;
+		}
+
+		const unsigned left = neighbours_.front();
+		const unsigned right = neighbours_.back();
+		clear_outgoing();
+		for (const sf::Vector2f& position : positions)
+		{
+			const float x = wrap(position.x); // the kernels leave a star up to one step outside the world
+			const bool near_left = x - slab_left() < halo_width_;
+			const bool near_right = slab_right() - x < halo_width_;
+			if (near_left)
+				append(outgoing_[left], &position, 1);
+			if (near_right && !(near_left && left == right)) // with two ranks both cuts face the same neighbour
+				append(outgoing_[right], &position, 1);
+		}
+
+		if (!transport_.exchange(neighbours_, outgoing_, incoming_))
+			return false;
+
+		ghosts_.clear();
+		for (const unsigned r : neighbours_)
+		{
+			const size_t count = incoming_[r].size() / sizeof(sf::Vector2f);
+			const size_t first = ghosts_.size();
+			ghosts_.resize(first + count);
+			read(incoming_[r].data(), ghosts_.data() + first, count);
+		}
+		return true;
+	}
+
+
+	// rank 0 gets every rank's stats, the others an empty list
+	std::vector<DomainStats> gather(const DomainStats& stats)
+	{
+		const unsigned rank = transport_.rank();
+		clear_outgoing();
+		if (rank != 0)
+			append(outgoing_[0], &stats, 1);
+
+		if (!transport_.exchange(rank == 0 ? others_ : std::vector<unsigned>{ 0 }, outgoing_, incoming_) || rank != 0)
+			return {};
+
+		std::vector<DomainStats> all(transport_.size());
+		all[0] = stats;
+		for (const unsigned r : others_)
+			if (incoming_[r].size() == sizeof(DomainStats))
+				read(incoming_[r].data(), &all[r], 1);
+		return all;
+	}
+
+private:
+	float wrap(const float x) const
+	{
+		return bounds_.left + std::fmod(std::fmod(x - bounds_.left, bounds_.width) + bounds_.width, bounds_.width);
+	}
+
+	template<typename Type>
+	static void append(Transport::Message& message, const Type* values, const size_t count)
+	{
+		const size_t offset = message.size();
+		message.resize(offset + count * sizeof(Type));
+		std::memcpy(message.data() + offset, values, count * sizeof(Type));
+	}
+
+	template<typename Type>
+	static const std::byte* read(const std::byte* data, Type* values, const size_t count)
+	{
+		std::memcpy(values, data, count * sizeof(Type));
+		return data + count * sizeof(Type);
+	}
+
+
+	void clear_outgoing()
+	{
+		for (Transport::Message& message : outgoing_)
+			message.clear();
+	}
+
+	void append_black_holes(const BlackHoles& black_holes)
+	{
+		for (const unsigned r : others_)
+			for (const std::vector<float>* array : { &black_holes.x, &black_holes.y, &black_holes.vx, &black_holes.vy, &black_holes.mass })
+				append(outgoing_[r], array->data(), array->size());
+	}
+
+	const std::byte* unpack_black_holes(const std::byte* data, BlackHoles& black_holes) const
+	{
+		for (std::vector<float>* array : { &black_holes.x, &black_holes.y, &black_holes.vx, &black_holes.vy, &black_holes.mass })
+			data = read(data, array->data(), array->size());
+		return data;
+	}
+
+
+	// appends every star outside this rank's slab to its owner's message and compacts it away
+	void send_away(StarArray<sf::Vector2f>& positions, StarArray<sf::Vector2f>& velocities)
+	{
+		const unsigned rank = transport_.rank();
+		leaving_.resize(positions.size());
+		pool_.parallel_for(positions.size(), [&](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t i = begin; i < end; ++i)
+				leaving_[i] = owner(positions[i].x) != rank;
+		});
+
+		compaction_.plan(leaving_.data(), positions.size());
+		for (const size_t i : compaction_.removed_indices())
+		{
+			Transport::Message& message = outgoing_[owner(positions[i].x)];
+			append(message, &positions[i], 1);
+			append(message, &velocities[i], 1);
+		}
+		compaction_.apply(positions, compaction_scratch_);
+		compaction_.apply(velocities, compaction_scratch_);
+	}
+
+	static void receive_stars(const std::byte* data, const std::byte* end, StarArray<sf::Vector2f>& positions, StarArray<sf::Vector2f>& velocities)
+	{
+		while (data + 2 * sizeof(sf::Vector2f) <= end)
+		{
+			sf::Vector2f position, velocity;
+			data = read(data, &position, 1);
+			data = read(data, &velocity, 1);
+			positions.push_back(position);
+			velocities.push_back(velocity);
+		}
+	}
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "gl_functions.h"
+
+
+// sends std::cout to stderr for as long as it lives, when stdout carries video. held by the simulation from
+// before its first message, so that nothing is printed into the stream or after it
+class CoutToStderr
+{
+	std::streambuf* cout_buffer_ = nullptr;
+
+public:
+	explicit CoutToStderr(const bool active)
+	{
+		if (active)
+			cout_buffer_ = std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
+	~CoutToStderr()
+	{
+		if (cout_buffer_)
+			std::cout.rdbuf(cout_buffer_);
+	}
+
+	CoutToStderr(const CoutToStderr&) = delete;
+	CoutToStderr& operator=(const CoutToStderr&) = delete;
+};
+
+
+// streams finished frames to a file or to stdout ("-") for an external encoder, e.g.
+//     gravitation --capture=- | ffmpeg -i - out.mp4
+// a path ending in .y4m (or stdout) gets YUV4MPEG2 4:4:4, anything else raw rgb24 frames back to back
+// (ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH). frames are copied into a ring of preallocated slots and
+// converted / written by a single writer thread. offer never waits: when the ring is full the frame is dropped
+// and counted instead
+class FrameCapture
+{
+	unsigned width_;
+	unsigned height_;
+	bool y4m_;
+	std::FILE* file_ = nullptr;
+
+	std::vector<std::vector<sf::Uint8>> slots_; // RGBA
+	std::vector<unsigned char> bottom_up_;
+	std::atomic<size_t> produced_ = 0;
+	std::atomic<size_t> consumed_ = 0;
+	size_t dropped_ = 0;
+
+	std::mutex mutex_; // only for sleeping and waking the writer
+	std::condition_variable ready_;
+	bool stop_ = false;
+	std::thread writer_;
+
+public:
+	FrameCapture(const std::string& path, const unsigned width, const unsigned height, const unsigned fps, const unsigned slots)
+		: width_(width), height_(height), y4m_(path == "-" || path.ends_with(".y4m")),
+		  slots_(std::max(2u, slots), std::vector<sf::Uint8>(static_cast<size_t>(width) * height * 4)),
+		  bottom_up_(slots_.size(), 0)
+	{
+		if (path == "-")
+		{
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			file_ = stdout;
+		}
+		else
+			file_ = std::fopen(path.c_str(), "wb");
+
+		if (!file_)
+		{
+			std::cerr << "capture: cannot open " << path << "\n";
+			return;
+		}
+
+		if (y4m_)
+			std::fprintf(file_, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width_, height_, fps);
+
+		writer_ = std::thread([this]() { write_frames(); });
+	}
+
+	~FrameCapture()
+	{
+		if (writer_.joinable())
+		{
+			{
+				std::lock_guard lock(mutex_);
+				stop_ = true;
+			}
+			ready_.notify_one();
+			writer_.join(); // drains what is already in the ring
+		}
+
+		if (file_ == stdout)
+			std::fflush(file_);
+		else if (file_)
+			std::fclose(file_);
+
+		std::cerr << "capture: " << consumed_.load() << " frames written, " << dropped_ << " dropped\n";
+	}
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	bool is_open() const { return writer_.joinable(); }
+	unsigned width() const { return width_; }
+	unsigned height() const { return height_; }
+	size_t written() const { return consumed_.load(std::memory_order_relaxed); }
+	size_t dropped() const { return dropped_; }
+
+
+	// copies a width * height RGBA frame into the ring, or drops it if the writer is a whole ring behind
+	bool offer(const sf::Uint8* rgba, const bool bottom_up)
+	{
+		const size_t produced = produced_.load(std::memory_order_relaxed);
+		if (!is_open() || produced - consumed_.load(std::memory_order_acquire) == slots_.size())
+		{
+			++dropped_;
+			return false;
+		}
+
+		const size_t slot = produced % slots_.size();
+		std::memcpy(slots_[slot].data(), rgba, slots_[slot].size());
+		bottom_up_[slot] = bottom_up;
+		produced_.store(produced + 1, std::memory_order_release);
+
+		{
+			std::lock_guard lock(mutex_); // the writer checks under the lock, so this wake-up cannot be missed
+		}
+		ready_.notify_one();
+		return true;
+	}
+
+	// frames lost before they reached the ring, e.g. a readback the gpu had not finished in time
+	void drop(const size_t frames) { dropped_ += frames; }
+
+private:
+	void write_frames()
+	{
+		std::vector<sf::Uint8> converted(static_cast<size_t>(width_) * height_ * 3);
+
+		while (true)
+		{
+			const size_t consumed = consumed_.load(std::memory_order_relaxed);
+			{
+				std::unique_lock lock(mutex_);
+				ready_.wait(lock, [&]() { return stop_ || produced_.load(std::memory_order_acquire) != consumed; });
+				if (produced_.load(std::memory_order_acquire) == consumed)
+					return;
+			}
+
+			const size_t slot = consumed % slots_.size();
+			if (y4m_)
+				to_yuv444(slots_[slot].data(), bottom_up_[slot], converted.data());
+			else
+				to_rgb(slots_[slot].data(), bottom_up_[slot], converted.data());
+			consumed_.store(consumed + 1, std::memory_order_release); // the slot is free again
+
+			if (y4m_)
+				std::fputs("FRAME\n", file_);
+			if (std::fwrite(converted.data(), 1, converted.size(), file_) != converted.size())
+			{
+				std::cerr << "capture: write failed, stopping\n";
+				return;
+			}
+		}
+	}
+
+	const sf::Uint8* row(const sf::Uint8* rgba, const bool bottom_up, const unsigned y) const
+	{
+		return rgba + static_cast<size_t>(bottom_up ? height_ - 1 - y : y) * width_ * 4;
+	}
+
+	void to_rgb(const sf::Uint8* rgba, const bool bottom_up, sf::Uint8* out) const
+	{
+		for (unsigned y = 0; y < height_; ++y)
+		{
+			const sf::Uint8* source = row(rgba, bottom_up, y);
+			for (unsigned x = 0; x < width_; ++x, out += 3)
+			{
+				out[0] = source[x * 4 + 0];
+				out[1] = source[x * 4 + 1];
+				out[2] = source[x * 4 + 2];
+			}
+		}
+	}
+
+	// BT.601 studio range, planar Y then Cb then Cr
+	void to_yuv444(const sf::Uint8* rgba, const bool bottom_up, sf::Uint8* out) const
+	{
+		const size_t plane = static_cast<size_t>(width_) * height_;
+		for (unsigned y = 0; y < height_; ++y)
+		{
+			const sf::Uint8* source = row(rgba, bottom_up, y);
+			for (unsigned x = 0; x < width_; ++x)
+			{
+				const int r = source[x * 4 + 0], g = source[x * 4 + 1], b = source[x * 4 + 2];
+				const size_t p = static_cast<size_t>(y) * width_ + x;
+				out[p] = static_cast<sf::Uint8>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				out[plane + p] = static_cast<sf::Uint8>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				out[plane * 2 + p] = static_cast<sf::Uint8>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		}
+	}
+};
+
+
+// reads the back buffer into pixel pack buffers without waiting for the gpu: every frame starts a readback
+// and collects the one started `buffers` frames earlier if its fence has signalled, otherwise that frame is
+// given up. without buffer objects and fences it falls back to a plain, stalling glReadPixels
+class FrameReadback
+{
+	static constexpr unsigned buffers = 3;
+
+	unsigned width_;
+	unsigned height_;
+	std::array<GLuint, buffers> pbos_{};
+	std::array<gl::Sync, buffers> fences_{};
+	unsigned next_ = 0;
+	bool async_;
+	std::vector<sf::Uint8> pixels_; // fallback only
+
+public:
+	// requires the context of the window being captured to be active
+	FrameReadback(const unsigned width, const unsigned height)
+		: width_(width), height_(height), async_(gl::functions().async_readback())
+	{
+		if (!async_)
+		{
+			std::cerr << "capture: no pixel buffer objects, every readback will stall the render thread\n";
+			pixels_.resize(static_cast<size_t>(width) * height * 4);
+			return;
+		}
+
+		const gl::Functions& f = gl::functions();
+		f.GenBuffers(buffers, pbos_.data());
+		for (const GLuint pbo : pbos_)
+		{
+			f.BindBuffer(gl::pixel_pack_buffer, pbo);
+			f.BufferData(gl::pixel_pack_buffer, static_cast<gl::SizeIPtr>(pixels_size()), nullptr, gl::stream_read);
+		}
+		f.BindBuffer(gl::pixel_pack_buffer, 0);
+	}
+
+	~FrameReadback()
+	{
+		if (!async_)
+			return;
+
+		for (gl::Sync& fence : fences_)
+			if (fence)
+				gl::functions().DeleteSync(fence);
+		gl::functions().DeleteBuffers(buffers, pbos_.data());
+	}
+
+	FrameReadback(const FrameReadback&) = delete;
+	FrameReadback& operator=(const FrameReadback&) = delete;
+
+
+	// call after drawing and before display. deliver(const sf::Uint8* rgba) receives bottom-up RGBA rows of an
+	// earlier frame. returns the number of frames given up because the gpu had not finished them yet
+	template <typename Deliver>
+	unsigned capture(Deliver&& deliver)
+	{
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+		if (!async_)
+		{
+			glReadPixels(0, 0, static_cast<GLsizei>(width_), static_cast<GLsizei>(height_), GL_RGBA, GL_UNSIGNED_BYTE, pixels_.data());
+			deliver(pixels_.data());
+			return 0;
+		}
+
+		const unsigned given_up = collect(next_, 0, deliver) ? 0 : 1;
+
+		const gl::Functions& f = gl::functions();
+		f.BindBuffer(gl::pixel_pack_buffer, pbos_[next_]);
+		glReadPixels(0, 0, static_cast<GLsizei>(width_), static_cast<GLsizei>(height_), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		f.BindBuffer(gl::pixel_pack_buffer, 0);
+		fences_[next_] = f.FenceSync(gl::sync_gpu_commands_complete, 0);
+
+		next_ = (next_ + 1) % buffers;
+		return given_up;
+	}
+
+
+	// waits for the readbacks still in flight, oldest first. only for the end of a recording
+	template <typename Deliver>
+	void flush(Deliver&& deliver)
+	{
+		if (!async_)
+			return;
+
+		for (unsigned i = 0; i < buffers; ++i)
+			collect((next_ + i) % buffers, 1'000'000'000, deliver);
+	}
+
+private:
+	size_t pixels_size() const { return static_cast<size_t>(width_) * height_ * 4; }
+
+	// true if the slot was empty or delivered, false if it was given up
+	template <typename Deliver>
+	bool collect(const unsigned slot, const std::uint64_t timeout_ns, Deliver& deliver)
+	{
+		gl::Sync& fence = fences_[slot];
+		if (!fence)
+			return true;
+
+		const gl::Functions& f = gl::functions();
+		const GLenum result = f.ClientWaitSync(fence, gl::sync_flush_commands_bit, timeout_ns);
+		f.DeleteSync(fence);
+		fence = nullptr;
+
+		if (result != gl::already_signaled && result != gl::condition_satisfied)
+			return false;
+
+		f.BindBuffer(gl::pixel_pack_buffer, pbos_[slot]);
+		if (const void* data = f.MapBufferRange(gl::pixel_pack_buffer, 0, static_cast<gl::SizeIPtr>(pixels_size()), gl::map_read_bit))
+		{
+			deliver(static_cast<const sf::Uint8*>(data));
+			f.UnmapBuffer(gl::pixel_pack_buffer);
+		}
+		f.BindBuffer(gl::pixel_pack_buffer, 0);
+		return true;
+	}
+};
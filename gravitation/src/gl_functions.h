@@ -0,0 +1,91 @@
+#pragma once
+
+#include <SFML/OpenGL.hpp>
+#include <SFML/Window/Context.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+
+// the buffer object entry points beyond OpenGL 1.1, loaded through SFML's context once a context is active.
+// names and constants live in their own namespace so they never clash with whatever glext.h the platform ships
+namespace gl
+{
+	using SizeIPtr = std::ptrdiff_t;
+	using IntPtr = std::ptrdiff_t;
+	using Sync = struct __GLsync*;
+
+	inline constexpr GLenum array_buffer = 0x8892;
+	inline constexpr GLenum stream_draw = 0x88E0;
+	inline constexpr GLenum dynamic_draw = 0x88E8;
+	inline constexpr GLenum static_draw = 0x88E4;
+	inline constexpr GLenum pixel_pack_buffer = 0x88EB;
+	inline constexpr GLenum stream_read = 0x88E1;
+
+	inline constexpr GLbitfield map_read_bit = 0x0001;
+	inline constexpr GLbitfield map_write_bit = 0x0002;
+	inline constexpr GLbitfield map_invalidate_buffer_bit = 0x0008;
+	inline constexpr GLbitfield map_unsynchronized_bit = 0x0020;
+	inline constexpr GLbitfield map_persistent_bit = 0x0040;
+	inline constexpr GLbitfield map_coherent_bit = 0x0080;
+
+	inline constexpr GLenum sync_gpu_commands_complete = 0x9117;
+	inline constexpr GLbitfield sync_flush_commands_bit = 0x0001;
+	inline constexpr GLenum already_signaled = 0x911A;
+	inline constexpr GLenum timeout_expired = 0x911B;
+	inline constexpr GLenum condition_satisfied = 0x911C;
+	inline constexpr GLenum wait_failed = 0x911D;
+
+	struct Functions
+	{
+		void (APIENTRY* GenBuffers)(GLsizei, GLuint*) = nullptr;
+		void (APIENTRY* DeleteBuffers)(GLsizei, const GLuint*) = nullptr;
+		void (APIENTRY* BindBuffer)(GLenum, GLuint) = nullptr;
+		void (APIENTRY* BufferData)(GLenum, SizeIPtr, const void*, GLenum) = nullptr;
+		void (APIENTRY* BufferSubData)(GLenum, IntPtr, SizeIPtr, const void*) = nullptr;
+		void* (APIENTRY* MapBufferRange)(GLenum, IntPtr, SizeIPtr, GLbitfield) = nullptr;
+		GLboolean (APIENTRY* UnmapBuffer)(GLenum) = nullptr;
+
+		// ARB_buffer_storage / ARB_sync, only needed for persistent mapping
+		void (APIENTRY* BufferStorage)(GLenum, SizeIPtr, const void*, GLbitfield) = nullptr;
+		Sync (APIENTRY* FenceSync)(GLenum, GLbitfield) = nullptr;
+		GLenum (APIENTRY* ClientWaitSync)(Sync, GLbitfield, std::uint64_t) = nullptr;
+		void (APIENTRY* DeleteSync)(Sync) = nullptr;
+
+		bool buffers() const { return GenBuffers && DeleteBuffers && BindBuffer && BufferData && BufferSubData && MapBufferRange && UnmapBuffer; }
+		bool persistent_mapping() const { return buffers() && BufferStorage && FenceSync && ClientWaitSync && DeleteSync; }
+		bool async_readback() const { return buffers() && FenceSync && ClientWaitSync && DeleteSync; }
+	};
+
+
+	// requires an active context, the pointers are only valid for contexts of the same kind
+	inline const Functions& functions()
+	{
+		static const Functions loaded = []()
+		{
+			Functions f;
+			auto load = [](auto& pointer, const char* name)
+			{
+				pointer = reinterpret_cast<std::remove_reference_t<decltype(pointer)>>(sf::Context::getFunction(name));
+			};
+
+			load(f.GenBuffers, "glGenBuffers");
+			load(f.DeleteBuffers, "glDeleteBuffers");
+			load(f.BindBuffer, "glBindBuffer");
+			load(f.BufferData, "glBufferData");
+			load(f.BufferSubData, "glBufferSubData");
+			load(f.MapBufferRange, "glMapBufferRange");
+			load(f.UnmapBuffer, "glUnmapBuffer");
+			load(f.BufferStorage, "glBufferStorage");
+			load(f.FenceSync, "glFenceSync");
+			load(f.ClientWaitSync, "glClientWaitSync");
+			load(f.DeleteSync, "glDeleteSync");
+			return f;
+		}();
+		return loaded;
+	}
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "density_renderer.h"
+#include "image_writer.h"
+#include "star_renderer.h"
+#include "threading.h"
+
+
+// renders the star field into numbered image files without a window. the image is cut into tiles of at most
+// tile_size squared, so the per-thread splat histograms (or the GL render texture) stay small even at 16k x 16k;
+// every tile of a frame is tone mapped at the same exposure and copied into one RGBA frame, which the
+// ImageWriter encodes in the background while the simulation moves on.
+// the CPU splatter needs no GL context at all. the GL path draws through an offscreen sf::RenderTexture and
+// falls back to the splatter if one cannot be created (SFML still needs a display server for that, e.g. xvfb)
+class HeadlessRenderer
+{
+	ThreadPool& pool_;
+	unsigned width_;
+	unsigned height_;
+	unsigned tile_width_;
+	unsigned tile_height_;
+	sf::Transform transform_; // world -> image, the whole world fitted into the image
+
+	std::optional<DensityRenderer> density_;
+	bool primed_ = false; // the first frame measures its exposure before it is written
+
+	std::optional<sf::RenderTexture> target_;
+	std::optional<StarRenderer> star_renderer_;
+	sf::Image tile_image_;
+
+	ImageWriter writer_;
+	std::string output_;
+	unsigned frame_ = 0;
+
+public:
+	HeadlessRenderer(const sf::FloatRect& world, const unsigned width, const unsigned height, const unsigned tile_size,
+		const size_t star_count, const sf::Color star_colour, const float softening, const bool use_gl, const unsigned render_path,
+		std::string output, const unsigned writer_threads, const size_t max_pending, ThreadPool& pool)
+		: pool_(pool), width_(std::max(1u, width)), height_(std::max(1u, height)),
+		  tile_width_(std::min(width_, tile_size)), tile_height_(std::min(height_, tile_size)),
+		  writer_(writer_threads, max_pending), output_(std::move(output))
+	{
+		const float scale = std::min(width_ / world.width, height_ / world.height);
+		transform_ = Camera(world, { width_, height_ }, scale, 1.f, 1.f).transform();
+
+		if (use_gl)
+			create_gl(star_count, star_colour, render_path);
+		if (!target_)
+			density_.emplace(tile_width_, tile_height_, star_colour, softening, pool_);
+
+		std::cout << "headless: " << width_ << "x" << height_ << " in " << tiles_x() * tiles_y() << " tiles of "
+			<< tile_width_ << "x" << tile_height_ << " via " << (target_ ? "render texture" : "CPU splat") << ", writing " << output_ << "\n";
+	}
+
+
+	// renders one frame and queues it for writing, only waits if the writer is max_pending frames behind
+	void render_frame(const sf::Vector2f* positions, const size_t count)
+	{
+		std::vector<sf::Uint8> frame = writer_.acquire(static_cast<size_t>(width_) * height_ * 4);
+
+		if (target_)
+		{
+			star_renderer_->upload(positions, count);
+			render_tiles(frame.data(), [&](const sf::Transform& tile_transform) { return render_tile_gl(tile_transform); });
+			star_renderer_->finish_frame(); // every tile drew the same positions
+		}
+		else
+		{
+			auto splat_tile = [&](const sf::Transform& tile_transform)
+			{
+				density_->splat(positions, count, tile_transform);
+				return density_->tone_map();
+			};
+
+			if (!primed_)
+			{
+				density_->adapt_exposure(render_tiles(nullptr, splat_tile), 1.f);
+				primed_ = true;
+			}
+			density_->adapt_exposure(render_tiles(frame.data(), splat_tile));
+		}
+
+		writer_.submit(std::move(frame), width_, height_, numbered_path(frame_++));
+	}
+
+
+	// blocks until every frame is written, returns the number that failed
+	size_t finish()
+	{
+		writer_.finish();
+		return writer_.failed();
+	}
+
+	const ImageWriter& writer() const { return writer_; }
+
+private:
+	unsigned tiles_x() const { return (width_ + tile_width_ - 1) / tile_width_; }
+	unsigned tiles_y() const { return (height_ + tile_height_ - 1) / tile_height_; }
+
+
+	// runs render_tile for every tile and copies the result into frame (skipped when frame is null).
+	// render_tile returns the tile's densest pixel and leaves its RGBA pixels in tile_pixels()
+	template <typename RenderTile>
+	float render_tiles(sf::Uint8* frame, RenderTile&& render_tile)
+	{
+		float peak = 0.f;
+		for (unsigned ty = 0; ty < height_; ty += tile_height_)
+		{
+			for (unsigned tx = 0; tx < width_; tx += tile_width_)
+			{
+				sf::Transform tile_transform;
+				tile_transform.translate(-static_cast<float>(tx), -static_cast<float>(ty));
+				tile_transform.combine(transform_);
+
+				peak = std::max(peak, render_tile(tile_transform));
+				if (frame)
+					copy_tile(frame, tx, ty);
+			}
+		}
+		return peak;
+	}
+
+
+	const sf::Uint8* tile_pixels() const
+	{
+		return target_ ? tile_image_.getPixelsPtr() : density_->pixels().data();
+	}
+
+	void copy_tile(sf::Uint8* frame, const unsigned tx, const unsigned ty)
+	{
+		const unsigned columns = std::min(tile_width_, width_ - tx);
+		const unsigned rows = std::min(tile_height_, height_ - ty);
+		const sf::Uint8* pixels = tile_pixels();
+
+		pool_.parallel_for(rows, [&](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t y = begin; y < end; ++y)
+			{
+				const sf::Uint8* source = pixels + y * tile_width_ * 4;
+				std::copy(source, source + columns * 4, frame + ((ty + y) * width_ + tx) * 4);
+			}
+		});
+	}
+
+
+	float render_tile_gl(const sf::Transform& tile_transform)
+	{
+		target_->clear();
+		star_renderer_->draw(*target_, sf::RenderStates(sf::BlendAdd, tile_transform, nullptr, nullptr));
+		target_->display();
+		tile_image_ = target_->getTexture().copyToImage();
+		return 0.f; // points are drawn at a fixed brightness, there is no exposure to adapt
+	}
+
+
+	void create_gl(const size_t star_count, const sf::Color star_colour, const unsigned render_path)
+	{
+		const unsigned max_size = sf::Texture::getMaximumSize();
+		tile_width_ = std::min(tile_width_, max_size);
+		tile_height_ = std::min(tile_height_, max_size);
+
+		target_.emplace();
+		if (!target_->create(tile_width_, tile_height_) || !target_->setActive(true))
+		{
+			std::cerr << "headless: no offscreen GL target, falling back to the CPU splatter\n";
+			target_.reset();
+			return;
+		}
+
+		star_renderer_.emplace(star_count, star_colour, pool_);
+		star_renderer_->set_path(static_cast<StarRenderer::Path>(render_path));
+	}
+
+
+	// frames/galaxy.png -> frames/galaxy_000042.png
+	std::string numbered_path(const unsigned index) const
+	{
+		const std::filesystem::path path(output_);
+		char number[16];
+		std::snprintf(number, sizeof(number), "_%06u", index);
+		return (path.parent_path() / (path.stem().string() + number + path.extension().string())).string();
+	}
+};
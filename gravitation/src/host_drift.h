@@ -0,0 +1,156 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "black_holes.h"
+#include "star_kernel.h"
+#include "toroidal_space.h"
+
+
+// host drift: most stars are bound to one black hole and barely feel the others. such a star follows the exact
+// pull of its host every step, while the summed pull of all other black holes is cached and only re-evaluated
+// every refresh_interval steps (staggered by index). a star whose perturbation, |other pulls| / |host pull|,
+// exceeds the threshold, or that is inside a capture zone, takes the full update every step. per step a bound
+// star costs one black hole instead of all of them.
+// this replaces an analytic Kepler drift: the pull here falls off as 1/r (a logarithmic potential), whose
+// orbits are rosettes without a Kepler equation, so the host term is integrated like every other force
+inline constexpr unsigned no_host = std::numeric_limits<unsigned>::max();
+
+
+struct HostDriftParams
+{
+	unsigned* hosts;              // per star, no_host = perturbed
+	sf::Vector2f* perturbations;  // per star, cached acceleration from every black hole but the host
+	unsigned refresh_interval;
+	unsigned phase;
+	float threshold;
+};
+
+
+// returns the number of stars that went through the full evaluation
+template<unsigned Features>
+size_t update_star_range_host_drift(sf::Vector2f* positions, sf::Vector2f* velocities, const size_t begin, const size_t end,
+	const StarKernelParams& params, const HostDriftParams& drift)
+{
+	constexpr bool limit_speed = Features & feature_speed_limit;
+	constexpr bool damp = Features & feature_damping;
+	constexpr bool capture = Features & feature_capture;
+	constexpr bool midstep_kick = Features & feature_midstep_kick;
+
+	const BlackHoles& black_holes = *params.black_holes;
+	const sf::FloatRect bounds = params.bounds;
+	const float dt = params.dt;
+	const float threshold_sq = drift.threshold * drift.threshold;
+	const float pull_scale = params.G * params.star_mass;
+	sf::Vector2f* const render_positions = params.render_positions;
+
+	// acceleration from one black hole, false inside its capture zone (with capture on)
+	const auto pull = [&](const sf::Vector2f& position, const size_t b, sf::Vector2f& acceleration)
+	{
+		const sf::Vector2f direction = toroidal_direction(position, black_holes.position(b), bounds);
+		float distance_sq = direction.x * direction.x + direction.y * direction.y;
+
+		if constexpr (capture)
+		{
+			if (distance_sq < params.capture_radius_sq)
+				return false;
+		}
+		else
+			distance_sq = std::max(distance_sq, params.capture_radius_sq);
+
+		acceleration = direction * (pull_scale * black_holes.mass[b] / distance_sq);
+		return true;
+	};
+
+	size_t evaluations = 0;
+	size_t absorbed = 0;
+	for (size_t i = begin; i < end; ++i)
+	{
+		sf::Vector2f& position = positions[i];
+		sf::Vector2f& vel = velocities[i];
+		unsigned& host = drift.hosts[i];
+
+		border(position, bounds);
+		if constexpr (midstep_kick)
+			position += vel * (dt * 0.5f);
+
+		sf::Vector2f acceleration{};
+		unsigned captures = 0;
+
+		const bool due = (i + drift.phase) % drift.refresh_interval == 0;
+		sf::Vector2f host_acceleration{};
+		if (host == no_host || due || !pull(position, host, host_acceleration))
+		{
+			// full evaluation, which also picks the host: the black hole with the strongest pull
+			float strongest_sq = -1.f;
+			host = no_host;
+			for (size_t b = 0; b < black_holes.size(); ++b)
+			{
+				sf::Vector2f single{};
+				if (!pull(position, b, single))
+				{
+					++captures;
+					continue;
+				}
+
+				acceleration += single;
+				const float single_sq = single.x * single.x + single.y * single.y;
+				if (single_sq > strongest_sq)
+				{
+					strongest_sq = single_sq;
+					host_acceleration = single;
+					host = static_cast<unsigned>(b);
+				}
+			}
+
+			const sf::Vector2f others = acceleration - host_acceleration;
+			if (captures || others.x * others.x + others.y * others.y > threshold_sq * strongest_sq)
+				host = no_host;
+			else
+				drift.perturbations[i] = others;
+			++evaluations;
+		}
+		else
+			acceleration = host_acceleration + drift.perturbations[i];
+
+		absorbed += capture_star(vel, captures, i, params);
+		vel += acceleration * dt;
+
+		if constexpr (limit_speed)
+			speed_limit(vel, params.max_speed);
+
+		position += vel * (midstep_kick ? dt * 0.5f : dt);
+
+		if (render_positions)
+			render_positions[i] = position;
+
+		if constexpr (damp)
+			vel *= params.damping;
+	}
+	add_absorbed(absorbed, params.absorbed_count);
+	return evaluations;
+}
+
+
+using HostDriftKernel = size_t(*)(sf::Vector2f*, sf::Vector2f*, size_t, size_t, const StarKernelParams&, const HostDriftParams&);
+
+namespace detail
+{
+	template<unsigned... Features>
+	constexpr std::array<HostDriftKernel, feature_count> make_host_drift_table(std::integer_sequence<unsigned, Features...>)
+	{
+		return { &update_star_range_host_drift<Features & (feature_speed_limit | feature_damping | feature_capture | feature_midstep_kick)>... };
+	}
+
+	inline constexpr auto host_drift_kernels = make_host_drift_table(std::make_integer_sequence<unsigned, feature_count>{});
+}
+
+
+inline HostDriftKernel select_host_drift_kernel(const unsigned features)
+{
+	return detail::host_drift_kernels[features];
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+
+// how the star arrays are backed. transparent maps them 2 MB aligned and asks the kernel to use huge pages
+// (madvise), explicit_2m and explicit_1g take pages from the reserved hugetlb pool (MAP_HUGETLB, large pages on
+// Windows, which need the lock pages in memory privilege). an explicit request that fails falls back to
+// transparent, Windows has no transparent huge pages and falls back to normal pages
+enum class HugePages : std::uint8_t
+{
+	none,
+	transparent,
+	explicit_2m,
+	explicit_1g,
+};
+
+inline constexpr std::array<const char*, 4> huge_page_names = { "none", "transparent", "2m", "1g" };
+inline constexpr size_t huge_page_2m = size_t(1) << 21;
+inline constexpr size_t huge_page_1g = size_t(1) << 30;
+
+// none for anything but the names above
+inline HugePages parse_huge_pages(const std::string& name)
+{
+	for (size_t mode = 0; mode < huge_page_names.size(); ++mode)
+		if (name == huge_page_names[mode])
+			return static_cast<HugePages>(mode);
+	return HugePages::none;
+}
+
+inline const char* huge_pages_name(const HugePages mode)
+{
+	return huge_page_names[static_cast<size_t>(mode)];
+}
+
+
+// bytes mapped since startup by the kind of page they actually got, plain counts the fallbacks to normal pages
+struct HugePageCounters
+{
+	std::array<std::atomic<size_t>, 4> bytes{};
+
+	size_t operator[](const HugePages mode) const { return bytes[static_cast<size_t>(mode)].load(std::memory_order_relaxed); }
+};
+inline HugePageCounters huge_page_counters;
+
+
+// arrays below half a huge page are left to operator new, and 1 GB pages are only used from half a gigabyte up
+inline HugePages huge_pages_for(const size_t bytes, HugePages mode)
+{
+	if (mode == HugePages::explicit_1g && bytes < huge_page_1g / 2)
+		mode = HugePages::explicit_2m;
+	if (bytes < huge_page_2m / 2)
+		mode = HugePages::none;
+	return mode;
+}
+
+inline size_t huge_mapping_size(const size_t bytes, const HugePages mode)
+{
+	const size_t page = mode == HugePages::explicit_1g ? huge_page_1g : huge_page_2m;
+	return (bytes + page - 1) / page * page;
+}
+
+
+// mode as given by huge_pages_for, never none. nullptr when not even normal pages are left
+inline void* map_huge_pages(const size_t bytes, const HugePages mode)
+{
+	const size_t size = huge_mapping_size(bytes, mode);
+	auto count = [size](const HugePages got) { huge_page_counters.bytes[static_cast<size_t>(got)].fetch_add(size, std::memory_order_relaxed); };
+#ifdef _WIN32
+	const SIZE_T large_page = GetLargePageMinimum();
+	if (mode != HugePages::transparent && large_page > 0 && size % large_page == 0)
+	{
+		if (void* data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))
+		{
+			count(mode);
+			return data;
+		}
+	}
+	void* data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (data)
+		count(HugePages::none);
+	return data;
+#else
+	if (mode != HugePages::transparent)
+	{
+		const int page_flag = mode == HugePages::explicit_1g ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag, -1, 0);
+		if (data != MAP_FAILED)
+		{
+			count(mode);
+			return data;
+		}
+	}
+
+	// over-map by a huge page and trim the ends, so the mapping starts on a 2 MB boundary
+	void* raw = mmap(nullptr, size + huge_page_2m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return nullptr;
+	const auto begin = reinterpret_cast<std::uintptr_t>(raw);
+	const std::uintptr_t aligned = (begin + huge_page_2m - 1) / huge_page_2m * huge_page_2m;
+	if (aligned > begin)
+		munmap(raw, aligned - begin);
+	if (begin + huge_page_2m > aligned)
+		munmap(reinterpret_cast<void*>(aligned + size), begin + huge_page_2m - aligned);
+
+#ifdef MADV_HUGEPAGE
+	const bool advised = madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE) == 0;
+#else
+	const bool advised = false;
+#endif
+	count(advised ? HugePages::transparent : HugePages::none);
+	return reinterpret_cast<void*>(aligned);
+#endif
+}
+
+inline void unmap_huge_pages(void* data, const size_t bytes, const HugePages mode)
+{
+#ifdef _WIN32
+	(void)bytes;
+	(void)mode;
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	munmap(data, huge_mapping_size(bytes, mode));
+#endif
+}
+
+
+// bytes of the mapping that holds address the kernel backs with transparent huge pages (AnonHugePages in
+// /proc/self/smaps), -1 where that is not known
+inline long long transparent_huge_bytes(const void* address)
+{
+#ifdef __linux__
+	std::ifstream smaps("/proc/self/smaps");
+	const auto target = reinterpret_cast<std::uintptr_t>(address);
+	bool inside = false;
+	std::string line;
+	while (std::getline(smaps, line))
+	{
+		std::uintptr_t begin = 0, end = 0;
+		char dash = 0;
+		std::istringstream header(line);
+		if (header >> std::hex >> begin >> dash >> end && dash == '-')
+		{
+			inside = begin <= target && target < end;
+			continue;
+		}
+		if (inside && line.rfind("AnonHugePages:", 0) == 0)
+		{
+			long long kib = 0;
+			std::istringstream(line.substr(14)) >> kib;
+			return kib * 1024;
+		}
+	}
+	return -1;
+#else
+	(void)address;
+	return -1;
+#endif
+}
+
+
+// the element StarAllocator leaves unwritten, see resize_uninitialized. any other allocator value-initializes
+struct Uninitialized
+{
+	template<typename Type>
+	operator Type() const { return Type{}; }
+};
+
+// count Uninitialized elements, what resize_uninitialized inserts
+struct UninitializedElements
+{
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = Uninitialized;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const Uninitialized*;
+	using reference = Uninitialized;
+
+	size_t index;
+
+	Uninitialized operator*() const { return {}; }
+	UninitializedElements& operator++() { ++index; return *this; }
+	UninitializedElements operator++(int) { UninitializedElements previous = *this; ++index; return previous; }
+	bool operator==(const UninitializedElements&) const = default;
+};
+
+
+// allocator of the star arrays, every allocation of at least half a huge page is mapped the way the mode asks.
+// stateful, containers of different modes are unequal and move or swap their allocator along with the buffer
+template<typename Type>
+class StarAllocator
+{
+	HugePages mode_ = HugePages::none;
+
+public:
+	using value_type = Type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	StarAllocator() = default;
+	explicit StarAllocator(const HugePages mode) : mode_(mode) {}
+
+	template<typename Other>
+	StarAllocator(const StarAllocator<Other>& other) : mode_(other.mode()) {}
+
+
+	HugePages mode() const { return mode_; }
+
+	Type* allocate(const size_t count)
+	{
+		const size_t bytes = count * sizeof(Type);
+		const HugePages mode = huge_pages_for(bytes, mode_);
+		if (mode == HugePages::none)
+			return static_cast<Type*>(::operator new(bytes));
+
+		void* data = map_huge_pages(bytes, mode);
+		if (!data)
+			throw std::bad_alloc();
+		return static_cast<Type*>(data);
+	}
+
+	// only resize_uninitialized constructs from Uninitialized and leaves the element as the allocation made it.
+	// every other construction is the usual one
+	template<typename Other>
+	void construct(Other*, Uninitialized)
+	{
+		static_assert(std::is_trivially_copyable_v<Other>);
+	}
+
+	void deallocate(Type* data, const size_t count)
+	{
+		const size_t bytes = count * sizeof(Type);
+		const HugePages mode = huge_pages_for(bytes, mode_);
+		if (mode == HugePages::none)
+			::operator delete(data);
+		else
+			unmap_huge_pages(data, bytes, mode);
+	}
+
+	template<typename Other>
+	bool operator==(const StarAllocator<Other>& other) const { return mode_ == other.mode(); }
+};
+
+template<typename Type>
+using StarArray = std::vector<Type, StarAllocator<Type>>;
+
+
+// grows values to count elements without writing the new ones, so whoever touches them first places their pages.
+// the caller writes every new element before reading it. shrinking is a plain resize
+template<typename Type>
+void resize_uninitialized(StarArray<Type>& values, const size_t count)
+{
+	static_assert(std::is_trivially_copyable_v<Type>, "only the trivially copyable star types are left unwritten");
+	if (count <= values.size())
+		values.resize(count);
+	else
+		values.insert(values.end(), UninitializedElements{ values.size() }, UninitializedElements{ count });
+}
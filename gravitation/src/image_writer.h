@@ -0,0 +1,182 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// encodes and writes RGBA frames on its own threads so the simulation only pays for handing a buffer over.
+// buffers are recycled, and at most max_pending frames are in flight: acquire waits beyond that, which bounds
+// memory at very large resolutions. the file extension picks the format: .ppm is raw RGB behind a one line
+// header (what ffmpeg and most tools read as "raw"), anything else goes through sf::Image (png, bmp, tga, jpg)
+class ImageWriter
+{
+	struct Job
+	{
+		std::vector<sf::Uint8> rgba;
+		unsigned width;
+		unsigned height;
+		std::string path;
+	};
+
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable work_;
+	std::condition_variable done_;
+
+	std::deque<Job> queue_;
+	std::vector<std::vector<sf::Uint8>> free_buffers_;
+	size_t max_pending_;
+	size_t pending_ = 0; // acquired or queued, not yet written
+	bool stop_ = false;
+
+	size_t written_ = 0;
+	size_t failed_ = 0;
+	double wait_ms_ = 0; // time callers spent waiting for a free buffer
+
+public:
+	ImageWriter(const unsigned threads, const size_t max_pending)
+		: max_pending_(std::max<size_t>(1, max_pending))
+	{
+		for (unsigned t = 0; t < std::max(1u, threads); ++t)
+			threads_.emplace_back([this]() { work(); });
+	}
+
+	~ImageWriter()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			stop_ = true;
+		}
+		work_.notify_all();
+		for (std::thread& thread : threads_)
+			thread.join();
+	}
+
+	ImageWriter(const ImageWriter&) = delete;
+	ImageWriter& operator=(const ImageWriter&) = delete;
+
+
+	// a buffer of at least bytes for the next frame, its contents are unspecified
+	std::vector<sf::Uint8> acquire(const size_t bytes)
+	{
+		std::unique_lock lock(mutex_);
+		if (pending_ >= max_pending_)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			done_.wait(lock, [this]() { return pending_ < max_pending_; });
+			wait_ms_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		++pending_;
+
+		std::vector<sf::Uint8> buffer;
+		if (!free_buffers_.empty())
+		{
+			buffer = std::move(free_buffers_.back());
+			free_buffers_.pop_back();
+		}
+		lock.unlock();
+
+		buffer.resize(bytes);
+		return buffer;
+	}
+
+
+	void submit(std::vector<sf::Uint8> rgba, const unsigned width, const unsigned height, std::string path)
+	{
+		{
+			std::lock_guard lock(mutex_);
+			queue_.push_back({ std::move(rgba), width, height, std::move(path) });
+		}
+		work_.notify_one();
+	}
+
+
+	// blocks until every submitted frame is on disk
+	void finish()
+	{
+		std::unique_lock lock(mutex_);
+		done_.wait(lock, [this]() { return pending_ == 0; });
+	}
+
+
+	size_t written() const { return written_; }
+	size_t failed() const { return failed_; }
+	double wait_ms() const { return wait_ms_; }
+
+private:
+	void work()
+	{
+		while (true)
+		{
+			std::unique_lock lock(mutex_);
+			work_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+			if (queue_.empty())
+				return;
+
+			Job job = std::move(queue_.front());
+			queue_.pop_front();
+			lock.unlock();
+
+			const bool ok = encode(job);
+			if (!ok)
+				std::cerr << "image writer: could not write " << job.path << "\n";
+
+			lock.lock();
+			++(ok ? written_ : failed_);
+			free_buffers_.push_back(std::move(job.rgba));
+			--pending_;
+			lock.unlock();
+			done_.notify_all();
+		}
+	}
+
+	static bool encode(const Job& job)
+	{
+		const std::filesystem::path path(job.path);
+		if (path.has_parent_path())
+		{
+			std::error_code error;
+			std::filesystem::create_directories(path.parent_path(), error);
+		}
+
+		if (path.extension() != ".ppm")
+		{
+			sf::Image image;
+			image.create(job.width, job.height, job.rgba.data());
+			return image.saveToFile(job.path);
+		}
+
+		std::FILE* file = std::fopen(job.path.c_str(), "wb");
+		if (!file)
+			return false;
+
+		std::fprintf(file, "P6\n%u %u\n255\n", job.width, job.height);
+
+		// drop the alpha channel a row at a time
+		std::vector<sf::Uint8> row(static_cast<size_t>(job.width) * 3);
+		bool ok = true;
+		for (unsigned y = 0; y < job.height && ok; ++y)
+		{
+			const sf::Uint8* source = &job.rgba[static_cast<size_t>(y) * job.width * 4];
+			for (unsigned x = 0; x < job.width; ++x)
+			{
+				row[x * 3 + 0] = source[x * 4 + 0];
+				row[x * 3 + 1] = source[x * 4 + 1];
+				row[x * 3 + 2] = source[x * 4 + 2];
+			}
+			ok = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+		}
+
+		return std::fclose(file) == 0 && ok;
+	}
+};
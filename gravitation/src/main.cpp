@@ -1,5 +1,28 @@
 #include "simulation.h"
 
+#include <cstdlib>
+#include <new>
+
+
+// every heap allocation is counted per thread, for the heap allocation counter and the hot path guard (arena.h)
+void* operator new(const std::size_t size)
+{
+	++thread_heap_allocations;
+	if (void* data = std::malloc(size > 0 ? size : 1))
+		return data;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* data) noexcept
+{
+	std::free(data);
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+	std::free(data);
+}
+
 
 // TODO
 // - Research on one body gravity simulators
@@ -8,9 +31,12 @@
 // - smoother frame rate & fps
 // - real-time passed statistic
 // - optimize for 3 million stars & 3 black holes
-// - zooming and screen translation
 
-int main()
+int main(int argc, char** argv)
 {
-	Simulation().run();
+	const Config config = Config::from_command_line(argc, argv);
+	if (config.shard_worker > 0)
+		return ShardWorker(config).run();
+
+	Simulation(config).run();
 }
\ No newline at end of file
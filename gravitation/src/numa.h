@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// the NUMA nodes of this machine and the CPUs of each that this process may run on. a machine (or an OS) without
+// NUMA information is one node with every CPU
+struct NumaTopology
+{
+	std::vector<std::vector<int>> nodes;
+
+	static NumaTopology detect()
+	{
+		NumaTopology topology;
+#ifdef _WIN32
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest))
+		{
+			for (UCHAR node = 0; node <= highest; ++node)
+			{
+				ULONGLONG mask = 0;
+				if (!GetNumaNodeProcessorMask(node, &mask) || mask == 0)
+					continue;
+				std::vector<int> cpus;
+				for (int cpu = 0; cpu < 64; ++cpu)
+					if (mask & (1ull << cpu))
+						cpus.push_back(cpu);
+				topology.nodes.push_back(std::move(cpus));
+			}
+		}
+#else
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		const bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+		for (int node = 0; ; ++node)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			if (!file)
+				break;
+
+			std::string list;
+			std::getline(file, list);
+			std::vector<int> cpus;
+			for (const auto& [first, last] : parse_ranges(list))
+				for (int cpu = first; cpu <= last; ++cpu)
+					if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+						cpus.push_back(cpu);
+			if (!cpus.empty())
+				topology.nodes.push_back(std::move(cpus));
+		}
+#endif
+		if (topology.nodes.empty())
+		{
+			topology.nodes.emplace_back();
+			for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); ++cpu)
+				topology.nodes.back().push_back(cpu);
+		}
+		return topology;
+	}
+
+
+	int node_of_cpu(const int cpu) const
+	{
+		for (size_t node = 0; node < nodes.size(); ++node)
+			if (std::find(nodes[node].begin(), nodes[node].end(), cpu) != nodes[node].end())
+				return static_cast<int>(node);
+		return -1;
+	}
+
+private:
+	// "0-3,8-11" -> { 0, 3 }, { 8, 11 }
+	static std::vector<std::pair<int, int>> parse_ranges(const std::string& list)
+	{
+		std::vector<std::pair<int, int>> ranges;
+		std::istringstream stream(list);
+		std::string range;
+		while (std::getline(stream, range, ','))
+		{
+			const size_t dash = range.find('-');
+			try
+			{
+				const int first = std::stoi(range.substr(0, dash));
+				ranges.emplace_back(first, dash == std::string::npos ? first : std::stoi(range.substr(dash + 1)));
+			}
+			catch (const std::exception&) {}
+		}
+		return ranges;
+	}
+};
+
+
+// the CPU of every pool thread for an affinity policy, empty when the threads are left to the scheduler.
+// "compact" fills one node before the next, "scatter" deals the threads round robin over the nodes
+inline std::vector<int> thread_cpus(const NumaTopology& topology, const std::string& policy, const unsigned threads)
+{
+	std::vector<int> cpus;
+	if (policy == "compact")
+	{
+		std::vector<int> all;
+		for (const std::vector<int>& node : topology.nodes)
+			all.insert(all.end(), node.begin(), node.end());
+		for (unsigned t = 0; t < threads; ++t)
+			cpus.push_back(all[t % all.size()]);
+	}
+	else if (policy == "scatter")
+	{
+		std::vector<size_t> next(topology.nodes.size(), 0);
+		for (unsigned t = 0; t < threads; ++t)
+		{
+			const size_t node = t % topology.nodes.size();
+			cpus.push_back(topology.nodes[node][next[node]++ % topology.nodes[node].size()]);
+		}
+	}
+	return cpus;
+}
+
+
+inline bool pin_current_thread(const int cpu)
+{
+#ifdef _WIN32
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+
+inline size_t page_size()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+
+// the node that holds the page of address, -1 when it is not resident or the OS does not say
+inline int page_node(const void* address)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+	void* page = reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(address) & ~(page_size() - 1));
+	int status = -1;
+	if (syscall(SYS_move_pages, 0, 1ul, &page, nullptr, &status, 0) != 0)
+		return -1;
+	return status;
+#else
+	(void)address;
+	return -1;
+#endif
+}
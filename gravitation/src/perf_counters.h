@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "threading.h"
+
+
+// dTLB load misses of every pool thread, counted in user space through perf_event_open. one counter per thread,
+// opened on that thread, so the pool has to stay the same while it counts. without a PMU the kernel lets this
+// process use (other systems, most VMs, perf_event_paranoid) the counter is unavailable and reads 0
+class TlbMissCounter
+{
+	std::vector<int> fds_;
+
+public:
+	explicit TlbMissCounter(ThreadPool& pool) : fds_(pool.size(), -1)
+	{
+#ifdef __linux__
+		pool.run([this](const unsigned t)
+		{
+			perf_event_attr attr{};
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fds_[t] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		});
+		for (const int fd : fds_)
+			if (fd < 0)
+				close_all();
+#endif
+	}
+
+	~TlbMissCounter()
+	{
+		close_all();
+	}
+
+	TlbMissCounter(const TlbMissCounter&) = delete;
+	TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+
+	bool available() const { return !fds_.empty() && fds_.front() >= 0; }
+
+	void start()
+	{
+#ifdef __linux__
+		for (const int fd : fds_)
+		{
+			if (fd < 0)
+				continue;
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	// the misses of all threads since start
+	std::uint64_t stop()
+	{
+		std::uint64_t total = 0;
+#ifdef __linux__
+		for (const int fd : fds_)
+		{
+			std::uint64_t misses = 0;
+			if (fd < 0)
+				continue;
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &misses, sizeof(misses)) == sizeof(misses))
+				total += misses;
+		}
+#endif
+		return total;
+	}
+
+private:
+	void close_all()
+	{
+		for (int& fd : fds_)
+		{
+#ifdef __linux__
+			if (fd >= 0)
+				close(fd);
+#endif
+			fd = -1;
+		}
+	}
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "black_holes.h"
+#include "huge_pages.h"
+#include "star_kernel.h"
+#include "toroidal_space.h"
+
+
+// scalar policies for the star state and its kernel. float is what the rest of the simulation runs on and
+// loses sub-unit precision towards the far edge of the world, double keeps it everywhere at twice the memory,
+// mixed stores float offsets from the origin of a coarse cell and sums the forces in double
+struct SinglePrecision
+{
+	using Storage = float;
+	using Accumulator = float;
+	static constexpr bool cell_relative = false;
+	static constexpr const char* name = "float";
+};
+
+struct DoublePrecision
+{
+	using Storage = double;
+	using Accumulator = double;
+	static constexpr bool cell_relative = false;
+	static constexpr const char* name = "double";
+};
+
+struct MixedPrecision
+{
+	using Storage = float;
+	using Accumulator = double;
+	static constexpr bool cell_relative = true;
+	static constexpr const char* name = "mixed";
+};
+
+
+struct StarCell
+{
+	std::uint16_t x;
+	std::uint16_t y;
+};
+
+
+// structure of arrays like BlackHoles. with a cell relative precision a position is the origin of cells[i]
+// plus positions[i], everywhere else positions[i] is the world position
+template<typename Precision>
+struct StarState
+{
+	using Storage = typename Precision::Storage;
+	using Accumulator = typename Precision::Accumulator;
+
+	std::vector<sf::Vector2<Storage>> positions;
+	std::vector<sf::Vector2<Storage>> velocities;
+	std::vector<StarCell> cells;
+
+	sf::Rect<Accumulator> bounds;
+	sf::Vector2<Accumulator> cell_size{};
+	sf::Vector2u cell_count{ 1, 1 };
+
+
+	// cells are stretched slightly so a whole number of them tiles the world
+	StarState(const StarArray<sf::Vector2f>& star_positions, const StarArray<sf::Vector2f>& star_velocities,
+		const sf::FloatRect& world, const float cell_extent)
+		: positions(star_positions.size()), velocities(star_velocities.size()), bounds(world)
+	{
+		if constexpr (Precision::cell_relative)
+		{
+			cell_count.x = std::clamp(static_cast<unsigned>(std::ceil(world.width / cell_extent)), 1u, 65'535u);
+			cell_count.y = std::clamp(static_cast<unsigned>(std::ceil(world.height / cell_extent)), 1u, 65'535u);
+			cell_size = { bounds.width / cell_count.x, bounds.height / cell_count.y };
+			cells.resize(star_positions.size());
+		}
+
+		for (size_t i = 0; i < star_positions.size(); ++i)
+		{
+			set_position(i, sf::Vector2<Accumulator>(star_positions[i]));
+			velocities[i] = sf::Vector2<Storage>(star_velocities[i]);
+		}
+	}
+
+
+	size_t size() const { return positions.size(); }
+
+	void reserve(const size_t capacity)
+	{
+		positions.reserve(capacity);
+		velocities.reserve(capacity);
+		if constexpr (Precision::cell_relative)
+			cells.reserve(capacity);
+	}
+
+	// new stars start in cell 0 at rest, set_position places them
+	void resize(const size_t count)
+	{
+		positions.resize(count);
+		velocities.resize(count);
+		if constexpr (Precision::cell_relative)
+			cells.resize(count, StarCell{ 0, 0 });
+	}
+
+	size_t bytes_per_star() const
+	{
+		return sizeof(positions[0]) + sizeof(velocities[0]) + (Precision::cell_relative ? sizeof(StarCell) : 0);
+	}
+
+
+	sf::Vector2<Accumulator> position(const size_t i) const
+	{
+		if constexpr (Precision::cell_relative)
+			return cell_origin(cells[i]) + sf::Vector2<Accumulator>(positions[i]);
+		else
+			return sf::Vector2<Accumulator>(positions[i]);
+	}
+
+
+	// wraps the world position into the bounds and, cell relative, picks the cell it is in
+	void set_position(const size_t i, sf::Vector2<Accumulator> world)
+	{
+		world.x = bounds.left + wrap(world.x - bounds.left, bounds.width);
+		world.y = bounds.top + wrap(world.y - bounds.top, bounds.height);
+
+		if constexpr (Precision::cell_relative)
+		{
+			StarCell& cell = cells[i];
+			cell.x = static_cast<std::uint16_t>(std::min(static_cast<unsigned>((world.x - bounds.left) / cell_size.x), cell_count.x - 1));
+			cell.y = static_cast<std::uint16_t>(std::min(static_cast<unsigned>((world.y - bounds.top) / cell_size.y), cell_count.y - 1));
+			positions[i] = sf::Vector2<Storage>(world - cell_origin(cell));
+		}
+		else
+			positions[i] = sf::Vector2<Storage>(world);
+	}
+
+
+	// true once a cell relative offset has left its cell
+	bool left_cell(const size_t i) const
+	{
+		const sf::Vector2<Storage>& offset = positions[i];
+		return offset.x < 0 || offset.y < 0 || offset.x >= cell_size.x || offset.y >= cell_size.y;
+	}
+
+private:
+	sf::Vector2<Accumulator> cell_origin(const StarCell cell) const
+	{
+		return { bounds.left + cell.x * cell_size.x, bounds.top + cell.y * cell_size.y };
+	}
+
+	static Accumulator wrap(const Accumulator value, const Accumulator extent)
+	{
+		const Accumulator wrapped = std::fmod(value, extent);
+		return wrapped < 0 ? wrapped + extent : wrapped;
+	}
+};
+
+
+// the direct sum over every black hole with the kernel's force law, evaluated and integrated in the precision's
+// accumulator type. temporal LOD, host drift, the tree and the acceleration field are float only. mirror gets
+// the new float positions for the grid and the renderers
+template<typename Precision, unsigned Features>
+size_t update_star_state(StarState<Precision>& stars, sf::Vector2f* mirror, const size_t begin, const size_t end, const StarKernelParams& params)
+{
+	using Storage = typename Precision::Storage;
+	using Accumulator = typename Precision::Accumulator;
+
+	constexpr bool limit_speed = Features & feature_speed_limit;
+	constexpr bool damp = Features & feature_damping;
+	constexpr bool capture = Features & feature_capture;
+	constexpr Accumulator split = Features & feature_midstep_kick ? Accumulator(0.5) : Accumulator(0);
+
+	const BlackHoles& black_holes = *params.black_holes;
+	const sf::Rect<Accumulator> bounds(params.bounds);
+	const sf::Rect<Storage> storage_bounds(params.bounds);
+	const Accumulator dt = params.dt;
+	const Accumulator pull_scale = static_cast<Accumulator>(params.G) * params.star_mass;
+	const Accumulator capture_radius_sq = params.capture_radius_sq;
+	sf::Vector2f* const render_positions = params.render_positions;
+
+	size_t absorbed = 0;
+	for (size_t i = begin; i < end; ++i)
+	{
+		sf::Vector2<Accumulator> vel(stars.velocities[i]);
+		const sf::Vector2<Accumulator> position = stars.position(i) + vel * (dt * split); // where the kick is evaluated
+
+		sf::Vector2<Accumulator> acceleration{};
+		unsigned captures = 0;
+		for (size_t b = 0; b < black_holes.size(); ++b)
+		{
+			const sf::Vector2<Accumulator> direction = toroidal_direction(position, sf::Vector2<Accumulator>(black_holes.position(b)), bounds);
+			Accumulator distance_sq = direction.x * direction.x + direction.y * direction.y;
+
+			if constexpr (capture)
+			{
+				if (distance_sq < capture_radius_sq)
+				{
+					++captures;
+					continue;
+				}
+			}
+			else
+				distance_sq = std::max(distance_sq, capture_radius_sq);
+
+			acceleration += direction * (pull_scale * black_holes.mass[b] / distance_sq);
+		}
+
+		const sf::Vector2<Accumulator> drift_before = vel * (dt * split);
+		absorbed += capture_star(vel, captures, i, params);
+		vel += acceleration * dt;
+
+		if constexpr (limit_speed)
+			speed_limit(vel, static_cast<Accumulator>(params.max_speed));
+
+		// both halves of the drift in one addition
+		const sf::Vector2<Accumulator> step = drift_before + vel * (dt * (1 - split));
+		if constexpr (Precision::cell_relative)
+		{
+			// the step goes onto the small offset, which keeps its precision anywhere in the world
+			stars.positions[i] += sf::Vector2<Storage>(step);
+			if (stars.left_cell(i))
+				stars.set_position(i, stars.position(i));
+		}
+		else
+		{
+			border(stars.positions[i], storage_bounds);
+			stars.positions[i] += sf::Vector2<Storage>(step);
+		}
+
+		const sf::Vector2f moved(stars.position(i));
+		mirror[i] = moved;
+		if (render_positions)
+			render_positions[i] = moved;
+
+		if constexpr (damp)
+			vel *= static_cast<Accumulator>(params.damping);
+		stars.velocities[i] = sf::Vector2<Storage>(vel);
+	}
+	add_absorbed(absorbed, params.absorbed_count);
+	return end - begin;
+}
+
+
+template<typename Precision>
+using PreciseStarKernel = size_t(*)(StarState<Precision>&, sf::Vector2f*, size_t, size_t, const StarKernelParams&);
+
+namespace detail
+{
+	template<typename Precision, unsigned... Features>
+	constexpr std::array<PreciseStarKernel<Precision>, feature_count> make_precise_table(std::integer_sequence<unsigned, Features...>)
+	{
+		return { &update_star_state<Precision, Features & (feature_speed_limit | feature_damping | feature_capture | feature_midstep_kick)>... };
+	}
+
+	template<typename Precision>
+	inline constexpr auto precise_star_kernels = make_precise_table<Precision>(std::make_integer_sequence<unsigned, feature_count>{});
+}
+
+
+template<typename Precision>
+PreciseStarKernel<Precision> select_precise_star_kernel(const unsigned features)
+{
+	return detail::precise_star_kernels<Precision>[features];
+}
+
+
+// energy per unit mass of a star while the black holes stand still, for the kernel without capture, damping and
+// the speed limit: the pull pull_scale * M * d / r^2 derives from pull_scale * M * ln r, softened to a harmonic
+// well inside the capture radius
+inline double star_energy(const sf::Vector2<double> position, const sf::Vector2<double> velocity, const BlackHoles& black_holes,
+	const sf::Rect<double>& bounds, const double pull_scale, const double capture_radius_sq)
+{
+	double potential = 0;
+	for (size_t b = 0; b < black_holes.size(); ++b)
+	{
+		const sf::Vector2<double> direction = toroidal_direction(position, sf::Vector2<double>(black_holes.position(b)), bounds);
+		const double distance_sq = direction.x * direction.x + direction.y * direction.y;
+		const double well = distance_sq < capture_radius_sq
+			? 0.5 * (distance_sq / capture_radius_sq + std::log(capture_radius_sq) - 1.0)
+			: 0.5 * std::log(distance_sq);
+		potential += pull_scale * black_holes.mass[b] * well;
+	}
+	return 0.5 * (velocity.x * velocity.x + velocity.y * velocity.y) + potential;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <SFML/System/Clock.hpp>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// lightweight per-frame section timer, used from the main thread only.
+// sections are identified by their (string literal) name and listed in first-recorded order
+class Profiler
+{
+	struct Section
+	{
+		const char* name;
+		float last_ms = 0.f;
+		float average_ms = 0.f; // exponential moving average, smooths the title bar readout
+	};
+
+	struct Counter
+	{
+		const char* name;
+		float value = 0.f;
+		const char* unit = "";
+	};
+
+	std::vector<Section> sections_;
+	std::vector<Counter> counters_; // values that are not timings, shown after the sections
+
+public:
+	class ScopedTimer
+	{
+		Profiler& profiler_;
+		const char* name_;
+		sf::Clock clock_{};
+
+	public:
+		ScopedTimer(Profiler& profiler, const char* name) : profiler_(profiler), name_(name) {}
+		~ScopedTimer() { profiler_.record(name_, clock_.getElapsedTime().asMicroseconds() / 1000.f); }
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+	};
+
+	ScopedTimer time(const char* name) { return { *this, name }; }
+
+	void record(const char* name, const float ms)
+	{
+		Section& section = find(name);
+		section.last_ms = ms;
+		section.average_ms += (ms - section.average_ms) * 0.05f;
+	}
+
+	float average_ms(const char* name) { return find(name).average_ms; }
+
+	void set_counter(const char* name, const float value, const char* unit = "")
+	{
+		for (Counter& counter : counters_)
+		{
+			if (counter.name == name || std::string_view(counter.name) == name)
+			{
+				counter.value = value;
+				counter.unit = unit;
+				return;
+			}
+		}
+		counters_.push_back({ name, value, unit });
+	}
+
+	std::string summary() const
+	{
+		std::string out;
+		append_summary(out);
+		return out;
+	}
+
+	// the same appended to any string type, so the title can be built in frame memory
+	template<typename String>
+	void append_summary(String& out) const
+	{
+		for (const Section& section : sections_)
+		{
+			out.append(" | ").append(section.name).append(" ");
+			append_fixed(out, section.average_ms);
+			out.append("ms");
+		}
+
+		for (const Counter& counter : counters_)
+		{
+			out.append(" | ").append(counter.name).append(" ");
+			append_fixed(out, counter.value);
+			out.append(counter.unit);
+		}
+	}
+
+	// two decimals
+	template<typename String>
+	static void append_fixed(String& out, const float value)
+	{
+		char digits[32];
+		const auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 2);
+		out.append(digits, result.ptr);
+	}
+
+private:
+	Section& find(const char* name)
+	{
+		for (Section& section : sections_)
+			if (section.name == name || std::string_view(section.name) == name)
+				return section;
+
+		sections_.push_back({ name });
+		return sections_.back();
+	}
+};
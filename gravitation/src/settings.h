@@ -2,6 +2,8 @@
 
 #include <SFML/Graphics.hpp>
 
+// compile-time settings. the values that can change per run are only defaults for Config (config.h),
+// everything else is fixed per build so the kernels can treat it as a constant
 struct SFMLSettings
 {
 	inline static constexpr unsigned int screen_width = 1920;
@@ -9,10 +11,6 @@ struct SFMLSettings
 
 	inline static constexpr float simulation_scale = 0.002f;
 
-	inline static constexpr auto border_width = screen_width / simulation_scale;
-	inline static constexpr auto border_height = screen_height / simulation_scale;
-	inline static sf::FloatRect bounds = { 0, 0, border_width, border_height };
-
 	inline static const std::string title = "Galaxy Simulation";
 	inline static constexpr bool v_sync = false;
 	inline static constexpr unsigned max_fps = 1050u;
@@ -26,28 +24,179 @@ struct SimulationSettings
 
 	inline static constexpr float star_spawn_radius = 40'000.f;
 
-	inline static constexpr unsigned number_of_black_holes = 2u;
+	// dark matter halo style setups with thousands of attractors instead of a pair of galaxies
+	inline static constexpr bool many_black_holes = false;
+	inline static constexpr unsigned number_of_black_holes = many_black_holes ? 4'096u : 2u;
 	inline static constexpr unsigned number_of_stars = 600'000u;
+	// star pool: room for star_capacity stars (at least number_of_stars) is reserved at startup, star_inflow new
+	// stars per step form around random black holes until it is full, accreted stars free their slots
+	inline static constexpr unsigned star_capacity = 0u;
+	inline static constexpr float star_inflow = 0.f;
+	// huge pages for the star arrays: "none", "transparent" (madvise), "2m" or "1g" (the reserved hugetlb pool,
+	// transparent when it is empty). the star loop then takes far fewer dTLB misses from 3M stars up
+	inline static const std::string huge_pages = "none";
+	inline static constexpr bool benchmark_huge_pages = false;
+
+	// 3D mode (dimensions = 3): disks with vertical structure in a periodic box of world_depth, shown through a
+	// tilted projection (Page Up / Page Down). the tree, the acceleration field, temporal LOD, host drift and
+	// star_precision are 2D only, 3D always takes the direct sum
+	inline static constexpr unsigned dimensions = 2u;
+	inline static constexpr float world_depth = 200'000.f;
+	inline static constexpr float disk_thickness = 2'000.f; // standard deviation of the stars' starting height
 
 
 	// Physics settings
-	inline static float G = 20000;
+	inline static constexpr float G = 20000;
 	inline static constexpr float cosmic_speed_limit = 100'000.f;
 	inline static constexpr float dt = 1.5f;
 
+	// adaptive timestep: the step follows the shortest timescale of the black hole pairs, dt is the first step.
+	// per-step factors (damping) are scaled to the step length, the capture boosts are not. distributed runs keep
+	// it fixed
+	inline static constexpr bool adaptive_dt = false;
+	inline static constexpr float dt_eta = 0.15f;     // step as a fraction of the shortest black hole pair or star orbit timescale
+	inline static constexpr float dt_min = 0.05f;
+	inline static constexpr float dt_max = 6.f;
+	inline static constexpr float max_dt_change = 1.25f; // largest growth or shrink factor from one step to the next
+	inline static constexpr bool benchmark_timestep = false;
+	inline static constexpr unsigned timestep_reference_divisions = 8u; // --benchmark_timestep=true: reference step dt / this
+
+	// Hermite black holes: 4th order, in double, substepped within every star step where close passes need it.
+	// up to black_hole_tree_threshold black holes, the tree keeps the Euler update
+	inline static constexpr bool hermite_black_holes = false;
+	inline static constexpr float black_hole_eta = 0.01f;          // accuracy of the Aarseth substep criterion
+	inline static constexpr float black_hole_softening = 300.f;    // Plummer softening of the black hole pulls
+	inline static constexpr unsigned max_black_hole_substeps = 256u;
+	inline static constexpr bool benchmark_black_holes = false;
+	inline static constexpr float black_hole_benchmark_time = 12'000.f; // --benchmark_black_holes=true: simulated time per run
+
 	inline static constexpr float star_mass = 1;
 	inline static constexpr float bh_mass   = 1;
 
+	// star kernel features, each can be toggled at runtime (L, R, C) and selects its own kernel instantiation
+	inline static constexpr bool speed_limit_stars = true;
+	inline static constexpr bool damp_stars = true;
+	inline static constexpr float damping = 0.9999f;
+	inline static constexpr bool capture_stars = true;
+
+	// accretion (X toggles, needs capture_stars): a captured star is removed and its mass and momentum go to the
+	// nearest black hole instead of the star being flung out
+	inline static constexpr bool accretion = false;
+	inline static constexpr float accreted_mass = 1e-5f; // black hole mass gained per absorbed star
+
+	// temporal level of detail (T toggles): weak-field stars reuse their acceleration for up to lod_interval steps
+	inline static constexpr bool temporal_lod = false;
+	inline static constexpr unsigned lod_interval = 4u;
+	inline static constexpr float lod_error = 0.05f;           // bound on the relative drift of a reused acceleration
+	inline static constexpr bool validate_lod = false;
+	inline static constexpr unsigned validation_steps = 200u;  // --validate_lod=true compares this many steps against the full update
+
+	// host drift (K toggles, up to black_hole_tree_threshold black holes): stars bound to one black hole feel its
+	// exact pull every step and a cached pull of the others, refreshed every host_drift_refresh steps
+	inline static constexpr bool host_drift = false;
+	inline static constexpr float host_drift_threshold = 0.2f; // largest |other pulls| / |host pull| of a bound star
+	inline static constexpr unsigned host_drift_refresh = 8u;
+
+	// star state precision: "float", "double" or "mixed" (float offsets from the origin of a precision_cell_size
+	// cell, double forces). double and mixed always take the direct sum, without temporal LOD, host drift, the tree
+	// or the acceleration field
+	inline static const std::string star_precision = "float";
+	inline static constexpr float precision_cell_size = 4'096.f;
+	inline static constexpr bool benchmark_precision = false;
+	inline static constexpr unsigned precision_steps = 2'000u; // --benchmark_precision=true: steps per variant
+
+	// star shards (shard_workers > 0): that many worker processes update the stars, the window process moves the
+	// black holes and shares them through the named shared memory segment. 2D float only, star count fixed
+	inline static constexpr unsigned shard_workers = 0u;
+	inline static const std::string shard_name = "/gravitation_shards";
+	inline static constexpr float shard_timeout = 10.f; // seconds a step may take before the workers are given up
+
+	// distributed run (domains > 1): that many processes each own a slab of the world and exchange migrating and
+	// halo stars over the transport at domain_address, for domain_steps steps, then rank 0 reports and all exit
+	inline static constexpr unsigned domains = 0u;
+	inline static const std::string domain_address = "tcp:127.0.0.1:47000"; // or unix:/tmp/gravitation
+	inline static constexpr unsigned domain_steps = 300u;
+	inline static constexpr float domain_timeout = 20.f; // seconds to connect, and for every exchange, before a rank gives up
+	inline static constexpr float halo_width = 5'000.f; // ghost stars are sent this far across a cut
+
 
 	// Multi-threading settings
 	inline static constexpr unsigned threads = 8u;
-	inline static constexpr unsigned threading_batches = number_of_stars / threads;
+	inline static constexpr unsigned chunks_per_thread = 16u; // starting point for the chunk size tuner
+	inline static constexpr unsigned min_star_chunk = 256u;
+	inline static constexpr unsigned stats_interval = 60u;   // frames between worker idle readouts
+	// frame scratch memory: bump arenas reset at the end of every frame, they grow to the busiest frame's needs
+	inline static constexpr size_t frame_arena_size = 1u << 20;
+	inline static constexpr size_t scratch_arena_size = 256u << 10; // per pool thread
+	inline static constexpr unsigned heap_guard_frames = 8u; // debug builds: the first allocating frame logs, this many in a row assert
+	// "none" leaves the threads to the scheduler, "compact" pins them to the cpus of one NUMA node before the next,
+	// "scatter" round robin over the nodes. pinned threads always update the same slice of stars, whose pages
+	// they touched first
+	inline static const std::string thread_affinity = "none";
+	inline static constexpr bool benchmark_numa = false; // --benchmark_numa=true: main thread against worker first touch
+
+	// config file hot reload
+	inline static constexpr float config_poll_interval = 0.5f; // seconds
+
+
+	// Black hole tree settings, above the threshold star-BH and BH-BH forces go through a Barnes-Hut tree
+	inline static constexpr unsigned black_hole_tree_threshold = 32u;
+	inline static constexpr float black_hole_tree_theta = 0.5f; // must stay below 1/sqrt(2) so a node is never applied to a body inside it
+	inline static constexpr unsigned black_hole_leaf_size = 4u;
+	static_assert(black_hole_tree_theta < 0.7071f);
+
+	// Acceleration field (A toggles): black hole pulls precomputed on a periodic grid, exact within the cutoff
+	inline static constexpr bool acceleration_field = false;
+	inline static constexpr float field_spacing = 4'000.f;    // node distance, keep well below the cutoff
+	inline static constexpr float field_cutoff = 20'000.f;    // black holes closer than this are corrected exactly
+	inline static constexpr float field_tolerance = 2'000.f;  // black hole movement that triggers a rebuild
+	inline static constexpr bool field_bicubic = false;
+	inline static constexpr bool benchmark_field = false;
+	inline static constexpr unsigned benchmark_steps = 5u;     // --benchmark_field=true: star steps timed per method
+
+
+	// Spatial index settings
+	inline static constexpr bool build_star_grid = true;
+	inline static constexpr float grid_cell_size = 2'000.f;
+	inline static constexpr float pick_radius = 5'000.f; // local density is measured within this radius of a clicked point
+
+
+	// Camera settings (wheel zoom, right drag / arrows pan, Home resets)
+	inline static constexpr float max_zoom = 1'000.f;
+	inline static constexpr float zoom_step = 1.2f;         // per wheel notch
+	inline static constexpr float tilt_step = 0.0872665f;   // 5 degrees per Page Up / Page Down, 3D only
+	// stars drawn per screen pixel before the visible set is thinned out, needs build_star_grid
+	inline static constexpr float lod_stars_per_pixel = 1.f;
 
 
 	// Graphical Settings
+	// 0 vertex array, 1 sf::VertexBuffer, 2 streamed GL buffer, 3 persistently mapped GL buffer (V cycles at runtime)
+	inline static constexpr unsigned star_render_path = 3u;
+	// CPU density splatting with asinh tone mapping instead of GL points (H toggles at runtime)
+	inline static constexpr bool density_render = false;
+	inline static constexpr float density_softening = 3.f; // stars per pixel where the tone curve turns logarithmic
 	inline static constexpr int sf = 10;
 	inline static const sf::Color star_color = { 8 * sf, 2 * sf, 4 * sf };
 
 	inline static const sf::Color black_hole_color = { 255, 20, 255 };
 	inline static constexpr float black_hole_radius = 600.f;
+
+
+	// Headless rendering (--headless=true), images are written on their own threads
+	inline static constexpr bool headless = false;
+	inline static constexpr bool headless_gl = false;        // offscreen render texture instead of the CPU splatter
+	inline static constexpr unsigned headless_steps = 600u;
+	inline static constexpr unsigned frame_interval = 1u;    // simulation steps per written image
+	inline static constexpr unsigned image_width = 3'840u;
+	inline static constexpr unsigned image_height = 2'160u;
+	inline static constexpr unsigned headless_tile_size = 2'048u; // splat histograms are threads * tile^2 floats
+	inline static constexpr unsigned image_writer_threads = 2u;
+	inline static constexpr unsigned max_pending_images = 3u;  // frames held in memory while they are encoded
+	inline static const std::string image_output = "frames/galaxy.png"; // .png / .bmp / .tga / .jpg, or .ppm for raw RGB
+
+
+	// Window capture (F9 starts / stops), streamed as y4m or raw rgb24 to a file or to stdout ("-")
+	inline static const std::string capture = "";            // recording starts right away when this is set
+	inline static constexpr unsigned capture_fps = 60u;       // only written into the y4m header
+	inline static constexpr unsigned capture_slots = 8u;      // frames buffered for the writer before they are dropped
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// a named shared memory segment mapped into this process. the creating process sizes it and removes the name
+// when it goes, the others open it by name and must know its size. names start with a slash (POSIX shm_open),
+// on Windows the slash is dropped and the segment lives in the session's Local namespace
+class SharedMemory
+{
+	std::string name_;
+	std::byte* data_ = nullptr;
+	size_t size_ = 0;
+	bool owner_ = false;
+#ifdef _WIN32
+	HANDLE mapping_ = nullptr;
+#endif
+
+public:
+	SharedMemory(std::string name, const size_t size, const bool create)
+		: name_(std::move(name)), size_(size), owner_(create)
+	{
+#ifdef _WIN32
+		const std::string local = "Local\\" + (name_.starts_with('/') ? name_.substr(1) : name_);
+		mapping_ = create
+			? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32),
+				static_cast<DWORD>(size & 0xffffffffu), local.c_str())
+			: OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, local.c_str());
+		if (mapping_)
+			data_ = static_cast<std::byte*>(MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+		if (create)
+			shm_unlink(name_.c_str()); // left behind by a coordinator that crashed
+
+		const int fd = shm_open(name_.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+		if (fd >= 0)
+		{
+			struct stat info{};
+			const bool sized = create ? ftruncate(fd, static_cast<off_t>(size)) == 0
+				: fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= size;
+			if (sized)
+			{
+				void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				data_ = mapped == MAP_FAILED ? nullptr : static_cast<std::byte*>(mapped);
+			}
+			close(fd);
+		}
+#endif
+		if (!data_)
+			std::cerr << "shared memory: cannot " << (create ? "create " : "open ") << name_ << "\n";
+	}
+
+	~SharedMemory()
+	{
+#ifdef _WIN32
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (mapping_)
+			CloseHandle(mapping_);
+#else
+		if (data_)
+			munmap(data_, size_);
+		if (owner_)
+			shm_unlink(name_.c_str());
+#endif
+	}
+
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+
+	bool is_open() const { return data_ != nullptr; }
+	std::byte* data() const { return data_; }
+	size_t size() const { return size_; }
+};
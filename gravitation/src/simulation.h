@@ -1,15 +1,38 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
-#include <thread>
 
 #include <string>
 
+#include <optional>
 #include <sstream>
+#include <variant>
 #include "settings.h"
+#include "config.h"
 
 #include "random.h"
 #include "toroidal_space.h"
+#include "spatial_grid.h"
+#include "black_holes.h"
+#include "black_hole_tree.h"
+#include "black_hole_integrator.h"
+#include "threading.h"
+#include "arena.h"
+#include "huge_pages.h"
+#include "perf_counters.h"
+#include "star_kernel.h"
+#include "timestep.h"
+#include "host_drift.h"
+#include "precision.h"
+#include "star_pool.h"
+#include "star_shards.h"
+#include "domains.h"
+#include "star_renderer.h"
+#include "density_renderer.h"
+#include "camera.h"
+#include "headless_renderer.h"
+#include "frame_capture.h"
+#include "profiler.h"
 #include <iostream>
 
 inline sf::Vector2f normalize(const sf::Vector2f vec)
@@ -24,56 +47,158 @@ inline sf::Vector2f perpendicular(const sf::Vector2f vec)
 }
 
 
-struct BlackHole
-{
-	sf::Vector2f position;
-	sf::Vector2f velocity;
-	sf::Vector2f acceleration;
-
-	void update(const float dt)
-	{
-		velocity += acceleration * dt;
-		position += velocity * dt;
-		acceleration = sf::Vector2f(0, 0);
-	}
-};
-
-
 class Simulation : SimulationSettings, SFMLSettings
 {
 private:
+	Config config_;
+	const CoutToStderr cout_to_stderr_{ config_.capture == "-" }; // stdout carries the captured video
+	ConfigWatcher config_watcher_;
+	sf::Clock config_poll_clock_{};
+	const sf::FloatRect bounds_;
+	const bool three_d_;
+	const Box<float> box_;
+	const bool use_black_hole_tree_;
+
+	const NumaTopology numa_;
+	ThreadPool pool_;
+	ChunkTuner star_chunks_;
+	FrameArenas arenas_{ pool_.size(), frame_arena_size, scratch_arena_size };
+
 	bool paused_ = false;
 	bool draw_ = true;
+	bool close_requested_ = false;
 
 	unsigned frames = 0;
+	unsigned stats_frame_ = 0; // frame at which the worker statistics were last taken
 
-	sf::RenderWindow window_{};
+	std::optional<sf::RenderWindow> window_;   // neither the window nor the star renderer exist in headless mode,
+	std::optional<HeadlessRenderer> headless_; // where creating any GL resource without a display would abort
 	sf::Clock clock_{};
+	Camera camera_;
+	std::optional<FrameReadback> readback_; // both only exist while recording, and go before the window
+	std::optional<FrameCapture> capture_;
+	const size_t star_budget_; // most stars drawn per frame, the rest of the visible ones are sampled away
+
+	const HugePages huge_pages_;
+	StarArray<sf::Vector2f> star_positions_;
+	StarArray<sf::Vector2f> star_velocities_;
+	// the authoritative star state when star_precision is double or mixed, star_positions_ then only mirrors it
+	// for the grid and the renderers and star_velocities_ keeps the starting velocities
+	std::variant<std::monostate, StarState<DoublePrecision>, StarState<MixedPrecision>> precise_stars_;
+	StarArray<sf::Vector3f> star_positions_3d_; // the star state in 3D, star_positions_ then holds its projection
+	StarArray<sf::Vector3f> star_velocities_3d_;
+	StarArray<sf::Vector2f> star_accelerations_; // temporal LOD cache, allocated when it is first switched on
+	bool lod_active_ = false;
+	unsigned stagger_phase_ = 0; // step counter that staggers the cache refreshes of temporal LOD and host drift
+	StarArray<unsigned> star_hosts_;             // host drift state, allocated when it is first switched on
+	StarArray<sf::Vector2f> star_perturbations_;
+	bool host_drift_active_ = false;
+	StarPool star_pool_{ pool_, arenas_, std::max<size_t>(config_.number_of_stars, config_.star_capacity) };
+	float inflow_carry_ = 0.f; // fraction of a star owed by star_inflow
+	size_t stars_absorbed_ = 0;
+	size_t stars_formed_ = 0;
+	double force_work_ = 0;      // star - black hole interactions evaluated, and what the full update would have
+	double force_work_full_ = 0; // needed, since the counters were last reset
+	std::optional<ShardCoordinator> shards_; // the stars live in worker processes
+	std::optional<StarRenderer> star_renderer_;
+	std::optional<DensityRenderer> density_renderer_; // created the first time density rendering is switched on
+	bool density_render_ = false;
+	bool written_positions_stale_ = false; // the star pool formed or moved stars after the kernel wrote the persistent region
+
+	BlackHoles black_holes_;
+	BlackHoleTree black_hole_tree_{ bounds_, black_hole_tree_theta, black_hole_leaf_size };
+	HermiteIntegrator hermite_;
+	BlackHoleTrajectory black_hole_trajectory_; // of the current step, with the Hermite black holes
+	BlackHoles black_holes_midstep_;            // sampled from it for the star kick
+	bool kick_at_midstep_ = false;              // this step's stars take the leapfrog against black_holes_midstep_
+	AccelerationField acceleration_field_{ bounds_, field_spacing, field_cutoff, pool_ };
+	sf::CircleShape black_hole_renderer_;
+	sf::VertexArray black_hole_quads_{ sf::Quads }; // circles are one draw call each, too slow for thousands
 
-	sf::VertexArray stars_ = sf::VertexArray(sf::Points, number_of_stars);
-	std::vector<sf::Vector2f> star_velocities_ = std::vector<sf::Vector2f>(number_of_stars);
+	SpatialGrid star_grid_{ bounds_, grid_cell_size, pool_ };
+	std::vector<SpatialGrid::Neighbour> picked_stars_;
+	std::vector<sf::Vector2f> visible_positions_; // culled and sampled star positions, filled from the grid
 
-	std::vector<BlackHole> black_holes_;
-	sf::CircleShape black_hole_renderer_;
+	Profiler profiler_{};
+	HeapGuard step_heap_guard_{ pool_, "step" };
+	std::uint64_t heap_allocations_ = 0; // on the main thread and in pool jobs, when the last frame ended
+
+	TimestepController timestep_{ config_.dt };
+	double simulated_time_ = 0.0;
+
+	StarKernel star_kernel_ = nullptr;
+	BasicStarKernel<3> star_kernel_3d_ = nullptr;
+	HostDriftKernel host_drift_kernel_ = nullptr;
+	StarKernel midstep_kernel_ = nullptr;       // the same kernels with feature_midstep_kick, for the Hermite steps
+	BasicStarKernel<3> midstep_kernel_3d_ = nullptr;
+	HostDriftKernel midstep_host_drift_kernel_ = nullptr;
 
 	sf::RenderStates states_{};
-	sf::Transform transform_{};
 
 
 public:
-	Simulation()
-		: window_(sf::VideoMode(screen_width, screen_height), title)
+	explicit Simulation(Config config = {})
+		: config_(std::move(config)), config_watcher_(config_.path), bounds_(config_.bounds()),
+		  three_d_(config_.dimensions == 3), box_(config_.box()),
+		  use_black_hole_tree_(config_.number_of_black_holes > black_hole_tree_threshold && !three_d_),
+		  numa_(NumaTopology::detect()), pool_(config_.threads, thread_cpus(numa_, config_.thread_affinity, config_.threads)),
+		  star_chunks_(config_.number_of_stars / (pool_.size() * chunks_per_thread), min_star_chunk, std::max(min_star_chunk, config_.number_of_stars / pool_.size())),
+		  camera_(bounds_, { config_.screen_width, config_.screen_height }, config_.simulation_scale, max_zoom, zoom_step),
+		  star_budget_(static_cast<size_t>(lod_stars_per_pixel * config_.screen_width * config_.screen_height)),
+		  huge_pages_(parse_huge_pages(config_.huge_pages)),
+		  star_positions_(StarAllocator<sf::Vector2f>(huge_pages_)), star_velocities_(StarAllocator<sf::Vector2f>(huge_pages_)),
+		  star_positions_3d_(StarAllocator<sf::Vector3f>(huge_pages_)), star_velocities_3d_(StarAllocator<sf::Vector3f>(huge_pages_)),
+		  star_accelerations_(StarAllocator<sf::Vector2f>(huge_pages_)), star_hosts_(StarAllocator<unsigned>(huge_pages_)),
+		  star_perturbations_(StarAllocator<sf::Vector2f>(huge_pages_))
 	{
-		window_.setFramerateLimit(max_fps);
-		window_.setVerticalSyncEnabled(v_sync);
-		window_.resetGLStates();
+		if (three_d_)
+			camera_.enable_tilt(config_.world_depth, tilt_step);
+
+		// the pool threads touch the star arrays first, before init_stars writes them on this thread
+		star_pool_.reserve(star_positions_);
+		star_pool_.reserve(star_velocities_);
+		star_pool_.resize(star_positions_, config_.number_of_stars);
+		star_pool_.resize(star_velocities_, config_.number_of_stars);
+		if (three_d_)
+		{
+			star_pool_.reserve(star_positions_3d_);
+			star_pool_.reserve(star_velocities_3d_);
+			star_pool_.resize(star_positions_3d_, config_.number_of_stars);
+			star_pool_.resize(star_velocities_3d_, config_.number_of_stars);
+		}
 
-		transform_.scale(sf::Vector2f(simulation_scale, simulation_scale));
-		states_.transform = transform_;
-		states_.blendMode = sf::BlendAdd;
+		if (huge_pages_ != HugePages::none)
+			print_huge_pages();
 
 		init_black_holes();
 		init_stars();
+		init_precision();
+		select_kernel();
+		init_shards();
+
+		if (config_.headless)
+		{
+			headless_.emplace(bounds_, config_.image_width, config_.image_height, headless_tile_size, star_pool_.capacity(),
+				star_color, density_softening, config_.headless_gl, config_.star_render_path, config_.image_output,
+				image_writer_threads, max_pending_images, pool_);
+		}
+		if (config_.headless || benchmark_only() || config_.domains > 1)
+			return;
+
+		window_.emplace(sf::VideoMode(config_.screen_width, config_.screen_height), title);
+		window_->setFramerateLimit(max_fps);
+		window_->setVerticalSyncEnabled(v_sync);
+		window_->resetGLStates();
+
+		states_.blendMode = sf::BlendAdd;
+		visible_positions_.reserve(std::min<size_t>(config_.number_of_stars, star_budget_ * 2));
+
+		star_renderer_.emplace(star_pool_.capacity(), star_color, pool_);
+		set_render_path(static_cast<StarRenderer::Path>(config_.star_render_path));
+		set_density_render(config_.density_render);
+
+		if (!config_.capture.empty())
+			set_capture(true);
 	}
 
 
@@ -82,208 +207,2089 @@ public:
 		black_hole_renderer_.setFillColor(black_hole_color);
 		black_hole_renderer_.setRadius(black_hole_radius);
 
-		black_holes_.resize(number_of_black_holes);
-		for (size_t i = 0; i < number_of_black_holes; i++)
+		black_holes_.resize(config_.number_of_black_holes, three_d_ ? 3 : 2);
+		for (size_t i = 0; i < black_holes_.size(); i++)
 		{
-			black_holes_[i].position = Random::rand_pos_in_rect(bounds);
-			black_holes_[i].velocity = Random::rand_vector(-initial_bh_velocity, initial_bh_velocity);
+			black_holes_.set_position(i, Random::rand_pos_in_rect(bounds_));
+			black_holes_.set_velocity(i, Random::rand_vector(-config_.initial_bh_velocity, config_.initial_bh_velocity));
+			black_holes_.mass[i] = bh_mass;
+
+			if (three_d_)
+			{
+				black_holes_.z[i] = Random::rand_range(box_.origin.z, box_.origin.z + box_.size.z);
+				black_holes_.vz[i] = Random::rand_range(-config_.initial_bh_velocity, config_.initial_bh_velocity);
+			}
 		}
 	}
 
 
 	void init_stars()
 	{
+		if (three_d_)
+		{
+			init_stars_3d();
+			return;
+		}
+
 		for (size_t i = 0; i < star_velocities_.size(); i++)
+			spawn_star(i, i % black_holes_.size());
+	}
+
+
+	// disks in the x / y plane like in 2D, around the height of their black hole with a spread of disk_thickness
+	void init_stars_3d()
+	{
+		const Projection projection = camera_.projection();
+		for (size_t i = 0; i < star_positions_3d_.size(); i++)
+			spawn_star_3d(i, i % black_holes_.size(), projection);
+	}
+
+
+	void spawn_star(const size_t i, const size_t parent)
+	{
+		const sf::Vector2f parent_pos = black_holes_.position(parent);
+		star_positions_[i] = Random::rand_pos_in_circle<float>(parent_pos, config_.star_spawn_radius);
+
+		// The star will initially start by going in the direction perpendicular to the black hole
+		const float dist = toroidal_distance(parent_pos, star_positions_[i], bounds_);
+
+		const sf::Vector2f norm = toroidal_direction(parent_pos, star_positions_[i], bounds_) / dist;
+		const sf::Vector2f perp = perpendicular(norm);
+
+		const float speed = sqrt(dist);
+
+		star_velocities_[i] = perp * speed;
+	}
+
+
+	void spawn_star_3d(const size_t i, const size_t parent, const Projection& projection)
+	{
+		std::normal_distribution<float> height(0.f, config_.disk_thickness);
+
+		const sf::Vector2f parent_pos = black_holes_.position(parent);
+		const sf::Vector2f in_plane = Random::rand_pos_in_circle<float>(parent_pos, config_.star_spawn_radius);
+
+		const float dist = toroidal_distance(parent_pos, in_plane, bounds_);
+		const sf::Vector2f norm = toroidal_direction(parent_pos, in_plane, bounds_) / dist;
+		const sf::Vector2f velocity = perpendicular(norm) * std::sqrt(dist);
+
+		sf::Vector3f position{ in_plane.x, in_plane.y, black_holes_.z[parent] + height(rng) };
+		border(position, box_);
+
+		star_positions_3d_[i] = position;
+		star_velocities_3d_[i] = { velocity.x, velocity.y, 0.f };
+		star_positions_[i] = projection(position);
+	}
+
+
+	void init_precision()
+	{
+		if (three_d_ && config_.star_precision != SinglePrecision::name)
 		{
-			const sf::Vector2f parent_pos = black_holes_[i % number_of_black_holes].position;
-			stars_[i].position = Random::rand_pos_in_circle<float>(parent_pos, star_spawn_radius);
-			stars_[i].color = star_color;
+			std::cout << "star_precision is 2D only, 3D runs in float\n";
+			return;
+		}
 
-			// The star will initially start by going in the direction perpendicular to the black hole
-			const float dist = toroidal_distance(parent_pos, stars_[i].position, bounds);
+		if (config_.star_precision == DoublePrecision::name)
+			precise_stars_.emplace<StarState<DoublePrecision>>(star_positions_, star_velocities_, bounds_, precision_cell_size);
+		else if (config_.star_precision == MixedPrecision::name)
+			precise_stars_.emplace<StarState<MixedPrecision>>(star_positions_, star_velocities_, bounds_, precision_cell_size);
+		else if (config_.star_precision != SinglePrecision::name)
+			std::cout << "unknown star_precision " << config_.star_precision << ", using float\n";
 
-			const sf::Vector2f norm = toroidal_direction(parent_pos, stars_[i].position, bounds) / dist;
-			const sf::Vector2f perp = perpendicular(norm);
+		std::visit([this](auto& stars)
+		{
+			if constexpr (!std::is_same_v<std::decay_t<decltype(stars)>, std::monostate>)
+				stars.reserve(star_pool_.capacity());
+		}, precise_stars_);
+	}
 
-			const float speed = sqrt(dist);
 
-			star_velocities_[i] = perp * speed;
+	void init_shards()
+	{
+		if (config_.shard_workers == 0)
+			return;
+
+		if (three_d_ || precise_stars_.index() != 0)
+		{
+			std::cout << "star shards run the 2D float star update, ignoring shard_workers\n";
+			return;
 		}
+
+		shards_.emplace(config_.shard_name, std::min(config_.shard_workers, max_shard_workers), black_holes_,
+			star_positions_, star_velocities_, config_.command_line());
+		if (!shards_->is_open())
+			shards_.reset();
 	}
 
 
 	void run()
 	{
-		while (window_.isOpen())
+		if (three_d_ && benchmark_only())
+		{
+			std::cout << "validation and benchmarks run on the 2D core, set dimensions = 2\n";
+			return;
+		}
+
+		if (config_.domains > 1)
+		{
+			run_domains();
+			return;
+		}
+
+		if (benchmark_only())
+		{
+			if (config_.validate_lod)
+				validate_approximations();
+			if (config_.benchmark_field)
+				benchmark_acceleration_field();
+			if (config_.benchmark_precision)
+				benchmark_precision();
+			if (config_.benchmark_numa)
+				benchmark_numa();
+			if (config_.benchmark_huge_pages)
+				benchmark_huge_pages();
+			if (config_.benchmark_timestep)
+				benchmark_timestep();
+			if (config_.benchmark_black_holes)
+				benchmark_black_holes();
+			return;
+		}
+
+		if (headless_)
+		{
+			run_headless();
+			return;
+		}
+
+		while (!close_requested_)
 		{
 			++frames;
 			handle_events();
-			update_stars();
-
-			update_black_holes();
-			
+			if (close_requested_)
+				break;
+			poll_config();
+			step();
+			update_idle_counter();
 			render();
+			end_frame();
 		}
+		close_window();
 	}
 
 
 private:
-	void handle_events()
+	// the validation and benchmark modes run without a window and exit when they are done
+	bool benchmark_only() const
 	{
-		sf::Event event;
-		while (window_.pollEvent(event))
+		return config_.validate_lod || config_.benchmark_field || config_.benchmark_precision || config_.benchmark_numa
+			|| config_.benchmark_huge_pages || config_.benchmark_timestep || config_.benchmark_black_holes;
+	}
+
+
+	void step()
+	{
+		const HeapGuard::Scope heap_guard = step_heap_guard_.watch();
+		if (shards_)
 		{
-			if (event.type == sf::Event::Closed)
-				window_.close();
+			step_shards();
+			return;
+		}
 
-			else if (event.type == sf::Event::KeyPressed)
+		if (config_.acceleration_field && !three_d_)
+		{
+			auto timer = profiler_.time("bh field");
+			acceleration_field_.update(black_holes_, config_.field_tolerance, arenas_.frame());
+			profiler_.set_counter("field builds", static_cast<float>(acceleration_field_.builds()));
+		}
+		// the leapfrog black holes drift the first half of the step here, the tree and the stars see them there
+		const bool leapfrog = leapfrog_active();
+		if (leapfrog)
+		{
+			auto timer = profiler_.time("black holes");
+			drift_black_holes(step_dt() / 2);
+		}
+		if (use_black_hole_tree_)
+		{
+			auto timer = profiler_.time("bh tree");
+			black_hole_tree_.build(black_holes_);
+		}
+		// the Hermite black holes are integrated ahead of the stars, which drift half a step, take their kick from
+		// the black holes in the middle of the step and drift the other half. the acceleration field was built
+		// from the start of the step, its stars keep the plain step
+		const bool black_holes_first = hermite_active();
+		if (black_holes_first)
+		{
+			auto timer = profiler_.time("black holes");
+			integrate_black_holes();
+			kick_at_midstep_ = three_d_ || !config_.acceleration_field;
+			if (kick_at_midstep_ && three_d_)
+				black_hole_trajectory_.interpolate<3>(0.5f, step_dt(), box_, black_holes_midstep_);
+			else if (kick_at_midstep_)
+				black_hole_trajectory_.interpolate<2>(0.5f, step_dt(), bounds_, black_holes_midstep_);
+		}
+		else
+			kick_at_midstep_ = leapfrog;
+		{
+			auto timer = profiler_.time("stars");
+			update_stars();
+			kick_at_midstep_ = false;
+		}
+		{
+			auto timer = profiler_.time("black holes");
+			if (black_holes_first)
+				black_holes_ = black_hole_trajectory_.end();
+			else
+				update_black_holes();
+		}
+		if (star_pool_.removals_pending() || config_.star_inflow > 0.f)
+		{
+			auto timer = profiler_.time("star pool");
+			update_star_pool();
+		}
+		if constexpr (build_star_grid)
+		{
+			auto timer = profiler_.time("grid");
+			rebuild_star_grid();
+		}
+		update_timestep();
+	}
+
+
+	// a worker failed, the stars go on in this process from now on. the shards that finished the step are taken
+	// as they are, the failed ones go through the step here, with the black holes it was published with
+	void take_over_stars(sf::Vector2f* render_positions)
+	{
+		std::cout << "shards: updating the stars locally from now on\n";
+		BlackHoles published;
+		published.resize(black_holes_.size());
+		ShardParams params{};
+		const std::vector<std::pair<size_t, size_t>> failed = shards_->take_over(star_positions_, star_velocities_, published, params);
+		shards_.reset();
+
+		if (use_black_hole_tree_)
+			black_hole_tree_.build(published);
+		const StarKernelParams kernel_params{ &published, &black_hole_tree_, nullptr, bounds_, nullptr,
+			params.G, params.dt, star_mass, params.max_speed, params.damping, black_hole_radius * black_hole_radius * 2 };
+		const StarKernel kernel = select_star_kernel(published.size(), use_black_hole_tree_, params.features);
+		for (const auto& [first, last] : failed)
+		{
+			pool_.parallel_for(last - first, [this, first, &kernel, &kernel_params](const size_t begin, const size_t end, unsigned)
 			{
-				if (event.key.code == sf::Keyboard::Space)
-					paused_ = not paused_;
+				kernel(star_positions_.data(), star_velocities_.data(), first + begin, first + end, kernel_params);
+			});
+		}
 
-				else if (event.key.code == sf::Keyboard::D)
-					draw_ = not draw_;
+		if (render_positions)
+			std::copy_n(star_positions_.data(), star_count(), render_positions);
+	}
 
-				else if (event.key.code == sf::Keyboard::Escape)
+
+	// the workers update the stars from the published black holes while this process moves them on
+	void step_shards()
+	{
+		sf::Vector2f* render_positions = nullptr;
+		if (draw_ && star_renderer_ && !density_render_ && !cull_stars_for_view())
+		{
+			auto timer = profiler_.time("fence wait");
+			render_positions = star_renderer_->writable_positions();
+		}
+		{
+			auto timer = profiler_.time("publish");
+			const bool leapfrog = leapfrog_active();
+			if (leapfrog)
+				drift_black_holes(step_dt() / 2);
+			const unsigned features = (star_features() & (feature_speed_limit | feature_damping | feature_capture))
+				| (leapfrog ? feature_midstep_kick : 0u);
+			shards_->publish(black_holes_, { config_.G, step_dt(), config_.cosmic_speed_limit, step_damping(), features });
+		}
+		{
+			auto timer = profiler_.time("black holes");
+			update_black_holes();
+		}
+		{
+			auto timer = profiler_.time("shards");
+			if (!shards_->wait(shard_timeout))
+			{
+				take_over_stars(render_positions);
+			}
+			else
+			{
+				const sf::Vector2f* shared = shards_->positions();
+				pool_.parallel_for(star_count(), [this, shared, render_positions](const size_t begin, const size_t end, unsigned)
 				{
-					window_.close();
-				}
+					std::copy(shared + begin, shared + end, star_positions_.data() + begin);
+					if (render_positions)
+						std::copy(shared + begin, shared + end, render_positions + begin);
+				});
 			}
 		}
+		if constexpr (build_star_grid)
+		{
+			auto timer = profiler_.time("grid");
+			rebuild_star_grid();
+		}
+		update_timestep();
 	}
 
 
-	void update_batch_of_stars(const unsigned begin_index, const unsigned end_index)
+	// the step of this frame, dt unless the adaptive step is on
+	float step_dt() const
 	{
-		if (end_index > number_of_stars)
-			return;
+		return config_.adaptive_dt ? timestep_.dt() : config_.dt;
+	}
 
-		for (size_t i = begin_index; i < end_index; ++i) 
+	// damping is per step, an adaptive step scales it so that the damping per unit of time stays the same
+	float step_damping() const
+	{
+		return config_.adaptive_dt ? std::pow(config_.damping, step_dt() / config_.dt) : config_.damping;
+	}
+
+	// the step is done, the black hole pairs and the stars closest to the black holes pick the next one
+	void update_timestep()
+	{
+		simulated_time_ += step_dt();
+		if (!config_.adaptive_dt)
 		{
-			sf::Vector2f& position = stars_[i].position;
-			sf::Vector2f& vel = star_velocities_[i];
+			timestep_.reset(config_.dt);
+			return;
+		}
 
-			gravitate(position, vel, star_mass);
-			speed_limit(vel);
-			border(position);
+		const float tau = std::min(three_d_ ? black_hole_timescale<3>() : black_hole_timescale<2>(), star_timescale());
+		timestep_.advance(config_.dt_eta * tau, config_.dt_min, config_.dt_max, max_dt_change);
+		profiler_.set_counter("dt", timestep_.dt());
+		profiler_.set_counter("time", static_cast<float>(simulated_time_));
+	}
 
-			position += vel * dt;
-			vel *= 0.9999f;
-		}
+	// the adaptive step is time symmetric, and so is its integrator: without Hermite the black holes and the stars
+	// take the drift kick drift leapfrog, the stars kicked by the black holes in the middle of the step. the
+	// acceleration field is built from the start of the step, with it everything keeps the plain step
+	bool leapfrog_active() const
+	{
+		return config_.adaptive_dt && !hermite_active() && (three_d_ || !config_.acceleration_field);
 	}
 
+	// half an orbit of a star just outside the capture radius of the heaviest black hole. the pull on a star is
+	// G * m_star * m / r, so the circular speed sqrt(G * m_star * m) is the same at every radius and the stars
+	// closest in turn around fastest. infinite without black holes
+	float star_timescale() const
+	{
+		float top_mass = 0.f;
+		for (const float mass : black_holes_.mass)
+			top_mass = std::max(top_mass, mass);
+		if (top_mass <= 0.f || star_count() == 0)
+			return std::numeric_limits<float>::infinity();
+
+		const float capture_radius = black_hole_radius * std::sqrt(2.f);
+		return 3.14159265f * capture_radius / std::sqrt(config_.G * star_mass * top_mass);
+	}
 
-	void update_stars()
+	// shortest timescale of the black hole pairs, the smaller of the crossing time r / |v_j - v_i| and the free
+	// fall time sqrt(r / a), with a = 2 * G * m_i * m_j / r the pull of the pair on each other. together
+	// tau^2 = r^2 / max(v^2, 2 * G * m_i * m_j), with r floored at the capture radius where the pull stops. the
+	// black holes are swept in x order and the scan from each one stops where not even the fastest rate could beat
+	// the shortest timescale so far, so spread out black holes cost about n log n, O(n^2) at worst. infinite with a
+	// single black hole
+	template<unsigned Dimensions>
+	float black_hole_timescale()
 	{
-		// updating particles
-		unsigned prev_i = 0;
-		std::vector<std::thread> threads;
-		threads.reserve(number_of_stars / threading_batches);
+		using Vector = typename Space<Dimensions>::Vector;
+		const size_t count = black_holes_.size();
+		const float pull_scale = 2 * config_.G / 5;
 
-		for (size_t i = threading_batches; i <= number_of_stars; i += threading_batches)
+		unsigned* const order = arenas_.frame().allocate<unsigned>(count);
+		float top_speed = 0.f, top_mass = 0.f;
+		for (size_t i = 0; i < count; ++i)
 		{
-			threads.emplace_back([this, prev_i, i]() {
-				update_batch_of_stars(prev_i, i);});
-			prev_i = i;
+			order[i] = static_cast<unsigned>(i);
+			top_speed = std::max(top_speed, std::sqrt(length_sq(black_holes_.template velocity_in<Dimensions>(i))));
+			top_mass = std::max(top_mass, black_holes_.mass[i]);
 		}
+		std::sort(order, order + count, [this](const unsigned a, const unsigned b) { return black_holes_.x[a] < black_holes_.x[b]; });
+		const float top_rate = std::max(2 * top_speed, std::sqrt(pull_scale) * top_mass);
 
-		for (auto& th : threads)
+		std::atomic<float> shortest_sq = std::numeric_limits<float>::infinity();
+		pool_.parallel_for(count, [this, order, count, pull_scale, top_rate, &shortest_sq](const size_t begin, const size_t end, unsigned)
 		{
-			th.join();
-		}
+			constexpr float capture_radius_sq = black_hole_radius * black_hole_radius * 2;
+			float local_sq = std::numeric_limits<float>::infinity();
+			for (size_t k = begin; k < end; ++k)
+			{
+				const unsigned i = order[k];
+				const Vector position = black_holes_.template position_in<Dimensions>(i);
+				const Vector velocity = black_holes_.template velocity_in<Dimensions>(i);
+				local_sq = std::min(local_sq, shortest_sq.load(std::memory_order_relaxed));
+				float reach = std::sqrt(local_sq) * top_rate;
+
+				// onwards in x around the torus, every pair is met from the one of its two that is behind
+				for (size_t m = 1; m < count; ++m)
+				{
+					const unsigned j = order[(k + m) % count];
+					float dx = black_holes_.x[j] - black_holes_.x[i];
+					if (dx < 0.f)
+						dx += bounds_.width;
+					if (dx > reach)
+						break;
+
+					const float distance_sq = std::max(toroidal_distance_sq(position, black_holes_.template position_in<Dimensions>(j),
+						space_bounds<Dimensions>()), capture_radius_sq);
+					const float rate_sq = std::max(length_sq(black_holes_.template velocity_in<Dimensions>(j) - velocity),
+						pull_scale * black_holes_.mass[i] * black_holes_.mass[j]);
+					if (rate_sq > 0.f && distance_sq < local_sq * rate_sq)
+					{
+						local_sq = distance_sq / rate_sq;
+						reach = std::sqrt(local_sq) * top_rate;
+					}
+				}
+			}
+			atomic_min(shortest_sq, local_sq);
+		});
+		return std::sqrt(shortest_sq.load(std::memory_order_relaxed));
 	}
 
-	void update_black_holes()
+
+	// fixed number of steps without a window, every frame_interval-th step is rendered to an image
+	void run_headless()
 	{
-		for (BlackHole& black_hole : black_holes_)
+		const unsigned interval = std::max(1u, config_.frame_interval);
+		sf::Clock clock;
+
+		for (unsigned s = 0; s < config_.headless_steps; ++s)
 		{
-			gravitate(black_hole.position, black_hole.velocity, bh_mass, G/5);
-			speed_limit(black_hole.velocity, cosmic_speed_limit / 10);
+			++frames;
+			poll_config();
+			step();
+
+			if (s % interval == 0)
+			{
+				auto timer = profiler_.time("image");
+				headless_->render_frame(star_positions_.data(), star_positions_.size());
+			}
 
-			black_hole.update(dt);
-			border(black_hole.position);
+			update_idle_counter();
+			if (frames % stats_interval == 0)
+				std::cout << "step " << frames << "/" << config_.headless_steps << profiler_.summary() << "\n";
+			end_frame();
 		}
 
+		const size_t failed = headless_->finish();
+		std::cout << "headless: " << headless_->writer().written() << " images in " << clock.getElapsedTime().asSeconds() << "s, "
+			<< failed << " failed, " << headless_->writer().wait_ms() << "ms spent waiting for the writer\n";
 	}
 
-	void render()
+
+	void handle_events()
 	{
-		if (draw_ == true) 
+		sf::Event event;
+		while (window_->pollEvent(event))
 		{
-			window_.clear();
+			if (event.type == sf::Event::Closed)
+				close_requested_ = true;
 
-			window_.draw(stars_, states_);
+			else if (camera_.handle_event(event))
+				continue;
 
-			for (BlackHole& black_hole : black_holes_)
+			else if (event.type == sf::Event::KeyPressed)
 			{
-				black_hole_renderer_.setPosition(black_hole.position - sf::Vector2f(black_hole_radius, black_hole_radius));
-				window_.draw(black_hole_renderer_, states_);
+				if (event.key.code == sf::Keyboard::Space)
+					paused_ = not paused_;
+
+				else if (event.key.code == sf::Keyboard::D)
+					draw_ = not draw_;
+
+				else if (event.key.code == sf::Keyboard::Escape)
+				{
+					close_requested_ = true;
+				}
+
+				else if (event.key.code == sf::Keyboard::L)
+					toggle_feature(config_.speed_limit_stars);
+
+				else if (event.key.code == sf::Keyboard::R)
+					toggle_feature(config_.damp_stars);
+
+				else if (event.key.code == sf::Keyboard::C)
+					toggle_feature(config_.capture_stars);
+
+				else if (event.key.code == sf::Keyboard::T)
+					toggle_feature(config_.temporal_lod);
+
+				else if (event.key.code == sf::Keyboard::K)
+					toggle_feature(config_.host_drift);
+
+				else if (event.key.code == sf::Keyboard::A)
+					toggle_feature(config_.acceleration_field);
+
+				else if (event.key.code == sf::Keyboard::X)
+					toggle_feature(config_.accretion);
+
+				else if (event.key.code == sf::Keyboard::F5)
+					reload_config();
+
+				else if (event.key.code == sf::Keyboard::P)
+					print_worker_stats();
+
+				else if (event.key.code == sf::Keyboard::V)
+					set_render_path(static_cast<StarRenderer::Path>((star_renderer_->path() + 1) % StarRenderer::path_count));
+
+				else if (event.key.code == sf::Keyboard::H)
+					set_density_render(not density_render_);
+
+				else if (event.key.code == sf::Keyboard::F9)
+					set_capture(!capture_);
 			}
 
-			window_.display();
+			else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
+			{
+				if constexpr (build_star_grid)
+					pick_star({ event.mouseButton.x, event.mouseButton.y });
+			}
 		}
+	}
 
-		// FPS management
-		const auto fps = static_cast< sf::Int32>(1.f / clock_.restart().asSeconds());
 
-		std::ostringstream oss;
-		oss << title << fps << " fps";
-		const std::string var = oss.str();
-		window_.setTitle(var);
+	void toggle_feature(bool& enabled)
+	{
+		enabled = not enabled;
+		select_kernel();
+	}
+
+
+	unsigned star_features() const
+	{
+		return (config_.speed_limit_stars ? feature_speed_limit : 0u)
+			| (config_.damp_stars ? feature_damping : 0u) | (config_.capture_stars ? feature_capture : 0u)
+			| (config_.temporal_lod ? feature_temporal_lod : 0u);
 	}
 
 
-	static void speed_limit(sf::Vector2f& velocity, const float max_speed = cosmic_speed_limit)
+	void select_kernel()
 	{
-		const float speed_sq = velocity.x * velocity.x + velocity.y * velocity.y;
+		const unsigned features = star_features();
+
+		if (three_d_)
+		{
+			star_kernel_3d_ = select_star_kernel<3>(black_holes_.size(), false, features);
+			midstep_kernel_3d_ = select_star_kernel<3>(black_holes_.size(), false, features | feature_midstep_kick);
+			if (config_.temporal_lod || config_.host_drift || config_.acceleration_field)
+				std::cout << "3D always takes the direct sum over the black holes\n";
+			return;
+		}
+
+		const StarKernel previous_kernel = star_kernel_;
+		const bool lod_was_running = lod_active_ && !host_drift_active_;
+		star_kernel_ = select_star_kernel(black_holes_.size(), use_black_hole_tree_, features, config_.acceleration_field);
+		midstep_kernel_ = select_star_kernel(black_holes_.size(), use_black_hole_tree_, features | feature_midstep_kick, config_.acceleration_field);
+		lod_active_ = config_.temporal_lod;
+
+		// host drift needs per black hole pulls, which the tree does not give. it takes over from temporal LOD
+		if (config_.host_drift && use_black_hole_tree_)
+			std::cout << "host drift needs the direct black hole loop (at most " << black_hole_tree_threshold << " black holes)\n";
 
-		if (speed_sq > max_speed * max_speed)
+		const bool host_drift = config_.host_drift && !use_black_hole_tree_;
+		if (host_drift && !host_drift_active_)
 		{
-			const float speed = sqrt(speed_sq);
-			const sf::Vector2f norm_vel = velocity / speed;
-			velocity = norm_vel * max_speed;
+			star_pool_.reserve(star_hosts_);
+			star_pool_.reserve(star_perturbations_);
+			star_pool_.assign(star_hosts_, star_count(), no_host);
+			star_pool_.resize(star_perturbations_, star_count());
 		}
+		host_drift_active_ = host_drift;
+		host_drift_kernel_ = select_host_drift_kernel(features);
+		midstep_host_drift_kernel_ = select_host_drift_kernel(features | feature_midstep_kick);
+
+		// the LOD kernel runs while host drift is off. caches from an earlier LOD period are arbitrarily old and
+		// ones from another kernel are not its accelerations, start from a full evaluation
+		if (lod_active_ && !host_drift_active_ && (!lod_was_running || star_kernel_ != previous_kernel))
+		{
+			star_pool_.reserve(star_accelerations_);
+			star_pool_.assign(star_accelerations_, star_count(), stale_acceleration);
+		}
+
+		if (precise_stars_.index() != 0 && (config_.temporal_lod || host_drift || config_.acceleration_field || use_black_hole_tree_))
+			std::cout << "star_precision " << config_.star_precision << " always takes the direct sum over the black holes\n";
+	}
+
+
+	void poll_config()
+	{
+		if (config_poll_clock_.getElapsedTime().asSeconds() < config_poll_interval)
+			return;
+
+		config_poll_clock_.restart();
+		if (config_watcher_.changed())
+			reload_config();
 	}
 
 
-	static void border(sf::Vector2f& position)
+	// re-reads the config file and applies the physics parameters that are safe to change mid-run
+	void reload_config()
 	{
-		if (position.x > bounds.left + bounds.width)
-			position.x -= bounds.left + bounds.width;
+		if (config_.path.empty())
+			return;
+
+		Config fresh = config_;
+		if (!fresh.load(config_.path))
+			return;
+
+		fresh.apply_overrides();
+		fresh.validate();
+		config_.update_live(fresh);
+		select_kernel();
+	}
+
 
-		else if (position.x < bounds.left)
-			position.x += bounds.left + bounds.width;
+	void set_render_path(const StarRenderer::Path path)
+	{
+		const StarRenderer::Path chosen = star_renderer_->set_path(path);
+		std::cout << "star render path: " << StarRenderer::path_name(chosen);
+		if (chosen != path)
+			std::cout << " (" << StarRenderer::path_name(path) << " is not supported)";
+		std::cout << "\n";
+	}
 
-		if (position.y < bounds.top)
-			position.y += bounds.top + bounds.height;
 
-		else if (position.y > bounds.top + bounds.height)
-			position.y -= bounds.top + bounds.height;
+	void set_density_render(const bool enabled)
+	{
+		density_render_ = enabled;
+		if (enabled && !density_renderer_)
+			density_renderer_.emplace(config_.screen_width, config_.screen_height, star_color, density_softening, pool_);
 	}
 
 
+	// a new recording overwrites the capture file
+	// the capture readback and the star renderer own raw GL objects, they are released while the window's
+	// context still exists
+	void close_window()
+	{
+		window_->setActive(true);
+		set_capture(false);
+		star_renderer_.reset();
+		window_->close();
+	}
+
 
-	void gravitate(const sf::Vector2f& position, sf::Vector2f& velocity, const float mass, const float grav_const=G) const
+	void set_capture(const bool enabled)
 	{
-		for (size_t i = 0; i < number_of_black_holes; i++)
+		if (!enabled)
 		{
-			const sf::Vector2f bh_position = black_holes_[i].position;
-			if (bh_position != position)
-			{
-				const float distance_sq = toroidal_distance_sq(position, bh_position, bounds);
+			if (readback_ && capture_)
+				readback_->flush([this](const sf::Uint8* pixels) { capture_->offer(pixels, true); });
+			readback_.reset();
+			capture_.reset();
+			return;
+		}
 
-				if (distance_sq < black_hole_radius * black_hole_radius * 2)
-				{
-					velocity *= 1.01f;
-					continue;
-				}
+		if (config_.capture.empty())
+		{
+			std::cout << "capture: set capture = <file.y4m | file.rgb | -> in the config or on the command line\n";
+			return;
+		}
 
-				const float mass_product = mass * bh_mass;
-				const float force = grav_const * (mass_product / distance_sq);
-				sf::Vector2f direction = toroidal_direction(position, bh_position, bounds);
+		const sf::Vector2u size = window_->getSize();
+		capture_.emplace(config_.capture, size.x, size.y, config_.capture_fps, capture_slots);
+		if (!capture_->is_open())
+		{
+			capture_.reset();
+			return;
+		}
 
-				velocity += direction * force * dt;
-			}
+		window_->setActive(true);
+		readback_.emplace(size.x, size.y);
+		std::cout << "capture: recording " << size.x << "x" << size.y << " to " << config_.capture << "\n";
+	}
+
+
+	// starts the readback of the finished frame and hands earlier, completed ones to the writer
+	void capture_frame()
+	{
+		auto timer = profiler_.time("capture");
+		const unsigned given_up = readback_->capture([this](const sf::Uint8* pixels) { capture_->offer(pixels, true); });
+		capture_->drop(given_up);
+		profiler_.set_counter("dropped", static_cast<float>(capture_->dropped()));
+	}
+
+
+	void rebuild_star_grid()
+	{
+		star_grid_.build(star_positions_.size(), arenas_.frame(), [this](const size_t i) { return star_positions_[i]; });
+	}
+
+
+	// reports the star under the cursor and the local star density around it
+	void pick_star(const sf::Vector2i pixel)
+	{
+		const sf::Vector2f world = camera_.to_world(pixel);
+
+		star_grid_.query_nearest(world, 1, picked_stars_);
+		if (picked_stars_.empty())
+			return;
+
+		const size_t neighbours = star_grid_.count_in_radius(world, pick_radius);
+		const float density = static_cast<float>(neighbours) / (3.14159265f * pick_radius * pick_radius);
+
+		std::cout << "star " << picked_stars_[0].index << " at distance " << sqrt(picked_stars_[0].distance_sq)
+			<< ", " << neighbours << " stars within " << pick_radius << " (density " << density << ")\n";
+	}
+
+
+	void update_stars()
+	{
+		// with a persistently mapped renderer the workers write the frame's vertices as they go, unless only
+		// the culled subset is drawn
+		sf::Vector2f* render_positions = nullptr;
+		if (draw_ && star_renderer_ && !density_render_ && !cull_stars_for_view())
+		{
+			auto timer = profiler_.time("fence wait");
+			render_positions = star_renderer_->writable_positions();
+		}
+
+		if (three_d_)
+		{
+			update_stars_3d(render_positions);
+			return;
+		}
+
+		StarKernelParams params{ star_black_holes(), &black_hole_tree_, &acceleration_field_, bounds_, render_positions,
+			config_.G, step_dt(), star_mass, config_.cosmic_speed_limit, step_damping(), black_hole_radius * black_hole_radius * 2 };
+		flag_absorbed_stars(params);
+
+		if (precise_stars_.index() != 0)
+		{
+			sf::Clock clock;
+			if (auto* stars = std::get_if<StarState<DoublePrecision>>(&precise_stars_))
+				update_precise_stars(*stars, params);
+			else if (auto* stars = std::get_if<StarState<MixedPrecision>>(&precise_stars_))
+				update_precise_stars(*stars, params);
+			star_chunks_.record(clock.getElapsedTime().asMicroseconds() / 1000.0);
+			return;
+		}
+
+		params.bicubic_field = config_.field_bicubic;
+		if (lod_active_)
+		{
+			params.accelerations = star_accelerations_.data();
+			params.lod_interval = std::max(1u, config_.lod_interval);
+			params.lod_phase = stagger_phase_ % params.lod_interval;
+			params.lod_limit = temporal_lod_limit(config_.lod_error, config_.G, star_mass, bh_mass, params.lod_interval, params.dt);
+			params.max_black_hole_speed = hermite_active() ? black_hole_trajectory_.max_speed() : max_black_hole_speed();
+		}
+
+		const HostDriftParams drift{ star_hosts_.data(), star_perturbations_.data(), std::max(1u, config_.host_drift_refresh),
+			stagger_phase_ % std::max(1u, config_.host_drift_refresh), config_.host_drift_threshold };
+
+		const StarKernel kernel = kick_at_midstep_ ? midstep_kernel_ : star_kernel_;
+		const HostDriftKernel host_drift_kernel = kick_at_midstep_ ? midstep_host_drift_kernel_ : host_drift_kernel_;
+
+		std::atomic<size_t> evaluations = 0;
+		sf::Clock clock;
+		for_each_star_slice(star_count(), [&](const size_t begin, const size_t end, unsigned)
+		{
+			const size_t evaluated = host_drift_active_
+				? host_drift_kernel(star_positions_.data(), star_velocities_.data(), begin, end, params, drift)
+				: kernel(star_positions_.data(), star_velocities_.data(), begin, end, params);
+			evaluations.fetch_add(evaluated, std::memory_order_relaxed);
+		});
+		star_chunks_.record(clock.getElapsedTime().asMicroseconds() / 1000.0);
+		++stagger_phase_;
+
+		// a full evaluation visits every black hole, a host drift step only the host
+		const double full = static_cast<double>(star_count()) * black_holes_.size();
+		const double work = static_cast<double>(evaluations.load()) * black_holes_.size()
+			+ (host_drift_active_ ? static_cast<double>(star_count() - evaluations.load()) : 0.0);
+		force_work_ += work;
+		force_work_full_ += full;
+		if (lod_active_ || host_drift_active_)
+			profiler_.set_counter("forces saved", static_cast<float>(100.0 * (1.0 - work / std::max(1.0, full))), "%");
+	}
+
+
+	// the leapfrog black holes are in the middle of the step themselves
+	const BlackHoles* star_black_holes() const
+	{
+		return kick_at_midstep_ && hermite_active() ? &black_holes_midstep_ : &black_holes_;
+	}
+
+	void update_stars_3d(sf::Vector2f* render_positions)
+	{
+		BasicStarKernelParams<3> params{ star_black_holes(), nullptr, nullptr, box_, render_positions,
+			config_.G, step_dt(), star_mass, config_.cosmic_speed_limit, step_damping(), black_hole_radius * black_hole_radius * 2 };
+		params.projection = camera_.projection();
+		params.projected_positions = star_positions_.data();
+		flag_absorbed_stars(params);
+
+		const BasicStarKernel<3> kernel = kick_at_midstep_ ? midstep_kernel_3d_ : star_kernel_3d_;
+		sf::Clock clock;
+		for_each_star_slice(star_count(), [this, &params, kernel](const size_t begin, const size_t end, unsigned)
+		{
+			kernel(star_positions_3d_.data(), star_velocities_3d_.data(), begin, end, params);
+		});
+		star_chunks_.record(clock.getElapsedTime().asMicroseconds() / 1000.0);
+	}
+
+
+	template<typename Precision>
+	void update_precise_stars(StarState<Precision>& stars, const StarKernelParams& params)
+	{
+		const PreciseStarKernel<Precision> kernel
+			= select_precise_star_kernel<Precision>(star_features() | (kick_at_midstep_ ? feature_midstep_kick : 0u));
+		for_each_star_slice(stars.size(), [this, &stars, &params, kernel](const size_t begin, const size_t end, unsigned)
+		{
+			kernel(stars, star_positions_.data(), begin, end, params);
+		});
+	}
+
+
+	// pinned threads always update the same contiguous slice of stars, whose pages they touched first, otherwise
+	// the chunks are handed out dynamically to balance the load
+	template<typename Func> // func(begin, end, thread_index)
+	void for_each_star_slice(const size_t count, Func&& func)
+	{
+		if (pool_.pinned())
+			pool_.parallel_for(count, func);
+		else
+			pool_.parallel_chunks(count, star_chunks_.chunk(), func);
+	}
+
+
+	// the number of stars left, shrinks as they are accreted
+	size_t star_count() const
+	{
+		return star_positions_.size();
+	}
+
+
+	// with accretion the capturing kernels flag stars for removal instead of boosting them
+	template<typename Params>
+	void flag_absorbed_stars(Params& params)
+	{
+		if (!config_.accretion || !config_.capture_stars)
+			return;
+
+		params.absorbed = star_pool_.removal_flags(star_count());
+		params.absorbed_count = star_pool_.removal_counter();
+	}
+
+
+	// one star pool batch: the flagged stars go to their nearest black hole, star_inflow new stars take over their
+	// slots or are appended, and whatever slots are still empty are compacted away
+	void update_star_pool()
+	{
+		const size_t count = star_count();
+		const std::vector<size_t>& removed = star_pool_.begin_batch(count);
+		for (const size_t i : removed)
+			absorb_star(i);
+		stars_absorbed_ += removed.size();
+		if (!removed.empty())
+			acceleration_field_.invalidate(); // the masses changed
+
+		inflow_carry_ += std::max(0.f, config_.star_inflow);
+		const auto requested = static_cast<size_t>(inflow_carry_);
+		inflow_carry_ -= static_cast<float>(requested);
+
+		const size_t length = star_pool_.insert(requested);
+		resize_stars(count, length);
+		const Projection projection = camera_.projection();
+		std::uniform_int_distribution<size_t> parent(0, black_holes_.size() - 1);
+		for (const size_t i : star_pool_.slots())
+			form_star(i, parent(rng), projection);
+		stars_formed_ += star_pool_.slots().size();
+		if (!star_pool_.slots().empty())
+			written_positions_stale_ = true;
+
+		if (star_pool_.compact())
+		{
+			compact_stars(length);
+			written_positions_stale_ = true;
+		}
+		star_pool_.end_batch();
+
+		profiler_.set_counter("stars", static_cast<float>(star_count()));
+		profiler_.set_counter("absorbed", static_cast<float>(stars_absorbed_));
+		profiler_.set_counter("formed", static_cast<float>(stars_formed_));
+	}
+
+
+	void absorb_star(const size_t i)
+	{
+		if (three_d_)
+			absorb<3>(star_positions_3d_[i], star_velocities_3d_[i]);
+		else if (auto* stars = std::get_if<StarState<DoublePrecision>>(&precise_stars_))
+			absorb<2>(sf::Vector2f(stars->position(i)), sf::Vector2f(stars->velocities[i]));
+		else if (auto* stars = std::get_if<StarState<MixedPrecision>>(&precise_stars_))
+			absorb<2>(sf::Vector2f(stars->position(i)), sf::Vector2f(stars->velocities[i]));
+		else
+			absorb<2>(star_positions_[i], star_velocities_[i]);
+	}
+
+
+	// a new star in slot i, on an orbit around parent like the initial ones, with fresh LOD and host drift state
+	void form_star(const size_t i, const size_t parent, const Projection& projection)
+	{
+		if (three_d_)
+			spawn_star_3d(i, parent, projection);
+		else
+			spawn_star(i, parent);
+
+		std::visit([this, i](auto& stars)
+		{
+			if constexpr (!std::is_same_v<std::decay_t<decltype(stars)>, std::monostate>)
+			{
+				using Accumulator = typename std::decay_t<decltype(stars)>::Accumulator;
+				using Storage = typename std::decay_t<decltype(stars)>::Storage;
+				stars.set_position(i, sf::Vector2<Accumulator>(star_positions_[i]));
+				stars.velocities[i] = sf::Vector2<Storage>(star_velocities_[i]);
+			}
+		}, precise_stars_);
+
+		if (i < star_accelerations_.size())
+			star_accelerations_[i] = stale_acceleration;
+		if (i < star_hosts_.size())
+			star_hosts_[i] = no_host;
+	}
+
+
+	// grows every per-star array from count to length stars, within the reserved capacity
+	void resize_stars(const size_t count, const size_t length)
+	{
+		if (length == count)
+			return;
+
+		star_pool_.resize(star_positions_, length);
+		star_pool_.resize(star_velocities_, length);
+		if (star_accelerations_.size() == count)
+			star_pool_.resize(star_accelerations_, length, stale_acceleration);
+		if (star_hosts_.size() == count)
+		{
+			star_pool_.resize(star_hosts_, length, no_host);
+			star_pool_.resize(star_perturbations_, length);
+		}
+		if (three_d_)
+		{
+			star_pool_.resize(star_positions_3d_, length);
+			star_pool_.resize(star_velocities_3d_, length);
+		}
+		std::visit([length](auto& stars)
+		{
+			if constexpr (!std::is_same_v<std::decay_t<decltype(stars)>, std::monostate>)
+				stars.resize(length);
+		}, precise_stars_);
+	}
+
+
+	// drops the slots the pool left empty from every per-star array, the kept stars stay in order
+	void compact_stars(const size_t length)
+	{
+		star_pool_.apply(star_positions_);
+		star_pool_.apply(star_velocities_);
+		if (star_accelerations_.size() == length)
+			star_pool_.apply(star_accelerations_);
+		if (star_hosts_.size() == length)
+		{
+			star_pool_.apply(star_hosts_);
+			star_pool_.apply(star_perturbations_);
+		}
+		if (three_d_)
+		{
+			star_pool_.apply(star_positions_3d_);
+			star_pool_.apply(star_velocities_3d_);
+		}
+		std::visit([this](auto& stars)
+		{
+			if constexpr (!std::is_same_v<std::decay_t<decltype(stars)>, std::monostate>)
+			{
+				star_pool_.apply(stars.positions);
+				star_pool_.apply(stars.velocities);
+				if (!stars.cells.empty())
+					star_pool_.apply(stars.cells);
+			}
+		}, precise_stars_);
+	}
+
+
+	// the nearest black hole takes the star's momentum and grows by accreted_mass, which is also the mass the star
+	// brings in (star_mass only scales the pull stars feel)
+	template<unsigned Dimensions>
+	void absorb(const typename Space<Dimensions>::Vector& position, const typename Space<Dimensions>::Vector& velocity)
+	{
+		size_t nearest = 0;
+		float nearest_distance_sq = std::numeric_limits<float>::max();
+		for (size_t b = 0; b < black_holes_.size(); ++b)
+		{
+			const float distance_sq = toroidal_distance_sq(position, black_holes_.position_in<Dimensions>(b), space_bounds<Dimensions>());
+			if (distance_sq < nearest_distance_sq)
+			{
+				nearest = b;
+				nearest_distance_sq = distance_sq;
+			}
+		}
+
+		const float mass = black_holes_.mass[nearest];
+		const typename Space<Dimensions>::Vector host_velocity = black_holes_.velocity_in<Dimensions>(nearest);
+		black_holes_.set_velocity(nearest, host_velocity + (velocity - host_velocity) * (config_.accreted_mass / (mass + config_.accreted_mass)));
+		black_holes_.mass[nearest] = mass + config_.accreted_mass;
+	}
+
+
+	float max_black_hole_speed() const
+	{
+		float max_speed_sq = 0.f;
+		for (size_t i = 0; i < black_holes_.size(); ++i)
+			max_speed_sq = std::max(max_speed_sq, black_holes_.vx[i] * black_holes_.vx[i] + black_holes_.vy[i] * black_holes_.vy[i]);
+		return std::sqrt(max_speed_sq);
+	}
+
+
+	// runs validation_steps steps with the full update and again from the same state with the approximations
+	// switched on in the config (temporal LOD if none is). the black holes do not feel the stars and every star
+	// is independent, so the difference is entirely the approximation error. accretion and inflow would change
+	// the stars and their order between the runs, both are off. the simulation is left in its starting state
+	void validate_approximations()
+	{
+		const StarArray<sf::Vector2f> start_positions = star_positions_;
+		const StarArray<sf::Vector2f> start_velocities = star_velocities_;
+		const BlackHoles start_black_holes = black_holes_;
+		const Config settings = config_;
+		const bool lod_setting = config_.temporal_lod;
+		const bool host_drift_setting = config_.host_drift;
+		const bool validate_lod = lod_setting || !host_drift_setting;
+
+		config_.accretion = false;
+		config_.star_inflow = 0.f;
+
+		auto run_steps = [&](const bool approximate)
+		{
+			star_positions_ = start_positions;
+			star_velocities_ = start_velocities;
+			black_holes_ = start_black_holes;
+			star_pool_.reset(start_positions.size());
+			hermite_.reset();
+			timestep_.reset(settings.dt);
+			simulated_time_ = 0.0;
+			stagger_phase_ = 0;
+			force_work_ = force_work_full_ = 0;
+
+			config_.temporal_lod = approximate && validate_lod;
+			config_.host_drift = approximate && host_drift_setting;
+			lod_active_ = host_drift_active_ = false;
+			select_kernel();
+
+			sf::Clock clock;
+			for (unsigned s = 0; s < config_.validation_steps; ++s)
+			{
+				step();
+				end_frame();
+			}
+			return clock.getElapsedTime().asSeconds();
+		};
+
+		const float full_seconds = run_steps(false);
+		const StarArray<sf::Vector2f> reference = star_positions_;
+		const float approximate_seconds = run_steps(true);
+
+		// errors relative to how far the stars actually moved. the tail is dominated by the few chaotic stars
+		// passing through capture zones, the median shows the typical star
+		std::vector<float> errors(reference.size());
+		double error_sq_sum = 0, travelled_sum = 0;
+		for (size_t i = 0; i < reference.size(); ++i)
+		{
+			errors[i] = toroidal_distance(reference[i], star_positions_[i], bounds_);
+			error_sq_sum += static_cast<double>(errors[i]) * errors[i];
+			travelled_sum += toroidal_distance(start_positions[i], reference[i], bounds_);
+		}
+		std::sort(errors.begin(), errors.end());
+		auto percentile = [&errors](const double p) { return errors.empty() ? 0.f : errors[static_cast<size_t>(p * (errors.size() - 1))]; };
+
+		const double count = static_cast<double>(std::max<size_t>(1, reference.size()));
+		const double rms_error = std::sqrt(error_sq_sum / count);
+		const double mean_travelled = travelled_sum / count;
+
+		std::cout << "validation over " << config_.validation_steps << " steps of";
+		if (validate_lod)
+			std::cout << " temporal LOD (interval " << config_.lod_interval << ", error bound " << config_.lod_error << ")";
+		if (host_drift_setting)
+			std::cout << " host drift (refresh " << config_.host_drift_refresh << ", threshold " << config_.host_drift_threshold << ")";
+		std::cout << "\n"
+			<< "  position error: median " << percentile(0.5) << ", p99 " << percentile(0.99) << ", max " << percentile(1.0)
+			<< ", rms " << rms_error << " (mean distance travelled " << mean_travelled
+			<< ", rms / travelled " << (mean_travelled > 0 ? rms_error / mean_travelled : 0.0) << ")\n"
+			<< "  star - black hole forces saved: " << 100.0 * (1.0 - force_work_ / std::max(1.0, force_work_full_)) << "%\n"
+			<< "  time: full " << full_seconds << "s, approximate " << approximate_seconds << "s\n";
+
+		star_positions_ = start_positions;
+		star_velocities_ = start_velocities;
+		black_holes_ = start_black_holes;
+		star_pool_.reset(start_positions.size());
+		config_ = settings;
+		timestep_.reset(config_.dt);
+		simulated_time_ = 0.0;
+		lod_active_ = host_drift_active_ = false;
+		select_kernel();
+	}
+
+
+	// star accelerations from the acceleration field (bilinear and bicubic) and the tree against the direct sum
+	// over every black hole on a sample of stars, then the star update throughput of each method
+	void benchmark_acceleration_field()
+	{
+		const float pull_scale = config_.G * star_mass;
+		constexpr float capture_radius_sq = black_hole_radius * black_hole_radius * 2;
+
+		sf::Clock build_clock;
+		acceleration_field_.update(black_holes_, 0.f, arenas_.frame());
+		const float build_ms = build_clock.getElapsedTime().asMicroseconds() / 1000.f;
+		black_hole_tree_.build(black_holes_);
+
+		std::cout << "acceleration field benchmark, " << black_holes_.size() << " black holes, " << star_positions_.size() << " stars\n"
+			<< "  field: " << acceleration_field_.node_count() << " nodes, cutoff " << field_cutoff << ", built in " << build_ms << "ms\n";
+
+		// accuracy, black holes inside a capture zone are skipped by every method
+		const size_t samples = std::min<size_t>(star_positions_.size(), 20'000);
+		const size_t stride = std::max<size_t>(1, star_positions_.size() / std::max<size_t>(1, samples));
+		std::array<std::vector<float>, 3> errors; // bilinear, bicubic, tree
+		for (size_t s = 0; s < samples; ++s)
+		{
+			const sf::Vector2f position = star_positions_[s * stride];
+
+			sf::Vector2f exact{};
+			for (size_t b = 0; b < black_holes_.size(); ++b)
+			{
+				const sf::Vector2f direction = toroidal_direction(position, black_holes_.position(b), bounds_);
+				const float distance_sq = direction.x * direction.x + direction.y * direction.y;
+				if (distance_sq >= capture_radius_sq)
+					exact += direction * (pull_scale * black_holes_.mass[b] / distance_sq);
+			}
+			const float exact_length = std::max(std::sqrt(exact.x * exact.x + exact.y * exact.y), 1e-20f);
+
+			unsigned captures = 0;
+			sf::Vector2f tree{};
+			black_hole_tree_.gravitate(position, tree, star_mass, config_.G, capture_radius_sq, 1.f);
+			const std::array<sf::Vector2f, 3> approximations = {
+				acceleration_field_.acceleration(position, black_holes_, pull_scale, capture_radius_sq, true, false, captures),
+				acceleration_field_.acceleration(position, black_holes_, pull_scale, capture_radius_sq, true, true, captures),
+				tree
+			};
+			for (size_t m = 0; m < approximations.size(); ++m)
+			{
+				const sf::Vector2f error = approximations[m] - exact;
+				errors[m].push_back(std::sqrt(error.x * error.x + error.y * error.y) / exact_length);
+			}
+		}
+
+		const std::array<const char*, 3> names = { "field bilinear", "field bicubic", "tree" };
+		std::cout << "  relative acceleration error over " << samples << " stars:\n";
+		for (size_t m = 0; m < errors.size(); ++m)
+		{
+			std::sort(errors[m].begin(), errors[m].end());
+			auto percentile = [&](const double p) { return errors[m].empty() ? 0.f : errors[m][static_cast<size_t>(p * (errors[m].size() - 1))]; };
+			std::cout << "    " << names[m] << ": median " << percentile(0.5) << ", p99 " << percentile(0.99) << ", max " << percentile(1.0) << "\n";
+		}
+
+		// throughput on copies of the stars, the black holes stay put
+		const unsigned features = star_features() & ~feature_temporal_lod;
+		auto time_kernel = [&](const StarKernel kernel, const bool bicubic)
+		{
+			StarArray<sf::Vector2f> positions = star_positions_;
+			StarArray<sf::Vector2f> velocities = star_velocities_;
+			StarKernelParams params{ &black_holes_, &black_hole_tree_, &acceleration_field_, bounds_, nullptr,
+				config_.G, config_.dt, star_mass, config_.cosmic_speed_limit, config_.damping, capture_radius_sq };
+			params.bicubic_field = bicubic;
+
+			sf::Clock clock;
+			for (unsigned s = 0; s < benchmark_steps; ++s)
+			{
+				pool_.parallel_chunks(positions.size(), star_chunks_.chunk(), [&](const size_t begin, const size_t end, unsigned)
+				{
+					kernel(positions.data(), velocities.data(), begin, end, params);
+				});
+			}
+			return clock.getElapsedTime().asMicroseconds() / 1000.0 / benchmark_steps;
+		};
+
+		const std::array<std::pair<const char*, double>, 4> timings = { {
+			{ "direct", time_kernel(select_star_kernel(black_holes_.size(), false, features), false) },
+			{ "tree", time_kernel(select_star_kernel(black_holes_.size(), true, features), false) },
+			{ "field bilinear", time_kernel(select_star_kernel(black_holes_.size(), false, features, true), false) },
+			{ "field bicubic", time_kernel(select_star_kernel(black_holes_.size(), false, features, true), true) },
+		} };
+		std::cout << "  star step over " << benchmark_steps << " steps:\n";
+		for (const auto& [name, ms] : timings)
+			std::cout << "    " << name << ": " << ms << "ms (" << star_positions_.size() / std::max(ms, 1e-6) / 1000.0 << " M stars/s)\n";
+	}
+
+
+	// precision_steps steps of every star precision from the same state, with the black holes held still and
+	// without capture, damping and the speed limit, so each star's energy is conserved up to the integrator.
+	// reports the cost, the energy drift relative to the star's starting kinetic energy and how far the stars end
+	// up from the double precision run. the integrator's own error is the same in every row, the differences
+	// between the rows are rounding
+	void benchmark_precision()
+	{
+		constexpr float capture_radius_sq = black_hole_radius * black_hole_radius * 2;
+		const StarKernelParams params{ &black_holes_, &black_hole_tree_, &acceleration_field_, bounds_, nullptr,
+			config_.G, config_.dt, star_mass, config_.cosmic_speed_limit, config_.damping, capture_radius_sq };
+		const sf::Rect<double> bounds(bounds_);
+		const double pull_scale = static_cast<double>(config_.G) * star_mass;
+		const size_t count = star_positions_.size();
+
+		std::vector<double> start_energy(count), start_kinetic(count);
+		pool_.parallel_for(count, [&](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				const sf::Vector2<double> velocity(star_velocities_[i]);
+				start_energy[i] = star_energy(sf::Vector2<double>(star_positions_[i]), velocity, black_holes_, bounds, pull_scale, capture_radius_sq);
+				start_kinetic[i] = std::max(0.5 * (velocity.x * velocity.x + velocity.y * velocity.y), 1e-12);
+			}
+		});
+
+		struct Result
+		{
+			const char* name;
+			size_t bytes_per_star;
+			double ms_per_step;
+			std::vector<sf::Vector2<double>> positions;
+			std::vector<double> drift;
+		};
+
+		std::vector<sf::Vector2f> mirror(count);
+		auto run_steps = [&]<typename Precision>(Precision)
+		{
+			StarState<Precision> stars(star_positions_, star_velocities_, bounds_, precision_cell_size);
+			const PreciseStarKernel<Precision> kernel = select_precise_star_kernel<Precision>(0);
+
+			sf::Clock clock;
+			for (unsigned s = 0; s < config_.precision_steps; ++s)
+			{
+				pool_.parallel_chunks(count, star_chunks_.chunk(), [&](const size_t begin, const size_t end, unsigned)
+				{
+					kernel(stars, mirror.data(), begin, end, params);
+				});
+			}
+
+			Result result{ Precision::name, stars.bytes_per_star(),
+				clock.getElapsedTime().asMicroseconds() / 1000.0 / std::max(1u, config_.precision_steps),
+				std::vector<sf::Vector2<double>>(count), std::vector<double>(count) };
+			pool_.parallel_for(count, [&](const size_t begin, const size_t end, unsigned)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					result.positions[i] = sf::Vector2<double>(stars.position(i));
+					const double energy = star_energy(result.positions[i], sf::Vector2<double>(stars.velocities[i]), black_holes_, bounds, pull_scale, capture_radius_sq);
+					result.drift[i] = std::abs(energy - start_energy[i]) / start_kinetic[i];
+				}
+			});
+			return result;
+		};
+
+		std::array<Result, 3> results = { run_steps(SinglePrecision{}), run_steps(DoublePrecision{}), run_steps(MixedPrecision{}) };
+		const std::vector<sf::Vector2<double>>& reference = results[1].positions;
+
+		auto percentile = [](std::vector<double>& values, const double p)
+		{
+			if (values.empty())
+				return 0.0;
+			const auto nth = values.begin() + static_cast<ptrdiff_t>(p * (values.size() - 1));
+			std::nth_element(values.begin(), nth, values.end());
+			return *nth;
+		};
+
+		std::cout << "precision benchmark, " << count << " stars, " << black_holes_.size() << " black holes held still, "
+			<< config_.precision_steps << " steps\n";
+		for (Result& result : results)
+		{
+			std::vector<double> divergence(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const sf::Vector2<double> direction = toroidal_direction(reference[i], result.positions[i], bounds);
+				divergence[i] = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+			}
+
+			std::cout << "  " << result.name << ": " << result.bytes_per_star << " bytes/star, " << result.ms_per_step << "ms/step ("
+				<< count / std::max(result.ms_per_step, 1e-6) / 1000.0 << " M stars/s)\n"
+				<< "    energy drift / kinetic energy: median " << percentile(result.drift, 0.5) << ", p99 " << percentile(result.drift, 0.99)
+				<< ", max " << percentile(result.drift, 1.0) << "\n"
+				<< "    distance from double: median " << percentile(divergence, 0.5) << ", p99 " << percentile(divergence, 0.99)
+				<< ", max " << percentile(divergence, 1.0) << "\n";
+		}
+	}
+
+
+	// the star step on copies of the stars whose pages were first touched by this thread (as every array was
+	// before) and by the pool threads in their parallel_for slices, each timed over benchmark_steps steps with
+	// static slices. reports where every thread's slice lives and the bandwidth each node's threads reach
+	void benchmark_numa()
+	{
+		const size_t count = star_positions_.size();
+		const unsigned threads = pool_.size();
+		constexpr size_t bytes_per_star = 4 * sizeof(sf::Vector2f); // position and velocity, read and written
+
+		std::cout << "numa benchmark, " << count << " stars, " << numa_.nodes.size() << " nodes, " << threads
+			<< " threads, affinity " << config_.thread_affinity << "\n";
+		if (!pool_.pinned())
+			std::cout << "  the threads are not pinned (thread_affinity = compact or scatter), their node is a guess of the scheduler\n";
+
+		std::vector<int> thread_nodes(threads);
+		for (unsigned t = 0; t < threads; ++t)
+		{
+			thread_nodes[t] = numa_.node_of_cpu(pool_.cpu(t));
+			if (pool_.pinned())
+				std::cout << "  thread " << t << ": cpu " << pool_.cpu(t) << ", node " << thread_nodes[t] << "\n";
+		}
+
+		if (use_black_hole_tree_)
+			black_hole_tree_.build(black_holes_);
+		const StarKernel kernel = select_star_kernel(black_holes_.size(), use_black_hole_tree_, star_features() & ~feature_temporal_lod);
+		const StarKernelParams params{ &black_holes_, &black_hole_tree_, nullptr, bounds_, nullptr,
+			config_.G, config_.dt, star_mass, config_.cosmic_speed_limit, config_.damping, black_hole_radius * black_hole_radius * 2 };
+
+		// both placements are made before either is freed, so neither reuses pages the other touched
+		auto place = [&](StarArray<sf::Vector2f>& copy, const StarArray<sf::Vector2f>& stars, const bool by_workers)
+		{
+			resize_uninitialized(copy, count);
+			if (by_workers)
+				first_touch(pool_, copy.data(), count, sizeof(sf::Vector2f));
+			std::copy(stars.begin(), stars.end(), copy.begin());
+		};
+		std::array<StarArray<sf::Vector2f>, 2> positions{ StarArray<sf::Vector2f>(star_positions_.get_allocator()), StarArray<sf::Vector2f>(star_positions_.get_allocator()) };
+		std::array<StarArray<sf::Vector2f>, 2> velocities = positions;
+		for (size_t p = 0; p < positions.size(); ++p)
+		{
+			place(positions[p], star_positions_, p == 1);
+			place(velocities[p], star_velocities_, p == 1);
+		}
+
+		const std::array<const char*, 2> names = { "main thread first touch", "worker first touch" };
+		const size_t page = page_size();
+		for (size_t p = 0; p < positions.size(); ++p)
+		{
+			// the share of each slice's pages on its thread's node, -1 when the OS does not tell
+			size_t local = 0, known = 0;
+			for (unsigned t = 0; t < threads; ++t)
+			{
+				const auto [begin, end] = pool_.slice(count, t);
+				const std::byte* first = reinterpret_cast<const std::byte*>(positions[p].data() + begin);
+				const std::byte* last = reinterpret_cast<const std::byte*>(positions[p].data() + end);
+				for (const std::byte* address = first; address < last; address += page)
+				{
+					const int node = page_node(address);
+					known += node >= 0;
+					local += node >= 0 && node == thread_nodes[t];
+				}
+			}
+
+			pool_.take_stats();
+			sf::Clock clock;
+			for (unsigned s = 0; s < benchmark_steps; ++s)
+			{
+				pool_.parallel_for(count, [&](const size_t begin, const size_t end, unsigned)
+				{
+					kernel(positions[p].data(), velocities[p].data(), begin, end, params);
+				});
+			}
+			const double seconds = clock.getElapsedTime().asMicroseconds() / 1e6;
+			const std::vector<ThreadPool::WorkerStats> stats = pool_.take_stats();
+
+			std::cout << "  " << names[p] << ": " << seconds * 1000.0 / benchmark_steps << "ms/step, "
+				<< count * bytes_per_star * benchmark_steps / std::max(seconds, 1e-9) / 1e9 << " GB/s";
+			if (known > 0)
+				std::cout << ", " << 100.0 * local / known << "% of the pages on their thread's node";
+			std::cout << "\n";
+
+			for (size_t node = 0; node < numa_.nodes.size() && pool_.pinned(); ++node)
+			{
+				size_t stars = 0;
+				double busy_ms = 0.0;
+				for (unsigned t = 0; t < threads; ++t)
+				{
+					if (thread_nodes[t] != static_cast<int>(node))
+						continue;
+					const auto [begin, end] = pool_.slice(count, t);
+					stars += end - begin;
+					busy_ms = std::max(busy_ms, stats[t].busy_ms);
+				}
+				if (stars > 0)
+					std::cout << "    node " << node << ": " << stars * bytes_per_star * benchmark_steps / std::max(busy_ms, 1e-6) / 1e6
+						<< " GB/s over " << stars << " stars\n";
+			}
+		}
+	}
+
+
+	// what the star arrays were actually mapped with, a request the system could not meet has fallen back
+	void print_huge_pages() const
+	{
+		std::cout << "huge pages: " << huge_pages_name(huge_pages_) << " requested, mapped";
+		for (const HugePages mode : { HugePages::explicit_1g, HugePages::explicit_2m, HugePages::transparent, HugePages::none })
+			std::cout << " " << huge_pages_name(mode) << " " << huge_page_counters[mode] / (1024 * 1024) << " MiB";
+		std::cout << " (arrays below 1 MiB are left on normal pages)\n";
+	}
+
+
+	// the star step on copies of the stars backed by every kind of page, each first touched by the pool threads and
+	// timed over benchmark_steps steps with static slices. counts the dTLB load misses where the kernel allows it
+	void benchmark_huge_pages()
+	{
+		const size_t count = star_positions_.size();
+		TlbMissCounter tlb_misses(pool_);
+		std::cout << "huge page benchmark, " << count << " stars, " << 2 * count * sizeof(sf::Vector2f) / (1024 * 1024) << " MiB of positions and velocities\n";
+		if (!tlb_misses.available())
+			std::cout << "  dTLB counters unavailable (no PMU for this process, or perf_event_paranoid too high)\n";
+
+		if (use_black_hole_tree_)
+			black_hole_tree_.build(black_holes_);
+		const StarKernel kernel = select_star_kernel(black_holes_.size(), use_black_hole_tree_, star_features() & ~feature_temporal_lod);
+		const StarKernelParams params{ &black_holes_, &black_hole_tree_, nullptr, bounds_, nullptr,
+			config_.G, config_.dt, star_mass, config_.cosmic_speed_limit, config_.damping, black_hole_radius * black_hole_radius * 2 };
+
+		double baseline_ms = 0.0, baseline_misses = 0.0;
+		for (const HugePages mode : { HugePages::none, HugePages::transparent, HugePages::explicit_2m, HugePages::explicit_1g })
+		{
+			std::array<size_t, 4> mapped_before{};
+			for (size_t kind = 0; kind < mapped_before.size(); ++kind)
+				mapped_before[kind] = huge_page_counters[static_cast<HugePages>(kind)];
+
+			StarArray<sf::Vector2f> positions{ StarAllocator<sf::Vector2f>(mode) };
+			StarArray<sf::Vector2f> velocities{ StarAllocator<sf::Vector2f>(mode) };
+			for (auto [copy, stars] : { std::pair{ &positions, &star_positions_ }, std::pair{ &velocities, &star_velocities_ } })
+			{
+				resize_uninitialized(*copy, count);
+				first_touch(pool_, copy->data(), count, sizeof(sf::Vector2f));
+				std::copy(stars->begin(), stars->end(), copy->begin());
+			}
+
+			std::string backing = "normal pages";
+			for (const HugePages kind : { HugePages::explicit_1g, HugePages::explicit_2m, HugePages::transparent })
+			{
+				if (huge_page_counters[kind] == mapped_before[static_cast<size_t>(kind)])
+					continue;
+				backing = kind == HugePages::transparent ? "transparent" : std::string(huge_pages_name(kind)) + " pages";
+				break;
+			}
+			const long long transparent = transparent_huge_bytes(positions.data());
+			if (backing == "transparent" && transparent >= 0)
+				backing += ", " + std::to_string(transparent / (1024 * 1024)) + " MiB of positions on huge pages";
+
+			tlb_misses.start();
+			sf::Clock clock;
+			for (unsigned s = 0; s < benchmark_steps; ++s)
+			{
+				pool_.parallel_for(count, [&](const size_t begin, const size_t end, unsigned)
+				{
+					kernel(positions.data(), velocities.data(), begin, end, params);
+				});
+			}
+			const double ms = clock.getElapsedTime().asMicroseconds() / 1000.0 / benchmark_steps;
+			const double misses = static_cast<double>(tlb_misses.stop()) / benchmark_steps;
+			if (mode == HugePages::none)
+			{
+				baseline_ms = ms;
+				baseline_misses = misses;
+			}
+
+			std::cout << "  " << huge_pages_name(mode) << " (" << backing << "): " << ms << "ms/step (" << baseline_ms / std::max(ms, 1e-9) << "x)";
+			if (tlb_misses.available())
+				std::cout << ", " << misses << " dTLB misses/step (" << misses / std::max(baseline_misses, 1.0) << "x)";
+			std::cout << "\n";
+		}
+	}
+
+
+	// the same stretch of simulated time, validation_steps * dt, with the fixed dt, with the adaptive step and with
+	// dt / timestep_reference_divisions as the reference. capture and damping act per step rather than per unit of
+	// time, both are off so that every run integrates the same equations. reports the steps each run took and its
+	// black hole and star position errors against the reference. the simulation is left in its starting state
+	void benchmark_timestep()
+	{
+		if (three_d_ || precise_stars_.index() != 0 || shards_)
+		{
+			std::cout << "the timestep benchmark uses the 2D float star update, set dimensions = 2, star_precision = float and shard_workers = 0\n";
+			return;
+		}
+
+		const StarArray<sf::Vector2f> start_positions = star_positions_;
+		const StarArray<sf::Vector2f> start_velocities = star_velocities_;
+		const BlackHoles start_black_holes = black_holes_;
+		const Config settings = config_;
+		const double duration = static_cast<double>(config_.validation_steps) * config_.dt;
+
+		config_.capture_stars = config_.damp_stars = config_.accretion = false;
+		config_.temporal_lod = config_.host_drift = false;
+		config_.star_inflow = 0.f;
+		lod_active_ = host_drift_active_ = false;
+		select_kernel();
+
+		struct Run
+		{
+			unsigned steps = 0;
+			float seconds = 0.f;
+			float smallest_dt = std::numeric_limits<float>::max();
+			float largest_dt = 0.f;
+			StarArray<sf::Vector2f> positions;
+			BlackHoles black_holes;
+		};
+
+		// a fixed step takes a whole number of steps, the adaptive one cuts its last step to end on time
+		auto run = [&](const bool adaptive, const float dt)
+		{
+			star_positions_ = start_positions;
+			star_velocities_ = start_velocities;
+			black_holes_ = start_black_holes;
+			star_pool_.reset(start_positions.size());
+			hermite_.reset();
+			config_.adaptive_dt = adaptive;
+			config_.dt = dt;
+			timestep_.reset(dt);
+			simulated_time_ = 0.0;
+
+			Run result;
+			const auto fixed_steps = static_cast<unsigned>(std::lround(duration / dt));
+			sf::Clock clock;
+			while (adaptive ? duration - simulated_time_ > 1e-6 * duration : result.steps < fixed_steps)
+			{
+				if (adaptive)
+					timestep_.limit(static_cast<float>(duration - simulated_time_));
+				result.smallest_dt = std::min(result.smallest_dt, step_dt());
+				result.largest_dt = std::max(result.largest_dt, step_dt());
+				step();
+				end_frame();
+				++result.steps;
+			}
+			result.seconds = clock.getElapsedTime().asSeconds();
+			result.positions = star_positions_;
+			result.black_holes = black_holes_;
+			return result;
+		};
+
+		const Run reference = run(false, settings.dt / timestep_reference_divisions);
+		std::cout << "timestep benchmark over " << duration << " time units, " << start_positions.size() << " stars, "
+			<< start_black_holes.size() << " black holes\n"
+			<< "  reference dt " << reference.largest_dt << ": " << reference.steps << " steps, " << reference.seconds << "s\n";
+
+		auto report = [&](const char* name, const Run& tested)
+		{
+			double black_hole_error_sq = 0;
+			float black_hole_error_max = 0.f;
+			for (size_t b = 0; b < tested.black_holes.size(); ++b)
+			{
+				const float error = toroidal_distance(tested.black_holes.position(b), reference.black_holes.position(b), bounds_);
+				black_hole_error_sq += static_cast<double>(error) * error;
+				black_hole_error_max = std::max(black_hole_error_max, error);
+			}
+
+			std::vector<float> errors(reference.positions.size());
+			for (size_t i = 0; i < errors.size(); ++i)
+				errors[i] = toroidal_distance(tested.positions[i], reference.positions[i], bounds_);
+			std::sort(errors.begin(), errors.end());
+			auto percentile = [&errors](const double p) { return errors.empty() ? 0.f : errors[static_cast<size_t>(p * (errors.size() - 1))]; };
+
+			std::cout << "  " << name << ": " << tested.steps << " steps (dt " << tested.smallest_dt << " - " << tested.largest_dt << "), "
+				<< tested.seconds << "s, black hole error rms " << std::sqrt(black_hole_error_sq / std::max<size_t>(1, tested.black_holes.size()))
+				<< " max " << black_hole_error_max << ", star error median " << percentile(0.5) << " p99 " << percentile(0.99) << "\n";
+		};
+		report("fixed", run(false, settings.dt));
+		report("adaptive", run(true, settings.dt));
+
+		star_positions_ = start_positions;
+		star_velocities_ = start_velocities;
+		black_holes_ = start_black_holes;
+		star_pool_.reset(start_positions.size());
+		config_ = settings;
+		timestep_.reset(config_.dt);
+		simulated_time_ = 0.0;
+		lod_active_ = host_drift_active_ = false;
+		select_kernel();
+	}
+
+
+	// an eccentric pair of black holes moved by the Euler and by the Hermite update at dt and 4 * dt, over
+	// black_hole_benchmark_time each. reports the largest energy error on the way relative to the starting kinetic
+	// energy, each update against its own force law
+	void benchmark_black_holes()
+	{
+		if (use_black_hole_tree_)
+		{
+			std::cout << "the black hole benchmark compares the direct updates, at most " << black_hole_tree_threshold << " black holes\n";
+			return;
+		}
+
+		const BlackHoles start_black_holes = black_holes_;
+		const Config settings = config_;
+		config_.adaptive_dt = false;
+
+		// the pull is G / 5 * m_i * m_j / r, so the circular relative speed is the same at every separation. the
+		// pair starts at apocentre with 0.6 of it, pericentre stays at 0.4 of the separation. near the origin,
+		// where the float positions keep the most digits
+		const float grav_const = config_.G / 5;
+		const float separation = 20 * black_hole_softening;
+		const float speed = 0.6f * std::sqrt(2 * grav_const * bh_mass * bh_mass) / 2;
+		BlackHoles pair;
+		pair.resize(2);
+		for (size_t i = 0; i < pair.size(); ++i)
+		{
+			const float side = i == 0 ? -1.f : 1.f;
+			pair.set_position(i, sf::Vector2f(bounds_.left + separation * (2 + side / 2), bounds_.top + 2 * separation));
+			pair.set_velocity(i, sf::Vector2f(0.f, side * speed));
+			pair.mass[i] = bh_mass;
+		}
+		const double kinetic = speed * speed;
+
+		std::cout << "black hole benchmark: two black holes " << separation << " apart, " << black_hole_benchmark_time << " time units\n";
+		for (const float dt : { settings.dt, 4 * settings.dt })
+		{
+			for (const bool hermite : { false, true })
+			{
+				black_holes_ = pair;
+				hermite_.reset();
+				config_.hermite_black_holes = hermite;
+				config_.dt = dt;
+				timestep_.reset(dt);
+
+				const double softening_sq = hermite ? black_hole_softening * black_hole_softening : 0.0;
+				const double start_energy = black_hole_energy(black_holes_, bounds_, grav_const, softening_sq);
+				const auto steps = static_cast<unsigned>(std::lround(black_hole_benchmark_time / dt));
+				double error = 0.0;
+				size_t substeps = 0;
+				sf::Clock clock;
+				for (unsigned s = 0; s < steps; ++s)
+				{
+					update_black_holes();
+					substeps += hermite ? hermite_.substeps() : 1;
+					error = std::max(error, std::abs(black_hole_energy(black_holes_, bounds_, grav_const, softening_sq) - start_energy) / kinetic);
+				}
+				std::cout << "  dt " << dt << ", " << (hermite ? "hermite" : "euler") << ": " << steps << " steps, "
+					<< static_cast<double>(substeps) / std::max(1u, steps) << " substeps per step, " << clock.getElapsedTime().asMilliseconds()
+					<< "ms, energy error / kinetic energy " << error << "\n";
+			}
+		}
+
+		black_holes_ = start_black_holes;
+		config_ = settings;
+		hermite_.reset();
+		timestep_.reset(config_.dt);
+	}
+
+
+	// one rank of a distributed run. rank 0 starts the others with its own command line, decomposes the world
+	// and moves the black holes, every rank updates the stars of its slab. the star state changes size every
+	// step, so the per-star caches (temporal LOD, host drift) and the star pool stay off. every rank steps with
+	// the fixed dt, an adaptive step would need one more reduction over the ranks
+	void run_domains()
+	{
+		if (three_d_ || precise_stars_.index() != 0)
+		{
+			std::cout << "distributed runs use the 2D float star update, set dimensions = 2 and star_precision = float\n";
+			return;
+		}
+
+		const unsigned rank = config_.domain_rank;
+		const unsigned size = config_.domains;
+		std::vector<std::unique_ptr<ChildProcess>> ranks; // reaped after the transport has closed
+		if (rank == 0)
+		{
+			for (unsigned r = 1; r < size; ++r)
+			{
+				std::vector<std::string> args = config_.command_line();
+				args.push_back("--domain_rank=" + std::to_string(r));
+				ranks.push_back(std::make_unique<ChildProcess>(args));
+			}
+		}
+
+		// a rank that lost the others gives up. rank 0 also kills the ranks it started, a hung one would keep
+		// its ChildProcess waiting forever
+		auto abort_run = [&ranks]()
+		{
+			for (const std::unique_ptr<ChildProcess>& child : ranks)
+				child->terminate();
+		};
+
+		SocketTransport transport(config_.domain_address, rank, size, domain_timeout);
+		if (!transport.is_connected())
+		{
+			abort_run();
+			return;
+		}
+
+		config_.temporal_lod = config_.host_drift = config_.accretion = config_.adaptive_dt = false;
+		config_.star_inflow = 0.f;
+		select_kernel();
+
+		DomainDecomposition domains(transport, pool_, arenas_, bounds_, halo_width);
+		if (!domains.decompose(star_positions_, star_velocities_, black_holes_))
+		{
+			abort_run();
+			return;
+		}
+
+		DomainStats stats;
+		const size_t setup_sent = transport.bytes_sent(), setup_received = transport.bytes_received();
+		for (unsigned s = 0; s < config_.domain_steps; ++s)
+		{
+			sf::Clock clock;
+			if (config_.acceleration_field)
+				acceleration_field_.update(black_holes_, config_.field_tolerance, arenas_.frame());
+			if (use_black_hole_tree_)
+				black_hole_tree_.build(black_holes_);
+			update_stars();
+			if (rank == 0)
+				update_black_holes();
+
+			sf::Clock exchange_clock;
+			if (!domains.broadcast_black_holes(black_holes_) || !domains.migrate(star_positions_, star_velocities_)
+				|| !domains.exchange_halo(star_positions_))
+			{
+				std::cerr << "rank " << rank << ": lost the connection to the other ranks\n";
+				abort_run();
+				return;
+			}
+			stats.exchange_ms += exchange_clock.getElapsedTime().asMicroseconds() / 1000.0;
+			stats.step_ms += clock.getElapsedTime().asMicroseconds() / 1000.0;
+			stats.migrated += domains.migrated();
+			stats.ghosts += domains.ghosts().size();
+			++stats.steps;
+			end_frame();
+		}
+		stats.stars = star_count();
+		stats.bytes_sent = transport.bytes_sent() - setup_sent;
+		stats.bytes_received = transport.bytes_received() - setup_received;
+
+		const std::vector<DomainStats> all = domains.gather(stats);
+		if (rank != 0)
+			return;
+		if (all.empty())
+		{
+			abort_run();
+			return;
+		}
+
+		std::cout << "distributed run, " << size << " ranks over " << config_.domain_address << ", " << stats.steps << " steps, "
+			<< config_.number_of_stars << " stars, " << black_holes_.size() << " black holes\n";
+		double bytes = 0, max_stars = 0, mean_stars = 0;
+		for (unsigned r = 0; r < all.size(); ++r)
+		{
+			const DomainStats& ranked = all[r];
+			const double steps = static_cast<double>(std::max<std::uint64_t>(1, ranked.steps));
+			std::cout << "  rank " << r << ": " << ranked.stars << " stars, " << ranked.migrated / steps << " migrated and "
+				<< ranked.ghosts / steps << " ghosts received per step, " << ranked.bytes_sent / steps / 1024.0 << " KiB sent and "
+				<< ranked.bytes_received / steps / 1024.0 << " KiB received per step, " << ranked.step_ms / steps << "ms/step ("
+				<< ranked.exchange_ms / steps << "ms exchanging)\n";
+			bytes += ranked.bytes_sent / steps;
+			max_stars = std::max(max_stars, static_cast<double>(ranked.stars));
+			mean_stars += static_cast<double>(ranked.stars) / all.size();
+		}
+		std::cout << "  communication " << bytes / 1024.0 << " KiB/step over all ranks, " << bytes / std::max(1.0, mean_stars * all.size())
+			<< " bytes/star/step, load imbalance (max / mean stars) " << max_stars / std::max(1.0, mean_stars) << "\n";
+	}
+
+
+	// per-thread busy / idle time since the last call, worker 0 is the main thread
+	void print_worker_stats()
+	{
+		const std::vector<ThreadPool::WorkerStats> stats = pool_.take_stats();
+
+		std::cout << "worker stats over " << frames - stats_frame_ << " frames, star chunk size " << star_chunks_.chunk() << "\n";
+		for (size_t t = 0; t < stats.size(); ++t)
+		{
+			const double total = stats[t].busy_ms + stats[t].idle_ms;
+			std::cout << "  worker " << t << ": busy " << stats[t].busy_ms << "ms, idle " << stats[t].idle_ms << "ms ("
+				<< (total > 0 ? 100.0 * stats[t].idle_ms / total : 0.0) << "% idle), " << stats[t].chunks << " chunks\n";
+		}
+		stats_frame_ = frames;
+	}
+
+
+	void update_idle_counter()
+	{
+		// cheap running estimate for the title bar, the full table is printed with P
+		if (frames - stats_frame_ < stats_interval)
+			return;
+
+		ThreadPool::WorkerStats* stats = arenas_.frame().allocate<ThreadPool::WorkerStats>(pool_.size());
+		pool_.take_stats(stats);
+		double busy = 0, idle = 0;
+		for (unsigned t = 0; t < pool_.size(); ++t)
+		{
+			busy += stats[t].busy_ms;
+			idle += stats[t].idle_ms;
+		}
+		profiler_.set_counter("idle", busy + idle > 0 ? static_cast<float>(100.0 * idle / (busy + idle)) : 0.f, "%");
+		profiler_.set_counter("chunk", static_cast<float>(star_chunks_.chunk()));
+		stats_frame_ = frames;
+	}
+
+
+	void update_black_holes()
+	{
+		if (hermite_active())
+		{
+			integrate_black_holes();
+			black_holes_ = black_hole_trajectory_.end();
+		}
+		else if (three_d_)
+			update_black_holes_in<3>();
+		else
+			update_black_holes_in<2>();
+	}
+
+
+	bool hermite_active() const
+	{
+		return config_.hermite_black_holes && !use_black_hole_tree_;
+	}
+
+	// one step of the Hermite black holes into black_hole_trajectory_, black_holes_ stays at the start of the step
+	void integrate_black_holes()
+	{
+		constexpr float capture_radius_sq = black_hole_radius * black_hole_radius * 2;
+		const HermiteParams params{ config_.G / 5, step_dt(), capture_radius_sq, black_hole_softening * black_hole_softening,
+			config_.black_hole_eta, config_.cosmic_speed_limit / 10, max_black_hole_substeps };
+		if (three_d_)
+			hermite_.integrate<3>(black_holes_, box_, params, black_hole_trajectory_);
+		else
+			hermite_.integrate<2>(black_holes_, bounds_, params, black_hole_trajectory_);
+		profiler_.set_counter("bh substeps", static_cast<float>(hermite_.substeps()));
+	}
+
+
+	// the leapfrog black holes were drifted half the step before the kick, they drift the other half after it
+	template<unsigned Dimensions>
+	void update_black_holes_in()
+	{
+		using Vector = typename Space<Dimensions>::Vector;
+
+		// every black hole reads the same snapshot of positions, so both passes can run in parallel
+		const float dt = step_dt();
+		pool_.parallel_for(black_holes_.size(), [this, dt](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				Vector velocity = black_holes_.template velocity_in<Dimensions>(i);
+				gravitate<Dimensions>(black_holes_.template position_in<Dimensions>(i), velocity, black_holes_.mass[i],
+					config_.G / 5, dt, static_cast<unsigned>(i));
+				speed_limit(velocity, config_.cosmic_speed_limit / 10);
+				black_holes_.set_velocity(i, velocity);
+			}
+		});
+		drift_black_holes_in<Dimensions>(leapfrog_active() ? dt / 2 : dt);
+	}
+
+	void drift_black_holes(const float dt)
+	{
+		if (three_d_)
+			drift_black_holes_in<3>(dt);
+		else
+			drift_black_holes_in<2>(dt);
+	}
+
+	template<unsigned Dimensions>
+	void drift_black_holes_in(const float dt)
+	{
+		using Vector = typename Space<Dimensions>::Vector;
+		pool_.parallel_for(black_holes_.size(), [this, dt](const size_t begin, const size_t end, unsigned)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				Vector position = black_holes_.template position_in<Dimensions>(i) + black_holes_.template velocity_in<Dimensions>(i) * dt;
+				border(position, space_bounds<Dimensions>());
+				black_holes_.set_position(i, position);
+			}
+		});
+	}
+
+
+	template<unsigned Dimensions>
+	const typename Space<Dimensions>::Bounds& space_bounds() const
+	{
+		if constexpr (Dimensions == 2)
+			return bounds_;
+		else
+			return box_;
+	}
+
+
+	// where a black hole is drawn, projected in 3D
+	sf::Vector2f black_hole_view_position(const size_t i) const
+	{
+		return three_d_ ? camera_.projection()(black_holes_.position_in<3>(i)) : black_holes_.position(i);
+	}
+
+	// drawing only what is on screen pays off once zoomed in, or when there are more stars than the budget
+	bool cull_stars_for_view() const
+	{
+		return build_star_grid && (camera_.zoom() > 1.f || star_count() > star_budget_);
+	}
+
+
+	// positions to draw this frame and the weight each one stands for
+	struct VisibleStars
+	{
+		const sf::Vector2f* positions;
+		size_t count;
+		float weight;
+	};
+
+	VisibleStars visible_stars()
+	{
+		if (!cull_stars_for_view())
+			return { star_positions_.data(), star_positions_.size(), 1.f };
+
+		auto timer = profiler_.time("cull");
+		const CullResult culled = cull_stars(star_grid_, camera_.view_rect(), star_budget_, pool_, arenas_.frame(), visible_positions_);
+		profiler_.set_counter("visible", static_cast<float>(culled.count));
+		return { visible_positions_.data(), culled.count, static_cast<float>(culled.stride) };
+	}
+
+
+	void render()
+	{
+		auto timer = profiler_.time("render");
+		if (draw_ == true) 
+		{
+			window_->clear();
+			states_.transform = camera_.transform();
+
+			if (density_render_)
+				render_density();
+			else
+			{
+				{
+					auto timer = profiler_.time("upload");
+					if (cull_stars_for_view())
+					{
+						const VisibleStars visible = visible_stars();
+						star_renderer_->set_weight(visible.weight);
+						star_renderer_->upload(visible.positions, visible.count);
+					}
+					else if (star_renderer_->path() == StarRenderer::gl_persistent && !written_positions_stale_)
+					{
+						star_renderer_->set_weight(1.f);
+						star_renderer_->use_written_positions(star_count());
+					}
+					else
+					{
+						star_renderer_->set_weight(1.f);
+						star_renderer_->upload(star_positions_.data(), star_positions_.size());
+					}
+					written_positions_stale_ = false;
+				}
+				{
+					auto timer = profiler_.time("draw stars");
+					star_renderer_->draw(*window_, states_);
+					star_renderer_->finish_frame();
+				}
+			}
+
+			if (black_holes_.size() > black_hole_tree_threshold)
+				draw_black_hole_quads();
+			else
+			{
+				for (size_t i = 0; i < black_holes_.size(); ++i)
+				{
+					black_hole_renderer_.setPosition(black_hole_view_position(i) - sf::Vector2f(black_hole_radius, black_hole_radius));
+					window_->draw(black_hole_renderer_, states_);
+				}
+			}
+
+			if (capture_)
+				capture_frame();
+
+			window_->display();
+		}
+
+		// FPS management
+		const auto fps = static_cast< sf::Int32>(1.f / clock_.restart().asSeconds());
+
+		ArenaString text{ ArenaAllocator<char>(arenas_.frame()) };
+		text.reserve(title.size() + 512);
+		text.append(title).append(std::to_string(fps)).append(" fps");
+		profiler_.append_summary(text);
+		window_->setTitle(text.c_str());
+	}
+
+
+	// the frame's scratch memory is released, and the heap allocations the frame made go to the profiler
+	void end_frame()
+	{
+		const std::uint64_t heap_allocations = thread_heap_allocations + pool_.heap_allocations();
+		profiler_.set_counter("heap allocs", static_cast<float>(heap_allocations - heap_allocations_));
+		profiler_.set_counter("arena", arenas_.peak() / 1024.f, "KiB");
+		heap_allocations_ = heap_allocations;
+		arenas_.reset();
+	}
+
+
+	void render_density()
+	{
+		const VisibleStars visible = visible_stars();
+		{
+			auto timer = profiler_.time("splat");
+			density_renderer_->splat(visible.positions, visible.count, states_.transform, visible.weight);
+		}
+		{
+			auto timer = profiler_.time("tone map");
+			density_renderer_->resolve();
+		}
+		window_->draw(density_renderer_->sprite());
+	}
+
+
+	void draw_black_hole_quads()
+	{
+		black_hole_quads_.resize(black_holes_.size() * 4);
+		for (size_t i = 0; i < black_holes_.size(); ++i)
+		{
+			const sf::Vector2f p = black_hole_view_position(i);
+			sf::Vertex* quad = &black_hole_quads_[i * 4];
+			quad[0] = { p + sf::Vector2f(-black_hole_radius, -black_hole_radius), black_hole_color };
+			quad[1] = { p + sf::Vector2f(black_hole_radius, -black_hole_radius), black_hole_color };
+			quad[2] = { p + sf::Vector2f(black_hole_radius, black_hole_radius), black_hole_color };
+			quad[3] = { p + sf::Vector2f(-black_hole_radius, black_hole_radius), black_hole_color };
+		}
+		window_->draw(black_hole_quads_, states_);
+	}
+
+
+	// self is the index of the black hole being updated, so that it does not attract itself
+	template<unsigned Dimensions>
+	void gravitate(const typename Space<Dimensions>::Vector& position, typename Space<Dimensions>::Vector& velocity, const float mass,
+		const float grav_const, const float dt, const unsigned self = BlackHoleTree::no_self) const
+	{
+		using Vector = typename Space<Dimensions>::Vector;
+		constexpr float capture_radius_sq = black_hole_radius * black_hole_radius * 2;
+
+		if constexpr (Dimensions == 2)
+		{
+			if (use_black_hole_tree_)
+			{
+				sf::Vector2f velocity_change{};
+				const unsigned captures = black_hole_tree_.gravitate(position, velocity_change, mass, grav_const, capture_radius_sq, dt, self);
+				for (unsigned c = 0; c < captures; ++c)
+					velocity *= 1.01f;
+
+				velocity += velocity_change;
+				return;
+			}
+		}
+
+		for (unsigned i = 0; i < black_holes_.size(); i++)
+		{
+			if (i == self)
+				continue;
+
+			const Vector bh_position = black_holes_.template position_in<Dimensions>(i);
+			const float distance_sq = toroidal_distance_sq(position, bh_position, space_bounds<Dimensions>());
+
+			if (distance_sq < capture_radius_sq)
+			{
+				velocity *= 1.01f;
+				continue;
+			}
+
+			const float mass_product = mass * black_holes_.mass[i];
+			const float force = grav_const * (mass_product / distance_sq);
+			Vector direction = toroidal_direction(position, bh_position, space_bounds<Dimensions>());
+
+			velocity += direction * force * dt;
 		}
 	}
 };
\ No newline at end of file
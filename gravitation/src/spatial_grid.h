@@ -0,0 +1,283 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+#include "arena.h"
+#include "threading.h"
+#include "toroidal_space.h"
+
+
+// periodic uniform grid ("cell list") over the torus. rebuilt from scratch every step with a parallel counting sort,
+// the star indices (and a copy of their positions, for cache friendly queries) end up ordered by cell.
+// all queries use the same minimum-image convention as toroidal_direction
+class SpatialGrid
+{
+public:
+	struct Neighbour
+	{
+		unsigned index;
+		float distance_sq;
+
+		bool operator<(const Neighbour& other) const { return distance_sq < other.distance_sq; }
+	};
+
+private:
+	sf::FloatRect bounds_;
+	ThreadPool& pool_;
+	unsigned threads_;
+
+	int cells_x_;
+	int cells_y_;
+	float cell_width_;
+	float cell_height_;
+	float inv_cell_width_;
+	float inv_cell_height_;
+
+	std::vector<unsigned> cell_start_;        // cells + 1 entries, cell c owns [cell_start_[c], cell_start_[c + 1])
+	std::vector<unsigned> thread_offsets_;    // threads * cells histogram, turned into scatter offsets in place
+	std::vector<unsigned> star_cells_;        // cell of every star, computed once in the counting pass
+	std::vector<unsigned> sorted_indices_;
+	std::vector<sf::Vector2f> sorted_positions_;
+
+public:
+	SpatialGrid(const sf::FloatRect& bounds, const float target_cell_size, ThreadPool& pool)
+		: bounds_(bounds), pool_(pool), threads_(pool.size())
+	{
+		// the cell size is rounded so that a whole number of cells tiles the torus exactly
+		cells_x_ = std::max(1, static_cast<int>(bounds.width / target_cell_size));
+		cells_y_ = std::max(1, static_cast<int>(bounds.height / target_cell_size));
+		cell_width_ = bounds.width / static_cast<float>(cells_x_);
+		cell_height_ = bounds.height / static_cast<float>(cells_y_);
+		inv_cell_width_ = 1.f / cell_width_;
+		inv_cell_height_ = 1.f / cell_height_;
+
+		cell_start_.resize(cell_count() + 1);
+		thread_offsets_.resize(static_cast<size_t>(threads_) * cell_count());
+	}
+
+
+	// scratch holds the prefix sum's block totals, it only has to last for the call
+	template<typename PositionOf> // PositionOf: (size_t index) -> sf::Vector2f
+	void build(const size_t count, Arena& scratch, PositionOf&& position_of)
+	{
+		const size_t cells = cell_count();
+		star_cells_.resize(count);
+		sorted_indices_.resize(count);
+		sorted_positions_.resize(count);
+		std::fill(thread_offsets_.begin(), thread_offsets_.end(), 0u);
+
+		// 1. every thread histograms its own slice of the stars
+		pool_.parallel_for(count, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			unsigned* histogram = &thread_offsets_[t * cells];
+			for (size_t i = begin; i < end; ++i)
+			{
+				const unsigned cell = cell_index(position_of(i));
+				star_cells_[i] = cell;
+				++histogram[cell];
+			}
+		});
+
+		// 2. exclusive prefix sum in (cell, thread) order. blocks of cells are summed in parallel,
+		// then the block totals are scanned serially and pushed back down into each block
+		unsigned* block_totals = scratch.allocate<unsigned>(threads_ + 1);
+		std::fill_n(block_totals, threads_ + 1, 0u);
+		pool_.parallel_for(cells, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			unsigned total = 0;
+			for (size_t c = begin; c < end; ++c)
+				for (unsigned th = 0; th < threads_; ++th)
+					total += thread_offsets_[th * cells + c];
+			block_totals[t + 1] = total;
+		});
+
+		for (unsigned t = 0; t < threads_; ++t)
+			block_totals[t + 1] += block_totals[t];
+
+		pool_.parallel_for(cells, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			unsigned running = block_totals[t];
+			for (size_t c = begin; c < end; ++c)
+			{
+				cell_start_[c] = running;
+				for (unsigned th = 0; th < threads_; ++th)
+				{
+					unsigned& slot = thread_offsets_[th * cells + c];
+					const unsigned amount = slot;
+					slot = running;
+					running += amount;
+				}
+			}
+		});
+		cell_start_[cells] = static_cast<unsigned>(count);
+
+		// 3. scatter, using the same slicing as the counting pass so every thread owns its offsets
+		pool_.parallel_for(count, [&](const size_t begin, const size_t end, const unsigned t)
+		{
+			unsigned* offsets = &thread_offsets_[t * cells];
+			for (size_t i = begin; i < end; ++i)
+			{
+				const unsigned destination = offsets[star_cells_[i]]++;
+				sorted_indices_[destination] = static_cast<unsigned>(i);
+				sorted_positions_[destination] = position_of(i);
+			}
+		});
+	}
+
+
+	// calls func(index, direction, distance_sq) for every star within radius of center,
+	// direction is the toroidal vector from center to the star
+	template<typename Func>
+	void query_radius(const sf::Vector2f center, const float radius, Func&& func) const
+	{
+		const float radius_sq = radius * radius;
+		const int reach_x = static_cast<int>(std::ceil(radius * inv_cell_width_));
+		const int reach_y = static_cast<int>(std::ceil(radius * inv_cell_height_));
+
+		const int center_x = cell_x(center);
+		const int center_y = cell_y(center);
+
+		// once the reach wraps all the way around, every column / row is visited exactly once instead
+		const bool all_x = 2 * reach_x + 1 >= cells_x_;
+		const bool all_y = 2 * reach_y + 1 >= cells_y_;
+		const int begin_x = all_x ? 0 : center_x - reach_x;
+		const int end_x = all_x ? cells_x_ - 1 : center_x + reach_x;
+		const int begin_y = all_y ? 0 : center_y - reach_y;
+		const int end_y = all_y ? cells_y_ - 1 : center_y + reach_y;
+
+		for (int y = begin_y; y <= end_y; ++y)
+		{
+			const int row = wrap(y, cells_y_) * cells_x_;
+			for (int x = begin_x; x <= end_x; ++x)
+			{
+				const unsigned cell = static_cast<unsigned>(row + wrap(x, cells_x_));
+				for (unsigned s = cell_start_[cell]; s < cell_start_[cell + 1]; ++s)
+				{
+					const sf::Vector2f direction = toroidal_direction(center, sorted_positions_[s], bounds_);
+					const float distance_sq = direction.x * direction.x + direction.y * direction.y;
+					if (distance_sq <= radius_sq)
+						func(sorted_indices_[s], direction, distance_sq);
+				}
+			}
+		}
+	}
+
+
+	size_t count_in_radius(const sf::Vector2f center, const float radius) const
+	{
+		size_t count = 0;
+		query_radius(center, radius, [&count](unsigned, sf::Vector2f, float) { ++count; });
+		return count;
+	}
+
+
+	// writes the k stars closest to center into out, nearest first. searches outwards ring by ring
+	// and stops once no unvisited cell can hold anything closer than the current k-th neighbour
+	void query_nearest(const sf::Vector2f center, const unsigned k, std::vector<Neighbour>& out) const
+	{
+		out.clear();
+		if (k == 0)
+			return;
+
+		std::priority_queue<Neighbour> heap; // max-heap, the top is the worst of the current best k
+
+		const int center_x = cell_x(center);
+		const int center_y = cell_y(center);
+
+		// the offsets that reach every column / row exactly once around the torus
+		const int min_dx = -(cells_x_ - 1) / 2;
+		const int max_dx = cells_x_ / 2;
+		const int min_dy = -(cells_y_ - 1) / 2;
+		const int max_dy = cells_y_ / 2;
+		const int max_ring = std::max(std::max(-min_dx, max_dx), std::max(-min_dy, max_dy));
+		const float min_cell_size = std::min(cell_width_, cell_height_);
+
+		auto visit_cell = [&](const int dx, const int dy)
+		{
+			const unsigned cell = static_cast<unsigned>(wrap(center_y + dy, cells_y_) * cells_x_ + wrap(center_x + dx, cells_x_));
+			for (unsigned s = cell_start_[cell]; s < cell_start_[cell + 1]; ++s)
+			{
+				const float distance_sq = toroidal_distance_sq(center, sorted_positions_[s], bounds_);
+				if (heap.size() < k)
+					heap.push({ sorted_indices_[s], distance_sq });
+				else if (distance_sq < heap.top().distance_sq)
+				{
+					heap.pop();
+					heap.push({ sorted_indices_[s], distance_sq });
+				}
+			}
+		};
+
+		for (int ring = 0; ring <= max_ring; ++ring)
+		{
+			for (int dy = std::max(-ring, min_dy); dy <= std::min(ring, max_dy); ++dy)
+			{
+				if (dy == -ring || dy == ring)
+				{
+					for (int dx = std::max(-ring, min_dx); dx <= std::min(ring, max_dx); ++dx)
+						visit_cell(dx, dy);
+				}
+				else
+				{
+					if (-ring >= min_dx)
+						visit_cell(-ring, dy);
+					if (ring != 0 && ring <= max_dx)
+						visit_cell(ring, dy);
+				}
+			}
+
+			// anything in the next ring is at least ring whole cells away from center
+			const float next_ring_distance = static_cast<float>(ring) * min_cell_size;
+			if (heap.size() == k && heap.top().distance_sq <= next_ring_distance * next_ring_distance)
+				break;
+		}
+
+		out.resize(heap.size());
+		for (size_t i = heap.size(); i-- > 0;)
+		{
+			out[i] = heap.top();
+			heap.pop();
+		}
+	}
+
+
+	// direct access to the cell ordered data, for consumers that want to walk cells themselves
+	const sf::FloatRect& bounds() const { return bounds_; }
+	int cells_x() const { return cells_x_; }
+	int cells_y() const { return cells_y_; }
+	size_t cell_count() const { return static_cast<size_t>(cells_x_) * cells_y_; }
+	float cell_width() const { return cell_width_; }
+	float cell_height() const { return cell_height_; }
+
+	unsigned cell_begin(const size_t cell) const { return cell_start_[cell]; }
+	unsigned cell_end(const size_t cell) const { return cell_start_[cell + 1]; }
+	unsigned sorted_index(const size_t slot) const { return sorted_indices_[slot]; }
+	const sf::Vector2f& sorted_position(const size_t slot) const { return sorted_positions_[slot]; }
+
+
+	int cell_x(const sf::Vector2f position) const
+	{
+		return wrap(static_cast<int>(std::floor((position.x - bounds_.left) * inv_cell_width_)), cells_x_);
+	}
+
+	int cell_y(const sf::Vector2f position) const
+	{
+		return wrap(static_cast<int>(std::floor((position.y - bounds_.top) * inv_cell_height_)), cells_y_);
+	}
+
+	unsigned cell_index(const sf::Vector2f position) const
+	{
+		return static_cast<unsigned>(cell_y(position) * cells_x_ + cell_x(position));
+	}
+
+private:
+	static int wrap(const int value, const int size)
+	{
+		const int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+};
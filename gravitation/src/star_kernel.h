@@ -0,0 +1,349 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "acceleration_field.h"
+#include "black_holes.h"
+#include "black_hole_tree.h"
+#include "toroidal_space.h"
+
+
+template<typename Type, template<typename> typename Vector>
+void speed_limit(Vector<Type>& velocity, const Type max_speed)
+{
+	const Type speed_sq = length_sq(velocity);
+
+	if (speed_sq > max_speed * max_speed)
+	{
+		const Type speed = sqrt(speed_sq);
+		const Vector<Type> norm_vel = velocity / speed;
+		velocity = norm_vel * max_speed;
+	}
+}
+
+
+template<typename Type>
+void border_axis(Type& coordinate, const Type low, const Type extent)
+{
+	if (coordinate > low + extent)
+		coordinate -= low + extent;
+
+	else if (coordinate < low)
+		coordinate += low + extent;
+}
+
+template<typename Type>
+void border(sf::Vector2<Type>& position, const sf::Rect<Type>& bounds)
+{
+	border_axis(position.x, bounds.left, bounds.width);
+	border_axis(position.y, bounds.top, bounds.height);
+}
+
+template<typename Type>
+void border(sf::Vector3<Type>& position, const Box<Type>& bounds)
+{
+	border_axis(position.x, bounds.origin.x, bounds.size.x);
+	border_axis(position.y, bounds.origin.y, bounds.size.y);
+	border_axis(position.z, bounds.origin.z, bounds.size.z);
+}
+
+
+// feature toggles of the star kernel, every combination is compiled into its own instantiation
+enum StarFeatures : unsigned
+{
+	feature_speed_limit = 1u << 0,
+	feature_damping     = 1u << 1,
+	feature_capture     = 1u << 2, // off: the capture zone only softens the force instead of boosting the star
+	feature_temporal_lod = 1u << 3, // weak-field stars reuse a cached acceleration between staggered evaluations
+	feature_midstep_kick = 1u << 4, // drift half a step, kick with the black holes of the middle of the step, drift the other half
+	feature_count       = 1u << 5
+};
+
+// black hole counts with a fully unrolled kernel, anything else goes through the runtime loop, the tree or the
+// precomputed acceleration field
+inline constexpr unsigned max_unrolled_black_holes = 4u;
+inline constexpr unsigned dynamic_black_holes = 0u;
+inline constexpr unsigned tree_black_holes = max_unrolled_black_holes + 1;
+inline constexpr unsigned field_black_holes = tree_black_holes + 1;
+
+// the features each dimension's kernels are compiled with, the others are masked off. the tree, the
+// acceleration field and temporal LOD are 2D only so far, 3D always takes the direct sum
+template<unsigned Dimensions>
+inline constexpr unsigned supported_features = Dimensions == 2 ? feature_count - 1
+	: (feature_speed_limit | feature_damping | feature_capture | feature_midstep_kick);
+
+
+template<unsigned Dimensions>
+struct BasicStarKernelParams
+{
+	const BlackHoles* black_holes;
+	const BlackHoleTree* black_hole_tree;
+	const AccelerationField* acceleration_field;
+	typename Space<Dimensions>::Bounds bounds;
+	sf::Vector2f* render_positions; // optional, the renderer's mapped buffer gets a copy of every new position
+
+	float G;
+	float dt;
+	float star_mass;
+	float max_speed;
+	float damping;
+	float capture_radius_sq;
+
+	// temporal level of detail. a star's acceleration is re-evaluated when (index + lod_phase) % lod_interval == 0,
+	// or every step while |a| * (|v| + max_black_hole_speed) > lod_limit, i.e. while the acceleration is expected
+	// to drift by more than the error bound before its next scheduled evaluation
+	typename Space<Dimensions>::Vector* accelerations = nullptr;
+	unsigned lod_interval = 1;
+	unsigned lod_phase = 0;
+	float lod_limit = 0.f;
+	float max_black_hole_speed = 0.f;
+
+	bool bicubic_field = false;
+
+	// 3D: every new position is also projected to 2D, into projected_positions (and render_positions instead of
+	// the 3D one) for the grid and the renderers
+	Projection projection{};
+	sf::Vector2f* projected_positions = nullptr;
+
+	// accretion: a star inside a capture zone is flagged here instead of boosted and removed at the end of the
+	// step, every kernel call adds its flagged stars to absorbed_count. both null while accretion is off
+	std::uint8_t* absorbed = nullptr;
+	std::atomic<size_t>* absorbed_count = nullptr;
+};
+
+using StarKernelParams = BasicStarKernelParams<2>;
+
+
+// marks a cached acceleration as unusable, so the star is evaluated on its next step
+inline const sf::Vector2f stale_acceleration{ std::numeric_limits<float>::infinity(), 0.f };
+
+
+// flags a star inside captures capture zones for accretion, or without accretion boosts it once per zone.
+// returns 1 if it was flagged
+template<typename Vector, typename Params>
+size_t capture_star(Vector& velocity, const unsigned captures, const size_t i, const Params& params)
+{
+	if (captures == 0)
+		return 0;
+
+	if (params.absorbed)
+	{
+		params.absorbed[i] = 1;
+		return 1;
+	}
+
+	for (unsigned c = 0; c < captures; ++c)
+		velocity *= static_cast<decltype(velocity.x)>(1.01);
+	return 0;
+}
+
+inline void add_absorbed(const size_t absorbed, std::atomic<size_t>* count)
+{
+	if (absorbed)
+		count->fetch_add(absorbed, std::memory_order_relaxed);
+}
+
+
+// relative change of the acceleration over lod_interval steps is about interval * dt * speed / r, and for the
+// 1/r pull of this force law r = G * m * M / |a|, so bounding it by lod_error gives this limit on |a| * speed
+inline float temporal_lod_limit(const float lod_error, const float G, const float star_mass, const float bh_mass,
+	const unsigned interval, const float dt)
+{
+	return lod_error * G * star_mass * bh_mass / (static_cast<float>(std::max(1u, interval)) * dt);
+}
+
+
+// returns the number of stars whose forces were evaluated, which is end - begin unless temporal_lod skips some
+template<unsigned Dimensions, unsigned BlackHoleCount, unsigned Features>
+size_t update_star_range(typename Space<Dimensions>::Vector* positions, typename Space<Dimensions>::Vector* velocities,
+	const size_t begin, const size_t end, const BasicStarKernelParams<Dimensions>& params)
+{
+	using Vector = typename Space<Dimensions>::Vector;
+
+	constexpr bool limit_speed = Features & feature_speed_limit;
+	constexpr bool damp = Features & feature_damping;
+	constexpr bool capture = Features & feature_capture;
+	constexpr bool temporal_lod = Features & feature_temporal_lod;
+	constexpr bool midstep_kick = Features & feature_midstep_kick;
+
+	const BlackHoles& black_holes = *params.black_holes;
+	const auto bounds = params.bounds;
+	const float dt = params.dt;
+	sf::Vector2f* const render_positions = params.render_positions;
+
+	// with a compile-time count the black holes are hoisted into registers and the inner loop disappears
+	constexpr size_t local_count = BlackHoleCount >= 1 && BlackHoleCount <= max_unrolled_black_holes ? BlackHoleCount : 1;
+	std::array<Vector, local_count> bh_position{};
+	std::array<float, local_count> bh_pull{}; // G * star_mass * bh_mass
+
+	if constexpr (BlackHoleCount >= 1 && BlackHoleCount <= max_unrolled_black_holes)
+	{
+		for (size_t b = 0; b < BlackHoleCount; ++b)
+		{
+			bh_position[b] = black_holes.template position_in<Dimensions>(b);
+			bh_pull[b] = params.G * params.star_mass * black_holes.mass[b];
+		}
+	}
+
+	// the capture zone boosts the star instead of pulling it (or softens the pull when capture is off)
+	const auto attract = [&](const Vector& position, Vector& acceleration, unsigned& captures, const Vector bh, const float pull)
+	{
+		const Vector direction = toroidal_direction(position, bh, bounds);
+		float distance_sq = length_sq(direction);
+
+		if constexpr (capture)
+		{
+			if (distance_sq < params.capture_radius_sq)
+			{
+				++captures;
+				return;
+			}
+		}
+		else
+			distance_sq = std::max(distance_sq, params.capture_radius_sq);
+
+		acceleration += direction * (pull / distance_sq);
+	};
+
+	const auto evaluate = [&](const Vector& position, Vector& acceleration, unsigned& captures)
+	{
+		if constexpr (BlackHoleCount == tree_black_holes)
+		{
+			// the tree always skips black holes inside the capture zone, the boost is what the toggle controls
+			const unsigned tree_captures = params.black_hole_tree->gravitate(position, acceleration, params.star_mass, params.G, params.capture_radius_sq, 1.f);
+			if constexpr (capture)
+				captures = tree_captures;
+		}
+		else if constexpr (BlackHoleCount == field_black_holes)
+		{
+			acceleration = params.acceleration_field->acceleration(position, black_holes, params.G * params.star_mass,
+				params.capture_radius_sq, capture, params.bicubic_field, captures);
+		}
+		else if constexpr (BlackHoleCount == dynamic_black_holes)
+		{
+			for (size_t b = 0; b < black_holes.size(); ++b)
+				attract(position, acceleration, captures, black_holes.template position_in<Dimensions>(b), params.G * params.star_mass * black_holes.mass[b]);
+		}
+		else
+		{
+			for (size_t b = 0; b < BlackHoleCount; ++b)
+				attract(position, acceleration, captures, bh_position[b], bh_pull[b]);
+		}
+	};
+
+	size_t evaluations = 0;
+	size_t absorbed = 0;
+	for (size_t i = begin; i < end; ++i)
+	{
+		Vector& position = positions[i];
+		Vector& vel = velocities[i];
+
+		border(position, bounds);
+		if constexpr (midstep_kick)
+			position += vel * (dt * 0.5f);
+
+		Vector acceleration{};
+		unsigned captures = 0;
+
+		if constexpr (temporal_lod)
+		{
+			Vector& cached = params.accelerations[i];
+			const bool due = (i + params.lod_phase) % params.lod_interval == 0;
+			const float drift = std::sqrt(length_sq(cached)) * (std::sqrt(length_sq(vel)) + params.max_black_hole_speed);
+
+			if (!due && drift <= params.lod_limit)
+				acceleration = cached;
+			else
+			{
+				evaluate(position, acceleration, captures);
+				cached = captures ? stale_acceleration : acceleration; // stars in a capture zone stay on the full update
+				++evaluations;
+			}
+		}
+		else
+		{
+			evaluate(position, acceleration, captures);
+			++evaluations;
+		}
+
+		absorbed += capture_star(vel, captures, i, params);
+		vel += acceleration * dt;
+
+		if constexpr (limit_speed)
+			speed_limit(vel, params.max_speed);
+
+		position += vel * (midstep_kick ? dt * 0.5f : dt);
+
+		if constexpr (Dimensions == 2)
+		{
+			if (render_positions)
+				render_positions[i] = position;
+		}
+		else
+		{
+			const sf::Vector2f projected = params.projection(position);
+			params.projected_positions[i] = projected;
+			if (render_positions)
+				render_positions[i] = projected;
+		}
+
+		if constexpr (damp)
+			vel *= params.damping;
+	}
+	add_absorbed(absorbed, params.absorbed_count);
+	return evaluations;
+}
+
+
+template<unsigned Dimensions>
+using BasicStarKernel = size_t(*)(typename Space<Dimensions>::Vector*, typename Space<Dimensions>::Vector*, size_t, size_t,
+	const BasicStarKernelParams<Dimensions>&);
+
+using StarKernel = BasicStarKernel<2>;
+
+namespace detail
+{
+	template<unsigned Dimensions, unsigned BlackHoleCount, unsigned... Features>
+	constexpr std::array<BasicStarKernel<Dimensions>, feature_count> make_feature_table(std::integer_sequence<unsigned, Features...>)
+	{
+		return { &update_star_range<Dimensions, BlackHoleCount, Features & supported_features<Dimensions>>... };
+	}
+
+	template<unsigned Dimensions, unsigned... Counts>
+	constexpr std::array<std::array<BasicStarKernel<Dimensions>, feature_count>, sizeof...(Counts)> make_kernel_table(std::integer_sequence<unsigned, Counts...>)
+	{
+		return { make_feature_table<Dimensions, Counts>(std::make_integer_sequence<unsigned, feature_count>{})... };
+	}
+
+	// indexed by [dynamic, 1 .. max_unrolled, tree, field][features], 3D stops after the unrolled counts
+	template<unsigned Dimensions>
+	inline constexpr auto star_kernels = make_kernel_table<Dimensions>(
+		std::make_integer_sequence<unsigned, Dimensions == 2 ? field_black_holes + 1 : tree_black_holes>{});
+}
+
+
+// picks the instantiation matching the current black hole count and feature toggles.
+// only needs to be called again when one of them changes. use_tree and use_field are 2D only
+template<unsigned Dimensions = 2>
+BasicStarKernel<Dimensions> select_star_kernel(const size_t black_hole_count, const bool use_tree, const unsigned features, const bool use_field = false)
+{
+	if constexpr (Dimensions == 2)
+	{
+		if (use_field)
+			return detail::star_kernels<Dimensions>[field_black_holes][features];
+
+		if (use_tree)
+			return detail::star_kernels<Dimensions>[tree_black_holes][features];
+	}
+
+	if (black_hole_count >= 1 && black_hole_count <= max_unrolled_black_holes)
+		return detail::star_kernels<Dimensions>[black_hole_count][features];
+
+	return detail::star_kernels<Dimensions>[dynamic_black_holes][features];
+}
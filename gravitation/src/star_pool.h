@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "compaction.h"
+#include "huge_pages.h"
+#include "threading.h"
+
+
+// capacity managed bookkeeping for the per-star arrays. every array is reserved for capacity stars up front, the
+// kernels flag removals during a step and they are applied in one batch after it, and the slots they free are
+// handed to the batch's new stars before anything is appended, so stars only move when more leave than arrive.
+// the kernels always see the dense range [0, count), and once the scratch buffers have grown a batch allocates
+// nothing. a batch is begin_batch, insert, then compact and apply to every array if compact says so, end_batch
+class StarPool
+{
+	ThreadPool& pool_;
+	StreamCompaction compaction_;
+	size_t capacity_;
+	std::vector<std::uint8_t> removed_; // flags over the current stars, set by the kernels
+	std::atomic<size_t> removed_count_{ 0 };
+	std::vector<size_t> slots_;         // where the batch's new stars go, freed slots first
+	const std::vector<size_t> none_{};
+	size_t length_ = 0;                 // stars in the arrays during the batch, holes included
+	size_t removed_left_ = 0;           // flagged stars whose slot was not taken over
+	bool planned_ = false;              // the compaction plan still matches the flags
+	std::vector<std::byte> scratch_;    // apply stages every array's kept stars here
+
+public:
+	StarPool(ThreadPool& pool, FrameArenas& arenas, const size_t capacity)
+		: pool_(pool), compaction_(pool, arenas), capacity_(capacity)
+	{
+		removed_.reserve(capacity);
+		slots_.reserve(capacity);
+	}
+
+
+	size_t capacity() const { return capacity_; }
+
+	template<typename Type, typename Allocator>
+	void reserve(std::vector<Type, Allocator>& values) const
+	{
+		values.reserve(capacity_);
+	}
+
+	// grows values to count stars of value. the pool threads write the new ones in the slices parallel_for(count)
+	// gives them, so the pages of an array grown from empty sit on the nodes of the threads that own the stars
+	template<typename Type>
+	void resize(StarArray<Type>& values, const size_t count, const Type& value = Type{}) const
+	{
+		const size_t from = values.size();
+		resize_uninitialized(values, count);
+		pool_.parallel_for(count, [&values, from, &value](const size_t begin, const size_t end, unsigned)
+		{
+			if (end > from)
+				std::fill(values.data() + std::max(begin, from), values.data() + end, value);
+		});
+	}
+
+	template<typename Type>
+	void assign(StarArray<Type>& values, const size_t count, const Type& value) const
+	{
+		values.clear();
+		resize(values, count, value);
+	}
+
+
+	// cleared flags for count stars, for the kernels
+	std::uint8_t* removal_flags(const size_t count)
+	{
+		if (removed_.size() != count)
+			removed_.assign(count, 0);
+		return removed_.data();
+	}
+
+	std::atomic<size_t>* removal_counter() { return &removed_count_; }
+
+	bool removals_pending() const { return removed_count_.load(std::memory_order_relaxed) > 0; }
+
+
+	// the stars flagged since the last batch in index order, still in place
+	const std::vector<size_t>& begin_batch(const size_t count)
+	{
+		length_ = count;
+		planned_ = false;
+		removed_left_ = 0;
+		if (!removals_pending())
+			return none_;
+
+		removal_flags(count);
+		compaction_.plan(removed_.data(), count);
+		planned_ = true;
+		removed_left_ = count - compaction_.kept();
+		return compaction_.removed_indices();
+	}
+
+
+	// drops the flags and the batch, for a run that starts over from count stars
+	void reset(const size_t count)
+	{
+		removed_.assign(count, 0);
+		removed_count_.store(0, std::memory_order_relaxed);
+		slots_.clear();
+		length_ = count;
+		removed_left_ = 0;
+		planned_ = false;
+	}
+
+
+	// makes room for up to requested new stars, as many as the capacity allows, and returns the length the
+	// arrays must be resized to. slots() then lists where the new stars go
+	size_t insert(const size_t requested)
+	{
+		const size_t stars = length_ - removed_left_;
+		const size_t inserted = std::min(requested, capacity_ - std::min(capacity_, stars));
+		const std::vector<size_t>& holes = planned_ ? compaction_.removed_indices() : none_;
+		const size_t refilled = std::min(inserted, removed_left_);
+
+		slots_.clear();
+		for (size_t h = 0; h < refilled; ++h)
+		{
+			slots_.push_back(holes[h]);
+			removed_[holes[h]] = 0;
+		}
+		for (size_t i = length_; i < length_ + inserted - refilled; ++i)
+			slots_.push_back(i);
+
+		removed_left_ -= refilled;
+		planned_ = planned_ && refilled == 0;
+		length_ += inserted - refilled;
+		removed_.resize(length_, 0);
+		return length_;
+	}
+
+	const std::vector<size_t>& slots() const { return slots_; }
+
+
+	// true if flagged stars are left and every array has to go through apply
+	bool compact()
+	{
+		if (removed_left_ == 0)
+			return false;
+
+		if (!planned_)
+			compaction_.plan(removed_.data(), length_);
+		planned_ = true;
+		return true;
+	}
+
+	template<typename Type, typename Allocator>
+	void apply(std::vector<Type, Allocator>& values)
+	{
+		compaction_.apply(values, scratch_);
+	}
+
+
+	// the number of stars after the batch
+	size_t end_batch()
+	{
+		if (removed_left_ > 0)
+			length_ = compaction_.kept();
+		removed_.assign(length_, 0);
+		removed_count_.store(0, std::memory_order_relaxed);
+		removed_left_ = 0;
+		return length_;
+	}
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "gl_functions.h"
+#include "threading.h"
+
+
+// draws the stars through one of several upload paths, the colour is the same for every star so only
+// positions ever change:
+//  - vertex_array:  sf::VertexArray, the whole 20 byte vertex is re-sent from client memory on every draw
+//  - vertex_buffer: sf::VertexBuffer with stream usage, still full vertices but uploaded once per frame
+//  - gl_stream:     raw GL buffer with 8 byte positions, orphaned and refilled every frame
+//  - gl_persistent: persistently mapped, triple buffered GL buffer that the physics workers write into directly
+class StarRenderer
+{
+public:
+	enum Path : unsigned { vertex_array, vertex_buffer, gl_stream, gl_persistent, path_count };
+
+	static const char* path_name(const Path path)
+	{
+		constexpr std::array<const char*, path_count> names = { "vertex array", "vertex buffer", "gl stream", "gl persistent" };
+		return names[path];
+	}
+
+private:
+	static constexpr unsigned regions = 3; // persistent mapping: the gpu reads one region while the cpu fills another
+
+	ThreadPool& pool_;
+	size_t count_;
+	size_t draw_count_;
+	sf::Color base_color_;
+	sf::Color color_;    // base colour scaled by the weight of the drawn subset
+	float weight_ = 1.f;
+	Path path_ = vertex_array;
+
+	sf::VertexArray vertices_;
+	sf::VertexBuffer vertex_buffer_{ sf::Points, sf::VertexBuffer::Stream };
+
+	GLuint buffer_ = 0;
+	sf::Vector2f* mapped_ = nullptr;
+	unsigned region_ = 0;
+	std::array<gl::Sync, regions> fences_{};
+
+public:
+	StarRenderer(const size_t count, const sf::Color color, ThreadPool& pool)
+		: pool_(pool), count_(count), draw_count_(count), base_color_(color), color_(color), vertices_(sf::Points, count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			vertices_[i].color = color;
+	}
+
+	~StarRenderer() { release_gl(); }
+
+	StarRenderer(const StarRenderer&) = delete;
+	StarRenderer& operator=(const StarRenderer&) = delete;
+
+	Path path() const { return path_; }
+
+
+	// switches to path, or the closest one the driver supports. requires an active context
+	Path set_path(Path path)
+	{
+		if (path >= path_count)
+			path = gl_persistent;
+		if (path == gl_persistent && !gl::functions().persistent_mapping())
+			path = gl_stream;
+		if (path == gl_stream && !gl::functions().buffers())
+			path = vertex_buffer;
+		if (path == vertex_buffer && !sf::VertexBuffer::isAvailable())
+			path = vertex_array;
+
+		release_gl();
+		path_ = path;
+
+		if (path_ == vertex_buffer)
+			vertex_buffer_.create(count_);
+		else if (path_ == gl_stream || path_ == gl_persistent)
+			create_gl_buffer();
+
+		return path_;
+	}
+
+
+	// gl_persistent only: the mapped region the physics workers should write this frame's positions into,
+	// waits until the gpu is done reading it. nullptr for every other path
+	sf::Vector2f* writable_positions()
+	{
+		if (path_ != gl_persistent)
+			return nullptr;
+
+		wait_for(fences_[region_]);
+		return mapped_ + region_ * count_;
+	}
+
+
+	// gl_persistent only: the workers have filled the region returned by writable_positions with the first count
+	// stars, fewer than it was created for once stars have been accreted
+	void use_written_positions(const size_t count)
+	{
+		draw_count_ = std::min(count, count_);
+	}
+
+
+	// copies the first count positions (at most the capacity) into whatever the current path draws from
+	void upload(const sf::Vector2f* positions, const size_t count)
+	{
+		draw_count_ = std::min(count, count_);
+
+		if (path_ == vertex_array || path_ == vertex_buffer)
+		{
+			pool_.parallel_for(draw_count_, [this, positions](const size_t begin, const size_t end, unsigned)
+			{
+				for (size_t i = begin; i < end; ++i)
+					vertices_[i].position = positions[i];
+			});
+
+			if (path_ == vertex_buffer)
+				vertex_buffer_.update(&vertices_[0], draw_count_, 0);
+		}
+		else if (path_ == gl_stream)
+		{
+			const gl::Functions& f = gl::functions();
+			f.BindBuffer(gl::array_buffer, buffer_);
+			f.BufferData(gl::array_buffer, static_cast<gl::SizeIPtr>(count_ * sizeof(sf::Vector2f)), nullptr, gl::stream_draw); // orphan
+			f.BufferSubData(gl::array_buffer, 0, static_cast<gl::SizeIPtr>(draw_count_ * sizeof(sf::Vector2f)), positions);
+			f.BindBuffer(gl::array_buffer, 0);
+		}
+		else if (path_ == gl_persistent)
+		{
+			sf::Vector2f* region = writable_positions();
+			pool_.parallel_for(draw_count_, [region, positions](const size_t begin, const size_t end, unsigned)
+			{
+				std::copy(positions + begin, positions + end, region + begin);
+			});
+		}
+	}
+
+
+	// brightness multiplier for every drawn star, used when only a representative subset is drawn
+	void set_weight(const float weight)
+	{
+		if (weight == weight_)
+			return;
+
+		weight_ = weight;
+		auto scale = [weight](const sf::Uint8 channel) { return static_cast<sf::Uint8>(std::min(255.f, channel * weight)); };
+		color_ = { scale(base_color_.r), scale(base_color_.g), scale(base_color_.b), base_color_.a };
+
+		for (size_t i = 0; i < count_; ++i)
+			vertices_[i].color = color_;
+	}
+
+
+	// draws this frame's positions, as often as needed (e.g. once per tile). finish_frame ends the frame
+	void draw(sf::RenderTarget& target, const sf::RenderStates& states)
+	{
+		switch (path_)
+		{
+		case vertex_array:
+			target.draw(&vertices_[0], draw_count_, sf::Points, states);
+			break;
+
+		case vertex_buffer:
+			target.draw(vertex_buffer_, 0, draw_count_, states);
+			break;
+
+		case gl_stream:
+			draw_gl_points(target, states, 0);
+			break;
+
+		case gl_persistent:
+			draw_gl_points(target, states, region_ * count_ * sizeof(sf::Vector2f));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// after the frame's last draw: gl_persistent fences the region the draws read and moves on to the next one
+	void finish_frame()
+	{
+		if (path_ != gl_persistent)
+			return;
+
+		const gl::Functions& f = gl::functions();
+		if (fences_[region_])
+			f.DeleteSync(fences_[region_]);
+		fences_[region_] = f.FenceSync(gl::sync_gpu_commands_complete, 0);
+		region_ = (region_ + 1) % regions;
+	}
+
+private:
+	void create_gl_buffer()
+	{
+		const gl::Functions& f = gl::functions();
+		f.GenBuffers(1, &buffer_);
+		f.BindBuffer(gl::array_buffer, buffer_);
+
+		if (path_ == gl_persistent)
+		{
+			const auto bytes = static_cast<gl::SizeIPtr>(regions * count_ * sizeof(sf::Vector2f));
+			const GLbitfield flags = gl::map_write_bit | gl::map_persistent_bit | gl::map_coherent_bit;
+			f.BufferStorage(gl::array_buffer, bytes, nullptr, flags);
+			mapped_ = static_cast<sf::Vector2f*>(f.MapBufferRange(gl::array_buffer, 0, bytes, flags));
+		}
+		else
+			f.BufferData(gl::array_buffer, static_cast<gl::SizeIPtr>(count_ * sizeof(sf::Vector2f)), nullptr, gl::stream_draw);
+
+		f.BindBuffer(gl::array_buffer, 0);
+	}
+
+	void release_gl()
+	{
+		if (buffer_ == 0)
+			return;
+
+		const gl::Functions& f = gl::functions();
+		for (gl::Sync& fence : fences_)
+		{
+			wait_for(fence);
+		}
+
+		if (mapped_)
+		{
+			f.BindBuffer(gl::array_buffer, buffer_);
+			f.UnmapBuffer(gl::array_buffer);
+			f.BindBuffer(gl::array_buffer, 0);
+			mapped_ = nullptr;
+		}
+
+		f.DeleteBuffers(1, &buffer_);
+		buffer_ = 0;
+		region_ = 0;
+	}
+
+	static void wait_for(gl::Sync& fence)
+	{
+		if (!fence)
+			return;
+
+		const gl::Functions& f = gl::functions();
+		constexpr std::uint64_t timeout_ns = 1'000'000'000;
+		GLenum result = f.ClientWaitSync(fence, gl::sync_flush_commands_bit, timeout_ns);
+		while (result != gl::already_signaled && result != gl::condition_satisfied && result != gl::wait_failed)
+			result = f.ClientWaitSync(fence, 0, timeout_ns);
+
+		f.DeleteSync(fence);
+		fence = nullptr;
+	}
+
+	// fixed function point draw straight from the position buffer, everything else is left as SFML expects it
+	void draw_gl_points(sf::RenderTarget& target, const sf::RenderStates& states, const size_t byte_offset)
+	{
+		if (!target.setActive(true))
+			return;
+
+		const sf::View& view = target.getView();
+		const sf::IntRect viewport = target.getViewport(view);
+		glViewport(viewport.left, static_cast<GLint>(target.getSize().y) - (viewport.top + viewport.height), viewport.width, viewport.height);
+
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(view.getTransform().getMatrix());
+		glMatrixMode(GL_MODELVIEW);
+		glLoadMatrixf(states.transform.getMatrix());
+
+		glDisable(GL_TEXTURE_2D);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE); // sf::BlendAdd
+		glColor4ub(color_.r, color_.g, color_.b, color_.a);
+
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState(GL_VERTEX_ARRAY);
+
+		const gl::Functions& f = gl::functions();
+		f.BindBuffer(gl::array_buffer, buffer_);
+		glVertexPointer(2, GL_FLOAT, 0, reinterpret_cast<const void*>(byte_offset));
+		glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(draw_count_));
+		f.BindBuffer(gl::array_buffer, 0);
+
+		target.resetGLStates();
+	}
+};
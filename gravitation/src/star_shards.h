@@ -0,0 +1,407 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "black_hole_tree.h"
+#include "black_holes.h"
+#include "child_process.h"
+#include "config.h"
+#include "huge_pages.h"
+#include "settings.h"
+#include "shared_memory.h"
+#include "star_kernel.h"
+#include "threading.h"
+
+
+// multi-process star update. stars only feel the black holes, so with the black hole state shared every process
+// can update its own shard of stars. the coordinator (the process with the window) owns the black holes and
+// publishes them every step into a shared memory segment under a seqlock, the workers (started by the
+// coordinator with its own command line plus --shard_worker=n) update their shard with it and write the new
+// positions straight back into the segment, then mark the step done. the coordinator moves its black holes
+// meanwhile and waits for every worker before it draws. the workers write their velocities back as well, into
+// one of two buffers by step parity, so that when a worker dies or hangs the coordinator can take the stars over
+// from the finished shards' new state and the failed shards' last complete one
+inline constexpr unsigned max_shard_workers = 64;
+inline constexpr std::uint64_t shard_magic = 0x6772'6176'7368'6172; // "gravshar"
+
+
+// what the star kernel needs from the coordinator besides the black holes, published with them every step
+struct ShardParams
+{
+	float G;
+	float dt;
+	float max_speed;
+	float damping;
+	unsigned features;
+};
+
+struct ShardHeader
+{
+	std::uint64_t magic;
+	std::uint32_t black_hole_count;
+	std::uint32_t star_count;
+	std::uint32_t workers;
+	std::uint64_t coordinator; // process id, the workers leave when it is gone
+
+	// seqlock over step, params and the black hole arrays, odd while the coordinator writes them
+	alignas(64) std::atomic<std::uint64_t> sequence;
+	std::uint64_t step;
+	ShardParams params;
+
+	alignas(64) std::atomic<std::uint32_t> stop;
+
+	struct alignas(64) Done
+	{
+		std::atomic<std::uint64_t> step; // the last step whose positions the worker has written back
+	};
+	Done done[max_shard_workers];
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shard counters are shared between processes");
+
+
+// the header, then x, y, vx, vy and mass of the black holes, then the star positions and two buffers of
+// velocities, step s writes buffer s % 2 and the starting velocities are in buffer 0
+struct ShardLayout
+{
+	size_t black_holes;
+	size_t positions;
+	size_t velocities;
+	size_t size;
+
+	ShardLayout(const size_t black_hole_count, const size_t star_count)
+	{
+		const auto align = [](const size_t offset) { return (offset + 63) / 64 * 64; };
+		black_holes = align(sizeof(ShardHeader));
+		positions = align(black_holes + 5 * black_hole_count * sizeof(float));
+		velocities = align(positions + star_count * sizeof(sf::Vector2f));
+		size = velocities + 2 * star_count * sizeof(sf::Vector2f);
+	}
+};
+
+
+// stars [first, second) of worker index (0 based)
+inline std::pair<size_t, size_t> shard_range(const size_t star_count, const unsigned workers, const unsigned index)
+{
+	return { star_count * index / workers, star_count * (index + 1) / workers };
+}
+
+
+// the writer side of the seqlock, only the coordinator writes
+inline void publish_black_holes(ShardHeader& header, float* arrays, const BlackHoles& black_holes, const ShardParams& params, const std::uint64_t step)
+{
+	const std::uint64_t sequence = header.sequence.load(std::memory_order_relaxed);
+	header.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	header.step = step;
+	header.params = params;
+	const size_t count = black_holes.size();
+	for (const std::vector<float>* array : { &black_holes.x, &black_holes.y, &black_holes.vx, &black_holes.vy, &black_holes.mass })
+	{
+		std::memcpy(arrays, array->data(), count * sizeof(float));
+		arrays += count;
+	}
+
+	header.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// the reader side, false if the copy may be torn and has to be retried
+inline bool read_black_holes(const ShardHeader& header, const float* arrays, BlackHoles& black_holes, ShardParams& params, std::uint64_t& step)
+{
+	const std::uint64_t before = header.sequence.load(std::memory_order_acquire);
+	if (before & 1)
+		return false;
+
+	step = header.step;
+	params = header.params;
+	const size_t count = black_holes.size();
+	for (std::vector<float>* array : { &black_holes.x, &black_holes.y, &black_holes.vx, &black_holes.vy, &black_holes.mass })
+	{
+		std::memcpy(array->data(), arrays, count * sizeof(float));
+		arrays += count;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return header.sequence.load(std::memory_order_relaxed) == before;
+}
+
+
+class ShardCoordinator
+{
+	ShardLayout layout_;
+	SharedMemory memory_;
+	ShardHeader* header_ = nullptr;
+	float* black_holes_ = nullptr;
+	const sf::Vector2f* positions_ = nullptr;
+	const sf::Vector2f* velocities_ = nullptr; // both buffers
+	unsigned workers_;
+	std::uint64_t step_ = 0;
+	std::vector<std::unique_ptr<ChildProcess>> processes_;
+
+public:
+	// copies the starting stars into the segment and starts the workers, command is this process's command line
+	ShardCoordinator(const std::string& name, const unsigned workers, const BlackHoles& black_holes,
+		const StarArray<sf::Vector2f>& positions, const StarArray<sf::Vector2f>& velocities, const std::vector<std::string>& command)
+		: layout_(black_holes.size(), positions.size()), memory_(name, layout_.size, true), workers_(workers)
+	{
+		if (!memory_.is_open())
+			return;
+
+		std::byte* data = memory_.data();
+		header_ = new (data) ShardHeader{};
+		header_->magic = shard_magic;
+		header_->black_hole_count = static_cast<std::uint32_t>(black_holes.size());
+		header_->star_count = static_cast<std::uint32_t>(positions.size());
+		header_->workers = workers_;
+#ifdef _WIN32
+		header_->coordinator = GetCurrentProcessId();
+#else
+		header_->coordinator = static_cast<std::uint64_t>(getpid());
+#endif
+		black_holes_ = reinterpret_cast<float*>(data + layout_.black_holes);
+		positions_ = reinterpret_cast<const sf::Vector2f*>(data + layout_.positions);
+		velocities_ = reinterpret_cast<const sf::Vector2f*>(data + layout_.velocities);
+		std::memcpy(data + layout_.positions, positions.data(), positions.size() * sizeof(sf::Vector2f));
+		std::memcpy(data + layout_.velocities, velocities.data(), velocities.size() * sizeof(sf::Vector2f));
+
+		for (unsigned w = 0; w < workers_; ++w)
+		{
+			std::vector<std::string> args = command;
+			args.push_back("--shard_worker=" + std::to_string(w + 1));
+			processes_.push_back(std::make_unique<ChildProcess>(args));
+		}
+		if (!std::all_of(processes_.begin(), processes_.end(), [](const auto& process) { return process->started(); }))
+		{
+			header_->stop.store(1, std::memory_order_release); // the started ones leave again
+			header_ = nullptr;
+			return;
+		}
+		std::cout << "shards: " << workers_ << " worker processes, " << layout_.size / (1024 * 1024) << " MiB shared through " << name << "\n";
+	}
+
+	// the workers see stop and leave, the processes are reaped before the segment goes
+	~ShardCoordinator()
+	{
+		if (header_)
+			header_->stop.store(1, std::memory_order_release);
+		processes_.clear();
+	}
+
+
+	bool is_open() const { return header_ != nullptr; }
+	const sf::Vector2f* positions() const { return positions_; }
+
+
+	void publish(const BlackHoles& black_holes, const ShardParams& params)
+	{
+		publish_black_holes(*header_, black_holes_, black_holes, params, ++step_);
+	}
+
+	// until every worker has written back the published step. false if a worker exited or the step took longer
+	// than timeout seconds, the workers are stopped and reaped then, so that nothing writes the segment any more
+	bool wait(const float timeout)
+	{
+		const auto deadline = std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(timeout));
+		for (unsigned w = 0; w < workers_; ++w)
+		{
+			unsigned spins = 0;
+			while (header_->done[w].step.load(std::memory_order_acquire) < step_)
+			{
+				back_off(spins);
+				if (spins >= 2'000 && (!processes_[w]->running() || std::chrono::steady_clock::now() > deadline))
+				{
+					std::cerr << "shards: worker " << w + 1 << " failed in step " << step_ << "\n";
+					header_->stop.store(1, std::memory_order_release);
+					for (const auto& process : processes_)
+						process->terminate();
+					processes_.clear();
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// after a failed wait: the shards that finished the published step hand over their new positions and
+	// velocities. a failed shard may have written part of its step, it gets its velocities of the step before,
+	// its positions of that step are still in positions from the last copy. black_holes and params get what was
+	// published, returns the failed shards' star ranges, which still have to go through the step
+	std::vector<std::pair<size_t, size_t>> take_over(StarArray<sf::Vector2f>& positions, StarArray<sf::Vector2f>& velocities,
+		BlackHoles& black_holes, ShardParams& params) const
+	{
+		const size_t count = header_->star_count;
+		const sf::Vector2f* finished_velocities = velocities_ + (step_ % 2) * count;
+		const sf::Vector2f* previous_velocities = velocities_ + ((step_ - 1) % 2) * count;
+
+		std::vector<std::pair<size_t, size_t>> failed;
+		for (unsigned w = 0; w < workers_; ++w)
+		{
+			const auto [begin, end] = shard_range(count, workers_, w);
+			if (header_->done[w].step.load(std::memory_order_acquire) >= step_)
+			{
+				std::copy(positions_ + begin, positions_ + end, positions.data() + begin);
+				std::copy(finished_velocities + begin, finished_velocities + end, velocities.data() + begin);
+			}
+			else
+			{
+				std::copy(previous_velocities + begin, previous_velocities + end, velocities.data() + begin);
+				failed.emplace_back(begin, end);
+			}
+		}
+
+		std::uint64_t step = 0;
+		read_black_holes(*header_, black_holes_, black_holes, params, step); // nobody writes any more
+		return failed;
+	}
+
+	// spin a little, then yield, then sleep, so a stalled peer does not burn a core
+	static void back_off(unsigned& spins)
+	{
+		if (++spins < 1'000)
+			return;
+		if (spins < 2'000)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+};
+
+
+// a worker process, owns stars shard_range(star_count, shard_workers, shard_worker - 1) and their velocities
+class ShardWorker : SimulationSettings, SFMLSettings
+{
+	Config config_;
+	unsigned index_;
+	sf::FloatRect bounds_;
+	SharedMemory memory_;
+	ShardHeader* header_ = nullptr;
+	ThreadPool pool_;
+	BlackHoles black_holes_;
+	BlackHoleTree black_hole_tree_{ bounds_, black_hole_tree_theta, black_hole_leaf_size };
+	StarArray<sf::Vector2f> positions_;
+	StarArray<sf::Vector2f> velocities_;
+	size_t begin_ = 0;
+#ifdef _WIN32
+	HANDLE coordinator_ = nullptr;
+#else
+	pid_t coordinator_ = getppid();
+#endif
+
+public:
+	// the command line is the coordinator's, so the layout comes out the same
+	explicit ShardWorker(Config config)
+		: config_(std::move(config)), index_(config_.shard_worker - 1), bounds_(config_.bounds()),
+		  memory_(config_.shard_name, ShardLayout(config_.number_of_black_holes, config_.number_of_stars).size, false),
+		  pool_(std::max(1u, config_.threads / std::max(1u, config_.shard_workers))),
+		  positions_(StarAllocator<sf::Vector2f>(parse_huge_pages(config_.huge_pages))),
+		  velocities_(StarAllocator<sf::Vector2f>(parse_huge_pages(config_.huge_pages)))
+	{
+		if (!memory_.is_open())
+			return;
+
+		auto* header = reinterpret_cast<ShardHeader*>(memory_.data());
+		if (header->magic != shard_magic || header->star_count != config_.number_of_stars
+			|| header->black_hole_count != config_.number_of_black_holes || index_ >= header->workers)
+		{
+			std::cerr << "shard worker " << config_.shard_worker << ": segment does not match the configuration\n";
+			return;
+		}
+		header_ = header;
+		black_holes_.resize(header_->black_hole_count);
+#ifdef _WIN32
+		coordinator_ = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(header_->coordinator));
+#endif
+
+		const ShardLayout layout(header_->black_hole_count, header_->star_count);
+		const auto [begin, end] = shard_range(header_->star_count, header_->workers, index_);
+		begin_ = begin;
+		const auto* positions = reinterpret_cast<const sf::Vector2f*>(memory_.data() + layout.positions);
+		const auto* velocities = reinterpret_cast<const sf::Vector2f*>(memory_.data() + layout.velocities); // buffer 0
+		positions_.assign(positions + begin, positions + end);
+		velocities_.assign(velocities + begin, velocities + end);
+	}
+
+#ifdef _WIN32
+	~ShardWorker()
+	{
+		if (coordinator_)
+			CloseHandle(coordinator_);
+	}
+#endif
+
+	ShardWorker(const ShardWorker&) = delete;
+	ShardWorker& operator=(const ShardWorker&) = delete;
+
+
+	int run()
+	{
+		if (!header_)
+			return 1;
+
+		const ShardLayout layout(header_->black_hole_count, header_->star_count);
+		const float* black_hole_arrays = reinterpret_cast<const float*>(memory_.data() + layout.black_holes);
+		sf::Vector2f* shared_positions = reinterpret_cast<sf::Vector2f*>(memory_.data() + layout.positions) + begin_;
+		sf::Vector2f* velocity_buffers = reinterpret_cast<sf::Vector2f*>(memory_.data() + layout.velocities) + begin_;
+		const bool use_tree = black_holes_.size() > black_hole_tree_threshold;
+
+		std::uint64_t last_step = 0;
+		unsigned spins = 0;
+		while (!header_->stop.load(std::memory_order_acquire) && coordinator_alive())
+		{
+			std::uint64_t step = 0;
+			ShardParams published{};
+			if (!read_black_holes(*header_, black_hole_arrays, black_holes_, published, step) || step == last_step)
+			{
+				ShardCoordinator::back_off(spins);
+				continue;
+			}
+			spins = 0;
+			last_step = step;
+
+			if (use_tree)
+				black_hole_tree_.build(black_holes_);
+
+			// the kernel writes the new positions straight into the segment
+			const StarKernelParams params{ &black_holes_, &black_hole_tree_, nullptr, bounds_, shared_positions,
+				published.G, published.dt, star_mass, published.max_speed, published.damping, black_hole_radius * black_hole_radius * 2 };
+			const StarKernel kernel = select_star_kernel(black_holes_.size(), use_tree, published.features);
+			sf::Vector2f* shared_velocities = velocity_buffers + (step % 2) * header_->star_count;
+			pool_.parallel_for(positions_.size(), [&](const size_t begin, const size_t end, unsigned)
+			{
+				kernel(positions_.data(), velocities_.data(), begin, end, params);
+				std::copy(velocities_.data() + begin, velocities_.data() + end, shared_velocities + begin);
+			});
+
+			header_->done[index_].step.store(step, std::memory_order_release);
+		}
+		return 0;
+	}
+
+private:
+	// a worker whose coordinator died without setting stop leaves on its own
+	bool coordinator_alive() const
+	{
+#ifdef _WIN32
+		return coordinator_ && WaitForSingleObject(coordinator_, 0) == WAIT_TIMEOUT;
+#else
+		return getppid() == coordinator_;
+#endif
+	}
+};
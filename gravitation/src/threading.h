@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "numa.h"
+
+
+// heap allocations made by this thread, counted by the global operator new in main.cpp (0 without it)
+inline thread_local std::uint64_t thread_heap_allocations = 0;
+
+
+// persistent worker threads. the calling thread takes part in every job as worker 0, so a pool of n threads
+// starts n - 1 extra threads. jobs are either statically sliced (parallel_for) or handed out in chunks through an
+// atomic cursor (parallel_chunks), which balances uneven per-item cost and never leaves a remainder behind.
+// given a cpu per thread, every thread (the calling one included) is pinned to its cpu
+class ThreadPool
+{
+public:
+	struct WorkerStats
+	{
+		double busy_ms = 0.0;
+		double idle_ms = 0.0; // time spent waiting for the slowest worker of a job to finish
+		size_t chunks = 0;
+	};
+
+private:
+	using Clock = std::chrono::steady_clock;
+	using Task = void(*)(void*, unsigned);
+
+	std::vector<std::thread> workers_;
+	std::vector<int> cpus_; // per thread, empty when the scheduler places them
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable finished_;
+
+	Task task_ = nullptr;
+	void* context_ = nullptr;
+	unsigned generation_ = 0;
+	unsigned running_ = 0;
+	bool stop_ = false;
+
+	std::atomic<size_t> cursor_{ 0 };
+	std::atomic<std::uint64_t> job_heap_allocations_{ 0 };
+	std::vector<double> job_busy_ms_;
+	std::vector<WorkerStats> stats_;
+
+public:
+	explicit ThreadPool(const unsigned threads, std::vector<int> cpus = {})
+		: cpus_(std::move(cpus)), job_busy_ms_(std::max(1u, threads)), stats_(std::max(1u, threads))
+	{
+		cpus_.resize(cpus_.empty() ? 0 : size(), cpus_.empty() ? -1 : cpus_.back());
+		if (pinned())
+			pin_current_thread(cpus_[0]);
+		for (unsigned t = 1; t < size(); ++t)
+			workers_.emplace_back([this, t]() { worker_loop(t); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+
+		for (auto& worker : workers_)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return static_cast<unsigned>(stats_.size()); }
+	bool pinned() const { return !cpus_.empty(); }
+	int cpu(const unsigned t) const { return pinned() ? cpus_[t] : -1; }
+
+
+	// runs func(thread_index) once on every thread and blocks until all of them are done
+	template<typename Func>
+	void run(Func&& func)
+	{
+		const Clock::time_point start = Clock::now();
+		{
+			std::lock_guard lock(mutex_);
+			task_ = [](void* context, const unsigned t) { (*static_cast<std::remove_reference_t<Func>*>(context))(t); };
+			context_ = &func;
+			running_ = static_cast<unsigned>(workers_.size());
+			++generation_;
+		}
+		wake_.notify_all();
+
+		execute(task_, context_, 0);
+
+		std::unique_lock lock(mutex_);
+		finished_.wait(lock, [this]() { return running_ == 0; });
+
+		const double wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		for (unsigned t = 0; t < size(); ++t)
+		{
+			stats_[t].busy_ms += job_busy_ms_[t];
+			stats_[t].idle_ms += std::max(0.0, wall_ms - job_busy_ms_[t]);
+		}
+	}
+
+
+	// one contiguous slice of [0, count) per thread, thread t always receives the same slice for the same count
+	template<typename Func> // func(begin, end, thread_index)
+	void parallel_for(const size_t count, Func&& func)
+	{
+		if (count < size())
+		{
+			func(size_t(0), count, 0u);
+			return;
+		}
+
+		run([&](const unsigned t)
+		{
+			const auto [begin, end] = slice(count, t);
+			func(begin, end, t);
+		});
+	}
+
+	// the slice of thread t in parallel_for(count)
+	std::pair<size_t, size_t> slice(const size_t count, const unsigned t) const
+	{
+		if (count < size())
+			return t == 0 ? std::pair<size_t, size_t>{ 0, count } : std::pair<size_t, size_t>{ count, count };
+
+		const size_t batch = count / size();
+		return { t * batch, t + 1 == size() ? count : (t + 1) * batch }; // the last thread takes the remainder
+	}
+
+
+	// hands out [0, count) in chunks of chunk_size to whichever thread is free next
+	template<typename Func> // func(begin, end, thread_index)
+	void parallel_chunks(const size_t count, const size_t chunk_size, Func&& func)
+	{
+		const size_t chunk = std::max<size_t>(1, chunk_size);
+		cursor_.store(0, std::memory_order_relaxed);
+
+		run([&](const unsigned t)
+		{
+			while (true)
+			{
+				const size_t begin = cursor_.fetch_add(chunk, std::memory_order_relaxed);
+				if (begin >= count)
+					break;
+
+				func(begin, std::min(begin + chunk, count), t);
+				++stats_[t].chunks;
+			}
+		});
+	}
+
+
+	// statistics accumulated since the last call
+	std::vector<WorkerStats> take_stats()
+	{
+		std::vector<WorkerStats> stats(size());
+		take_stats(stats.data());
+		return stats;
+	}
+
+	// the same into size() entries at out, without allocating
+	void take_stats(WorkerStats* out)
+	{
+		for (unsigned t = 0; t < size(); ++t)
+		{
+			out[t] = stats_[t];
+			stats_[t] = {};
+		}
+	}
+
+	// heap allocations made inside jobs, by every thread, since the pool started
+	std::uint64_t heap_allocations() const { return job_heap_allocations_.load(std::memory_order_relaxed); }
+
+private:
+	void execute(const Task task, void* context, const unsigned t)
+	{
+		const Clock::time_point start = Clock::now();
+		const std::uint64_t allocations = thread_heap_allocations;
+		task(context, t);
+		// thread 0 is the caller, its thread_heap_allocations already has them
+		if (t != 0 && thread_heap_allocations != allocations)
+			job_heap_allocations_.fetch_add(thread_heap_allocations - allocations, std::memory_order_relaxed);
+		job_busy_ms_[t] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	void worker_loop(const unsigned t)
+	{
+		if (pinned())
+			pin_current_thread(cpus_[t]);
+
+		unsigned seen = 0;
+		while (true)
+		{
+			std::unique_lock lock(mutex_);
+			wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+			if (stop_)
+				return;
+
+			seen = generation_;
+			const Task task = task_;
+			void* context = context_;
+			lock.unlock();
+
+			execute(task, context, t);
+
+			lock.lock();
+			if (--running_ == 0)
+				finished_.notify_one();
+		}
+	}
+};
+
+
+// zeroes count elements at data in the slices parallel_for(count) gives each thread. pages go to the node of the
+// thread that touches them first, so an array touched here before anything else is written into it is spread
+// over the nodes the way parallel_for later reads it
+inline void first_touch(ThreadPool& pool, void* data, const size_t count, const size_t element_size)
+{
+	pool.parallel_for(count, [&](const size_t begin, const size_t end, unsigned)
+	{
+		std::memset(static_cast<std::byte*>(data) + begin * element_size, 0, (end - begin) * element_size);
+	});
+}
+
+
+// hill climbs the chunk size of a dynamic loop: the time of a window of frames is compared against the previous
+// window, the chunk keeps doubling (or halving) while that helps and turns around when it does not
+class ChunkTuner
+{
+	static constexpr unsigned window = 32;
+
+	size_t chunk_;
+	size_t min_chunk_;
+	size_t max_chunk_;
+	bool growing_ = true;
+
+	unsigned samples_ = 0;
+	double window_ms_ = 0.0;
+	double previous_window_ms_ = 0.0;
+
+public:
+	ChunkTuner(const size_t initial, const size_t min_chunk, const size_t max_chunk)
+		: chunk_(std::clamp(initial, min_chunk, max_chunk)), min_chunk_(min_chunk), max_chunk_(max_chunk) {}
+
+	size_t chunk() const { return chunk_; }
+
+	void record(const double ms)
+	{
+		window_ms_ += ms;
+		if (++samples_ < window)
+			return;
+
+		if (previous_window_ms_ > 0.0 && window_ms_ > previous_window_ms_)
+			growing_ = not growing_;
+
+		previous_window_ms_ = window_ms_;
+		window_ms_ = 0.0;
+		samples_ = 0;
+
+		chunk_ = std::clamp(growing_ ? chunk_ * 2 : chunk_ / 2, min_chunk_, max_chunk_);
+	}
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+
+// lowers min to value, lock free, for reductions over the pool threads
+inline void atomic_min(std::atomic<float>& min, const float value)
+{
+	float current = min.load(std::memory_order_relaxed);
+	while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+
+// adaptive global timestep. every step ends with the criterion tau, the shortest timescale of the black hole
+// pairs or of the stars closest to a black hole. a step picked from the start of the step alone breaks the time
+// symmetry of the integrator and its energy error drifts, so the step is the mean of tau at both of its ends, with
+// tau at the end extrapolated from its change over the last step (Hut, Makino & McMillan 1995). the change from
+// one step to the next is bounded by max_change, and the step by dt_min and dt_max
+class TimestepController
+{
+	float dt_;
+	float tau_ = 0.f; // of the last step, 0 when there is none to extrapolate from
+
+public:
+	explicit TimestepController(const float dt) : dt_(dt) {}
+
+
+	float dt() const { return dt_; }
+
+	// starts over from a fixed step, e.g. while the adaptive step is off
+	void reset(const float dt)
+	{
+		dt_ = dt;
+		tau_ = 0.f;
+	}
+
+	// the next step ends no later than in remaining
+	void limit(const float remaining)
+	{
+		dt_ = std::min(dt_, remaining);
+	}
+
+	// a step of dt() is done and tau was the criterion at its end, picks the next step. an infinite tau, with
+	// nothing to measure, asks for dt_max
+	void advance(float tau, const float dt_min, const float dt_max, const float max_change)
+	{
+		tau = std::min(tau, dt_max);
+		const float slope = tau_ > 0.f ? (tau - tau_) / dt_ : 0.f;
+		tau_ = tau;
+
+		// dt = (tau + (tau + slope * dt)) / 2, solved for dt. a tau that grows faster than that has no solution,
+		// the step just grows as fast as it may
+		const float next = slope < 2.f ? tau / (1.f - slope / 2.f) : dt_ * max_change;
+		dt_ = std::clamp(std::clamp(next, dt_ / max_change, dt_ * max_change), dt_min, std::max(dt_min, dt_max));
+	}
+};
@@ -1,41 +1,107 @@
 #pragma once
 
+#include <SFML/Graphics.hpp>
+#include <cmath>
+
+// the periodic 3D world, an sf::Rect with depth
 template<typename Type>
-sf::Vector2<Type> toroidal_direction(const sf::Vector2<Type>& start, const sf::Vector2<Type>& end, const sf::Rect<Type>& bounds)
+struct Box
 {
-	Type dist_x = abs(start.x - end.x);
-	Type dist_y = abs(start.y - end.y);
+	sf::Vector3<Type> origin;
+	sf::Vector3<Type> size;
+};
 
-	if (dist_x < bounds.width / 2)
-		dist_x = dist_x;
-	else
-		dist_x = dist_x - bounds.width;
 
-	if (start.x > end.x)
-		dist_x *= -1;
+// vector and world types of the simulated space. Space<2> is exactly what the 2D simulation always used, so
+// code written against Space<Dimensions> compiles to the same thing in its 2D instantiation
+template<unsigned Dimensions>
+struct Space;
 
+template<>
+struct Space<2>
+{
+	using Vector = sf::Vector2f;
+	using Bounds = sf::FloatRect;
+};
 
-	if (dist_y < bounds.height / 2)
-		dist_y = dist_y;
-	else
-		dist_y = dist_y - bounds.height;
+template<>
+struct Space<3>
+{
+	using Vector = sf::Vector3f;
+	using Bounds = Box<float>;
+};
 
-	if (start.y > end.y)
-		dist_y *= -1;
 
-	return  { dist_x, dist_y };
+template<typename Type>
+Type length_sq(const sf::Vector2<Type>& vector)
+{
+	return vector.x * vector.x + vector.y * vector.y;
+}
+
+template<typename Type>
+Type length_sq(const sf::Vector3<Type>& vector)
+{
+	return vector.x * vector.x + vector.y * vector.y + vector.z * vector.z;
 }
 
+
+// minimum image offset from start to end along one periodic axis
 template<typename Type>
-Type toroidal_distance_sq(const sf::Vector2f& position1, const sf::Vector2f& position2, const sf::Rect<Type>& bounds)
+Type toroidal_offset(const Type start, const Type end, const Type extent)
 {
-	const sf::Vector2f dir = toroidal_direction(position1, position2, bounds);
+	Type dist = std::abs(start - end);
+
+	if (dist >= extent / 2)
+		dist = dist - extent;
+
+	if (start > end)
+		dist *= -1;
+
+	return dist;
+}
 
-	return dir.x * dir.x + dir.y * dir.y;
+template<typename Type>
+sf::Vector2<Type> toroidal_direction(const sf::Vector2<Type>& start, const sf::Vector2<Type>& end, const sf::Rect<Type>& bounds)
+{
+	return { toroidal_offset(start.x, end.x, bounds.width), toroidal_offset(start.y, end.y, bounds.height) };
 }
 
 template<typename Type>
-Type toroidal_distance(const sf::Vector2<Type>& vector_1, const sf::Vector2<Type>& vector_2, const sf::Rect<Type>& bounds)
+sf::Vector3<Type> toroidal_direction(const sf::Vector3<Type>& start, const sf::Vector3<Type>& end, const Box<Type>& bounds)
+{
+	return { toroidal_offset(start.x, end.x, bounds.size.x), toroidal_offset(start.y, end.y, bounds.size.y),
+		toroidal_offset(start.z, end.z, bounds.size.z) };
+}
+
+template<typename Vector, typename Bounds>
+auto toroidal_distance_sq(const Vector& position1, const Vector& position2, const Bounds& bounds)
 {
-	return sqrt(toroidal_distance_sq(vector_1, vector_2, bounds));
+	return length_sq(toroidal_direction(position1, position2, bounds));
 }
+
+template<typename Vector, typename Bounds>
+auto toroidal_distance(const Vector& position1, const Vector& position2, const Bounds& bounds)
+{
+	return std::sqrt(toroidal_distance_sq(position1, position2, bounds));
+}
+
+
+// orthographic view of the 3D world onto the 2D x / y plane, tilted about the x axis through the world centre:
+// tilt 0 looks straight down on the disks, a quarter turn looks at them edge on. y is wrapped back into the
+// 2D bounds so the grid and the renderers see an ordinary 2D world
+struct Projection
+{
+	float centre_y = 0.f;
+	float centre_z = 0.f;
+	float cos_tilt = 1.f;
+	float sin_tilt = 0.f;
+	float top = 0.f;
+	float height = 1.f;
+
+	sf::Vector2f operator()(const sf::Vector3f& position) const
+	{
+		float y = centre_y + (position.y - centre_y) * cos_tilt + (position.z - centre_z) * sin_tilt;
+		y -= height * std::floor((y - top) / height);
+		return { position.x, y };
+	}
+};
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+// message layer between the processes of a distributed run, ranks 0 .. size - 1. the only operation is a
+// collective exchange: every rank passes the same symmetric set of peers, sends one message to each of them and
+// receives one from each, so nobody can deadlock on a full socket buffer. byte counts include the framing
+class Transport
+{
+protected:
+	unsigned rank_;
+	unsigned size_;
+	size_t bytes_sent_ = 0;
+	size_t bytes_received_ = 0;
+
+public:
+	using Message = std::vector<std::byte>;
+
+	Transport(const unsigned rank, const unsigned size) : rank_(rank), size_(size) {}
+	virtual ~Transport() = default;
+
+	unsigned rank() const { return rank_; }
+	unsigned size() const { return size_; }
+	size_t bytes_sent() const { return bytes_sent_; }
+	size_t bytes_received() const { return bytes_received_; }
+
+	// outgoing and incoming are indexed by rank, only the entries of peers are sent and filled in
+	virtual bool exchange(const std::vector<unsigned>& peers, const std::vector<Message>& outgoing, std::vector<Message>& incoming) = 0;
+};
+
+
+// a socket per pair of ranks over loopback TCP ("tcp:127.0.0.1:47000", rank r listens on port + r) or, POSIX
+// only, unix domain sockets ("unix:/tmp/gravitation", rank r listens on /tmp/gravitation.r). a rank connects to
+// every lower rank and accepts every higher one
+class SocketTransport : public Transport
+{
+#ifdef _WIN32
+	using Socket = SOCKET;
+	using PollFd = WSAPOLLFD;
+	inline static const Socket no_socket = INVALID_SOCKET;
+#else
+	using Socket = int;
+	using PollFd = pollfd;
+	inline static constexpr Socket no_socket = -1;
+#endif
+#ifdef MSG_NOSIGNAL
+	inline static constexpr int send_flags = MSG_NOSIGNAL; // a rank that went away is an error, not SIGPIPE
+#else
+	inline static constexpr int send_flags = 0;
+#endif
+
+	std::vector<Socket> sockets_; // by rank, no_socket for this rank
+	bool unix_ = false;
+	std::string host_;
+	std::string path_;
+	unsigned port_ = 0;
+	bool connected_ = false;
+	std::chrono::duration<float> timeout_;
+
+public:
+	SocketTransport(const std::string& address, const unsigned rank, const unsigned size, const float timeout_seconds = 20.f)
+		: Transport(rank, size), sockets_(size, no_socket), timeout_(timeout_seconds)
+	{
+#ifdef _WIN32
+		WSADATA wsa{};
+		WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+		if (!parse(address))
+		{
+			std::cerr << "transport: bad address " << address << " (tcp:host:port or unix:path)\n";
+			return;
+		}
+
+		const Socket listener = listen_on(rank_);
+		if (listener == no_socket)
+		{
+			std::cerr << "transport: rank " << rank_ << " cannot listen\n";
+			return;
+		}
+
+		connected_ = true;
+		const auto deadline = std::chrono::steady_clock::now() + timeout_;
+		for (unsigned peer = 0; peer < rank_ && connected_; ++peer)
+		{
+			Socket socket = no_socket;
+			while (socket == no_socket && std::chrono::steady_clock::now() < deadline)
+			{
+				socket = connect_to(peer);
+				if (socket == no_socket)
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+			const std::uint32_t me = rank_;
+			connected_ = socket != no_socket && send_all(socket, &me, sizeof(me));
+			sockets_[peer] = socket;
+		}
+		for (unsigned accepted = rank_ + 1; accepted < size_ && connected_; ++accepted)
+		{
+			const Socket socket = readable_before(listener, deadline) ? accept(listener, nullptr, nullptr) : no_socket;
+			std::uint32_t peer = 0;
+			connected_ = socket != no_socket && readable_before(socket, deadline) && receive_all(socket, &peer, sizeof(peer))
+				&& peer > rank_ && peer < size_ && sockets_[peer] == no_socket;
+			if (connected_)
+				sockets_[peer] = socket;
+			else if (socket != no_socket)
+				close_socket(socket);
+		}
+		close_socket(listener);
+#ifndef _WIN32
+		if (unix_)
+			unlink(socket_path(rank_).c_str());
+#endif
+
+		for (const Socket socket : sockets_)
+		{
+			if (socket == no_socket)
+				continue;
+			set_non_blocking(socket);
+			if (!unix_)
+			{
+				const int one = 1;
+				setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+			}
+		}
+		if (!connected_)
+			std::cerr << "transport: rank " << rank_ << " could not reach every other rank\n";
+	}
+
+	~SocketTransport() override
+	{
+		for (const Socket socket : sockets_)
+			if (socket != no_socket)
+				close_socket(socket);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	SocketTransport(const SocketTransport&) = delete;
+	SocketTransport& operator=(const SocketTransport&) = delete;
+
+
+	bool is_connected() const { return connected_; }
+
+
+	// every message goes out as a 64 bit length and its bytes. sends and receives are interleaved with poll. a peer
+	// that has not finished within the timeout fails the exchange, a dead or hung rank does not hold up the others
+	bool exchange(const std::vector<unsigned>& peers, const std::vector<Message>& outgoing, std::vector<Message>& incoming) override
+	{
+		struct Transfer
+		{
+			std::uint64_t send_length;
+			size_t sent = 0;
+			std::uint64_t receive_length = 0;
+			size_t received = 0;
+		};
+		std::vector<Transfer> transfers(peers.size());
+		for (size_t p = 0; p < peers.size(); ++p)
+		{
+			transfers[p].send_length = outgoing[peers[p]].size();
+			incoming[peers[p]].clear();
+		}
+
+		constexpr size_t header = sizeof(std::uint64_t);
+		const auto deadline = std::chrono::steady_clock::now() + timeout_;
+		std::vector<PollFd> polls(peers.size());
+		while (true)
+		{
+			size_t pending = 0;
+			for (size_t p = 0; p < peers.size(); ++p)
+			{
+				const Transfer& transfer = transfers[p];
+				const bool sending = transfer.sent < header + transfer.send_length;
+				const bool receiving = transfer.received < header || transfer.received < header + transfer.receive_length;
+				polls[p] = PollFd{};
+				polls[p].fd = sockets_[peers[p]];
+				polls[p].events = static_cast<short>((sending ? POLLOUT : 0) | (receiving ? POLLIN : 0));
+				pending += sending || receiving;
+			}
+			if (pending == 0)
+				return true;
+
+			const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+#ifdef _WIN32
+			const int ready = WSAPoll(polls.data(), static_cast<ULONG>(polls.size()), static_cast<INT>(std::max<long long>(0, left.count())));
+#else
+			const int ready = poll(polls.data(), polls.size(), static_cast<int>(std::max<long long>(0, left.count())));
+#endif
+			if (ready < 0)
+				return false;
+			if (ready == 0)
+			{
+				std::cerr << "transport: rank " << rank_ << " timed out waiting for its peers\n";
+				return false;
+			}
+
+			for (size_t p = 0; p < peers.size(); ++p)
+			{
+				Transfer& transfer = transfers[p];
+				const Socket socket = sockets_[peers[p]];
+				if (polls[p].revents & (POLLERR | POLLNVAL))
+					return false;
+
+				if (polls[p].revents & POLLOUT)
+				{
+					const Message& message = outgoing[peers[p]];
+					const std::byte* data = transfer.sent < header
+						? reinterpret_cast<const std::byte*>(&transfer.send_length) + transfer.sent
+						: message.data() + (transfer.sent - header);
+					const size_t left = transfer.sent < header ? header - transfer.sent : header + message.size() - transfer.sent;
+					const long written = send(socket, reinterpret_cast<const char*>(data), static_cast<int>(left), send_flags);
+					if (written < 0 && !would_block())
+						return false;
+					transfer.sent += written > 0 ? static_cast<size_t>(written) : 0;
+					bytes_sent_ += written > 0 ? static_cast<size_t>(written) : 0;
+				}
+
+				const bool receiving = transfer.received < header || transfer.received < header + transfer.receive_length;
+				if (receiving && (polls[p].revents & (POLLIN | POLLHUP)))
+				{
+					Message& message = incoming[peers[p]];
+					std::byte* data;
+					size_t left;
+					if (transfer.received < header)
+					{
+						data = reinterpret_cast<std::byte*>(&transfer.receive_length) + transfer.received;
+						left = header - transfer.received;
+					}
+					else
+					{
+						data = message.data() + (transfer.received - header);
+						left = header + transfer.receive_length - transfer.received;
+					}
+					const long read = recv(socket, reinterpret_cast<char*>(data), static_cast<int>(left), 0);
+					if (read == 0 || (read < 0 && !would_block()))
+						return false;
+					if (read > 0)
+					{
+						const bool had_header = transfer.received >= header;
+						transfer.received += static_cast<size_t>(read);
+						bytes_received_ += static_cast<size_t>(read);
+						if (!had_header && transfer.received == header)
+							message.resize(transfer.receive_length);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	bool parse(const std::string& address)
+	{
+		if (address.starts_with("unix:"))
+		{
+#ifdef _WIN32
+			return false;
+#else
+			unix_ = true;
+			path_ = address.substr(5);
+			return !path_.empty();
+#endif
+		}
+		if (!address.starts_with("tcp:"))
+			return false;
+
+		const size_t colon = address.rfind(':');
+		if (colon <= 4)
+			return false;
+		host_ = address.substr(4, colon - 4);
+
+		// every rank's port, port + rank, has to exist
+		const char* first = address.data() + colon + 1;
+		const char* last = address.data() + address.size();
+		const auto [end, error] = std::from_chars(first, last, port_);
+		return error == std::errc() && end == last && port_ > 0 && port_ + size_ - 1 <= 65'535;
+	}
+
+	std::string socket_path(const unsigned rank) const
+	{
+		return path_ + "." + std::to_string(rank);
+	}
+
+	Socket listen_on(const unsigned rank) const
+	{
+		Socket socket = no_socket;
+#ifndef _WIN32
+		if (unix_)
+		{
+			sockaddr_un address{};
+			address.sun_family = AF_UNIX;
+			const std::string path = socket_path(rank);
+			std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+			unlink(path.c_str());
+			socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (socket != no_socket && bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(socket, static_cast<int>(size_)) == 0)
+				return socket;
+		}
+		else
+#endif
+		{
+			sockaddr_in address = tcp_address(rank);
+			socket = ::socket(AF_INET, SOCK_STREAM, 0);
+			const int one = 1;
+			if (socket != no_socket)
+				setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&one), sizeof(one));
+			if (socket != no_socket && bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(socket, static_cast<int>(size_)) == 0)
+				return socket;
+		}
+		if (socket != no_socket)
+			close_socket(socket);
+		return no_socket;
+	}
+
+	Socket connect_to(const unsigned rank) const
+	{
+		Socket socket = no_socket;
+		int result = -1;
+#ifndef _WIN32
+		if (unix_)
+		{
+			sockaddr_un address{};
+			address.sun_family = AF_UNIX;
+			std::strncpy(address.sun_path, socket_path(rank).c_str(), sizeof(address.sun_path) - 1);
+			socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (socket != no_socket)
+				result = connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+		}
+		else
+#endif
+		{
+			sockaddr_in address = tcp_address(rank);
+			socket = ::socket(AF_INET, SOCK_STREAM, 0);
+			if (socket != no_socket)
+				result = connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+		}
+		if (result == 0)
+			return socket;
+		if (socket != no_socket)
+			close_socket(socket);
+		return no_socket;
+	}
+
+	sockaddr_in tcp_address(const unsigned rank) const
+	{
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(static_cast<std::uint16_t>(port_ + rank));
+		inet_pton(AF_INET, host_.c_str(), &address.sin_addr);
+		return address;
+	}
+
+	// poll until the socket has something to read (a listener: a connection to accept), false at the deadline
+	template<typename Deadline>
+	static bool readable_before(const Socket socket, const Deadline deadline)
+	{
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+		PollFd poll_fd{};
+		poll_fd.fd = socket;
+		poll_fd.events = POLLIN;
+#ifdef _WIN32
+		return WSAPoll(&poll_fd, 1, static_cast<INT>(std::max<long long>(0, left.count()))) > 0 && (poll_fd.revents & POLLIN);
+#else
+		return poll(&poll_fd, 1, static_cast<int>(std::max<long long>(0, left.count()))) > 0 && (poll_fd.revents & POLLIN);
+#endif
+	}
+
+	// the handshake runs before the sockets are made non-blocking
+	static bool send_all(const Socket socket, const void* data, const size_t bytes)
+	{
+		size_t sent = 0;
+		while (sent < bytes)
+		{
+			const long written = send(socket, static_cast<const char*>(data) + sent, static_cast<int>(bytes - sent), send_flags);
+			if (written <= 0)
+				return false;
+			sent += static_cast<size_t>(written);
+		}
+		return true;
+	}
+
+	static bool receive_all(const Socket socket, void* data, const size_t bytes)
+	{
+		size_t received = 0;
+		while (received < bytes)
+		{
+			const long read = recv(socket, static_cast<char*>(data) + received, static_cast<int>(bytes - received), 0);
+			if (read <= 0)
+				return false;
+			received += static_cast<size_t>(read);
+		}
+		return true;
+	}
+
+	static void set_non_blocking(const Socket socket)
+	{
+#ifdef _WIN32
+		u_long on = 1;
+		ioctlsocket(socket, FIONBIO, &on);
+#else
+		fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	}
+
+	static bool would_block()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+	}
+
+	static void close_socket(const Socket socket)
+	{
+#ifdef _WIN32
+		closesocket(socket);
+#else
+		close(socket);
+#endif
+	}
+};